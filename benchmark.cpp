@@ -0,0 +1,363 @@
+/*----------------------------------------------------------------------------------*\
+ |																					|
+ | benchmark.cpp 																	|
+ |																					|
+ | Copyright (c) 2019 Richard Cookman												|
+ |																					|
+ | Permission is hereby granted, free of charge, to any person obtaining a copy		|
+ | of this software and associated documentation files (the "Software"), to deal	|
+ | in the Software without restriction, including without limitation the rights		|
+ | to use, copy, modify, merge, publish, distribute, sublicense, and/or sell		|
+ | copies of the Software, and to permit persons to whom the Software is			|
+ | furnished to do so, subject to the following conditions:							|
+ |																					|
+ | The above copyright notice and this permission notice shall be included in all	|
+ | copies or substantial portions of the Software.									|
+ |																					|
+ | THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR		|
+ | IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,			|
+ | FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE		|
+ | AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER			|
+ | LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,	|
+ | OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE	|
+ | SOFTWARE.																		|
+ |																					|
+\*----------------------------------------------------------------------------------*/
+
+//single threaded benchmarks of rcmalloc against the system malloc
+//prints json, one entry per workload and allocator, each run in its own process
+//so the peak rss is that of the run alone
+//usage: benchmark [workload filter] [iteration scale]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <map>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#define BENCH_HAS_FORK
+#endif
+
+#include "rcmalloc.hpp"
+
+using namespace std;
+using namespace rcmalloc;
+
+#define POOL_BENCH	10
+
+struct bench_object {
+	uint64_t a = 1;
+	uint64_t b = 2;
+	double c[4] = {};
+};
+
+//the allocators under test
+struct system_backend {
+	template<typename T>
+	using std_allocator = std::allocator<T>;
+
+	static const char* name() {
+		return "system";
+	}
+	static inline void* alloc(uint32_t size) {
+		return malloc(size);
+	}
+	static inline void dealloc(void* ptr, uint32_t /*size*/) {
+		free(ptr);
+	}
+	template<typename T>
+	static inline T* new_object() {
+		return new T();
+	}
+	template<typename T>
+	static inline void delete_object(T* ptr) {
+		delete ptr;
+	}
+};
+template<typename IAllocator>
+struct rc_backend {
+	template<typename T>
+	using std_allocator = default_std_allocator<T, default_allocator<T, IAllocator>>;
+
+	static inline void* alloc(uint32_t size) {
+		alloc_data dat = init_alloc_data_basic();
+		dat.size = size;
+		dat.size_of = 1;
+		return default_allocator<char, IAllocator>().allocate(&dat);
+	}
+	static inline void dealloc(void* ptr, uint32_t size) {
+		dealloc_data dat = init_dealloc_data_basic();
+		dat.ptr = ptr;
+		dat.size = size;
+		dat.size_of = 1;
+		default_allocator<char, IAllocator>().deallocate(&dat);
+	}
+	template<typename T>
+	static inline T* new_object() {
+		return allocate_init< default_allocator<T, IAllocator> >();
+	}
+	template<typename T>
+	static inline void delete_object(T* ptr) {
+		destruct_deallocate< default_allocator<T, IAllocator> >(ptr);
+	}
+};
+//the pool behind new_T/delete_T and default_std_allocator
+struct default_backend : rc_backend<rc_multi_threaded_internal_allocator<std::mutex, ALLOC_PAGE_SIZE, 0>> {
+	static const char* name() {
+		return "default_allocator";
+	}
+	template<typename T>
+	static inline T* new_object() {
+		return new_T<T>();
+	}
+	template<typename T>
+	static inline void delete_object(T* ptr) {
+		delete_T(ptr);
+	}
+};
+//unlocked
+struct internal_backend : rc_backend<rc_internal_allocator<ALLOC_PAGE_SIZE, POOL_BENCH>> {
+	static const char* name() {
+		return "rc_internal_allocator";
+	}
+};
+
+//xorshift, the same sequence for every allocator
+struct bench_rng {
+	uint64_t s = 0x9E3779B97F4A7C15ULL;
+
+	inline uint32_t next() {
+		s ^= s << 13;
+		s ^= s >> 7;
+		s ^= s << 17;
+		return (uint32_t)(s >> 32);
+	}
+	//log uniform in [lo, hi)
+	inline uint32_t size(uint32_t lo, uint32_t hi) {
+		uint32_t bits = highest_bit(hi / lo);
+		uint32_t sz = lo << (next() % (bits + 1));
+		sz += next() % sz;
+		return sz < hi ? sz : hi - 1;
+	}
+};
+
+//touch the memory so the allocation isn't optimised away and is resident
+static inline void touch(void* ptr) {
+	*(volatile char*)ptr = 1;
+}
+
+//workloads, each returns the number of operations done
+template<typename B, uint32_t Size>
+uint64_t bench_fixed(uint32_t scale) {
+	uint64_t iters = 2000000ULL * scale;
+	for(uint64_t i = 0; i < iters; ++i) {
+		void* p = B::alloc(Size);
+		touch(p);
+		B::dealloc(p, Size);
+	}
+	return iters * 2;
+}
+template<typename B>
+uint64_t bench_random_churn(uint32_t scale) {
+	const uint32_t slots = 8192;
+	vector<void*> ptrs(slots, nullptr);
+	vector<uint32_t> sizes(slots, 0);
+	bench_rng rng;
+	uint64_t iters = 2000000ULL * scale, ops = 0;
+	for(uint64_t i = 0; i < iters; ++i) {
+		uint32_t s = rng.next() % slots;
+		if(ptrs[s] != nullptr) {
+			B::dealloc(ptrs[s], sizes[s]);
+			++ops;
+		}
+		sizes[s] = rng.size(8, 8192);
+		ptrs[s] = B::alloc(sizes[s]);
+		touch(ptrs[s]);
+		++ops;
+	}
+	for(uint32_t s = 0; s < slots; ++s)
+		if(ptrs[s] != nullptr)
+			B::dealloc(ptrs[s], sizes[s]);
+	return ops + slots;
+}
+template<typename B, bool Lifo>
+uint64_t bench_order(uint32_t scale) {
+	const uint32_t count = 10000;
+	vector<void*> ptrs(count);
+	vector<uint32_t> sizes(count);
+	bench_rng rng;
+	for(uint32_t i = 0; i < count; ++i)
+		sizes[i] = rng.size(16, 512);
+	uint32_t reps = 100 * scale;
+	for(uint32_t r = 0; r < reps; ++r) {
+		for(uint32_t i = 0; i < count; ++i) {
+			ptrs[i] = B::alloc(sizes[i]);
+			touch(ptrs[i]);
+		}
+		if(Lifo) {
+			for(uint32_t i = count; i-- > 0;)
+				B::dealloc(ptrs[i], sizes[i]);
+		} else {
+			for(uint32_t i = 0; i < count; ++i)
+				B::dealloc(ptrs[i], sizes[i]);
+		}
+	}
+	return (uint64_t)reps * count * 2;
+}
+template<typename B>
+uint64_t bench_new_delete(uint32_t scale) {
+	const uint32_t count = 1000;
+	bench_object* objs[count];
+	uint32_t reps = 1000 * scale;
+	for(uint32_t r = 0; r < reps; ++r) {
+		for(uint32_t i = 0; i < count; ++i)
+			objs[i] = B::template new_object<bench_object>();
+		for(uint32_t i = 0; i < count; ++i)
+			B::delete_object(objs[i]);
+	}
+	return (uint64_t)reps * count * 2;
+}
+//containers count one operation per element inserted or removed
+template<typename B>
+uint64_t bench_vector(uint32_t scale) {
+	uint32_t reps = 20 * scale;
+	const uint32_t count = 1000000;
+	for(uint32_t r = 0; r < reps; ++r) {
+		vector<uint32_t, typename B::template std_allocator<uint32_t>> v;
+		for(uint32_t i = 0; i < count; ++i)
+			v.push_back(i);
+		touch(&v.back());
+	}
+	return (uint64_t)reps * count;
+}
+template<typename B>
+uint64_t bench_list(uint32_t scale) {
+	uint32_t reps = 20 * scale;
+	const uint32_t count = 100000;
+	list<uint32_t, typename B::template std_allocator<uint32_t>> l;
+	for(uint32_t r = 0; r < reps; ++r) {
+		for(uint32_t i = 0; i < count; ++i)
+			l.push_back(i);
+		while(!l.empty())
+			l.pop_front();
+	}
+	return (uint64_t)reps * count * 2;
+}
+template<typename B>
+uint64_t bench_map(uint32_t scale) {
+	typedef pair<const uint32_t, uint32_t> value_type;
+	uint32_t reps = 10 * scale;
+	const uint32_t count = 100000;
+	map<uint32_t, uint32_t, less<uint32_t>, typename B::template std_allocator<value_type>> m;
+	bench_rng rng;
+	for(uint32_t r = 0; r < reps; ++r) {
+		for(uint32_t i = 0; i < count; ++i)
+			m[rng.next()] = i;
+		m.clear();
+	}
+	return (uint64_t)reps * count * 2;
+}
+
+struct bench_result {
+	uint64_t ops;
+	double ns_per_op;
+	long peak_rss_kb;
+};
+
+static bench_result run_timed(uint64_t (*fn)(uint32_t), uint32_t scale) {
+	bench_result rtn;
+	auto start = chrono::steady_clock::now();
+	rtn.ops = fn(scale);
+	auto end = chrono::steady_clock::now();
+	rtn.ns_per_op = chrono::duration<double, nano>(end - start).count() / (double)rtn.ops;
+	rtn.peak_rss_kb = 0;
+#if defined(BENCH_HAS_FORK)
+	struct rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage) == 0)
+		rtn.peak_rss_kb = usage.ru_maxrss;
+#if defined(__APPLE__)
+	//bytes on macos
+	rtn.peak_rss_kb /= 1024;
+#endif
+#endif
+	return rtn;
+}
+//in a child process where there is fork, 0 ops on failure
+static bench_result run_isolated(uint64_t (*fn)(uint32_t), uint32_t scale) {
+#if defined(BENCH_HAS_FORK)
+	bench_result rtn = {0, 0, 0};
+	int fds[2];
+	if(pipe(fds) != 0)
+		return rtn;
+	fflush(stdout);
+	pid_t pid = fork();
+	if(pid == 0) {
+		close(fds[0]);
+		bench_result res = run_timed(fn, scale);
+		ssize_t wr = write(fds[1], &res, sizeof(res));
+		_exit(wr == (ssize_t)sizeof(res) ? 0 : 1);
+	}
+	close(fds[1]);
+	if(pid > 0) {
+		if(read(fds[0], &rtn, sizeof(rtn)) != (ssize_t)sizeof(rtn))
+			rtn.ops = 0;
+		waitpid(pid, 0, 0);
+	}
+	close(fds[0]);
+	return rtn;
+#else
+	return run_timed(fn, scale);
+#endif
+}
+
+struct bench_case {
+	const char* workload;
+	uint64_t (*fn[3])(uint32_t);
+};
+#define BENCH_CASE(name, ...) \
+	{name, {__VA_ARGS__<system_backend>, __VA_ARGS__<default_backend>, __VA_ARGS__<internal_backend>}}
+#define BENCH_CASE_N(name, fn, n) \
+	{name, {fn<system_backend, n>, fn<default_backend, n>, fn<internal_backend, n>}}
+
+int main(int argc, char** argv) {
+	const char* filter = argc > 1 ? argv[1] : "";
+	uint32_t scale = argc > 2 ? (uint32_t)atoi(argv[2]) : 1;
+	if(scale == 0) scale = 1;
+
+	const char* allocators[3] = {system_backend::name(), default_backend::name(), internal_backend::name()};
+	bench_case cases[] = {
+		BENCH_CASE_N("fixed_16", bench_fixed, 16),
+		BENCH_CASE_N("fixed_64", bench_fixed, 64),
+		BENCH_CASE_N("fixed_256", bench_fixed, 256),
+		BENCH_CASE_N("fixed_4096", bench_fixed, 4096),
+		BENCH_CASE("random_churn", bench_random_churn),
+		BENCH_CASE_N("lifo", bench_order, true),
+		BENCH_CASE_N("fifo", bench_order, false),
+		BENCH_CASE("new_delete", bench_new_delete),
+		BENCH_CASE("std_vector", bench_vector),
+		BENCH_CASE("std_list", bench_list),
+		BENCH_CASE("std_map", bench_map),
+	};
+
+	printf("{\n\t\"scale\": %u,\n\t\"benchmarks\": [", scale);
+	bool first = true;
+	for(const bench_case& bc : cases) {
+		if(strstr(bc.workload, filter) == 0)
+			continue;
+		for(uint32_t i = 0; i < 3; ++i) {
+			bench_result res = run_isolated(bc.fn[i], scale);
+			printf("%s\n\t\t{\"workload\": \"%s\", \"allocator\": \"%s\", \"ops\": %llu, \"ns_per_op\": %.3f, \"peak_rss_kb\": %ld}",
+				   first ? "" : ",", bc.workload, allocators[i],
+				   (unsigned long long)res.ops, res.ns_per_op, res.peak_rss_kb);
+			first = false;
+		}
+	}
+	printf("\n\t]\n}\n");
+	return 0;
+}
@@ -0,0 +1,433 @@
+/*----------------------------------------------------------------------------------*\
+ |																					|
+ | benchmark_mt.cpp																	|
+ |																					|
+ | Copyright (c) 2019 Richard Cookman												|
+ |																					|
+ | Permission is hereby granted, free of charge, to any person obtaining a copy		|
+ | of this software and associated documentation files (the "Software"), to deal	|
+ | in the Software without restriction, including without limitation the rights		|
+ | to use, copy, modify, merge, publish, distribute, sublicense, and/or sell		|
+ | copies of the Software, and to permit persons to whom the Software is			|
+ | furnished to do so, subject to the following conditions:							|
+ |																					|
+ | The above copyright notice and this permission notice shall be included in all	|
+ | copies or substantial portions of the Software.									|
+ |																					|
+ | THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR		|
+ | IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,			|
+ | FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE		|
+ | AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER			|
+ | LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,	|
+ | OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE	|
+ | SOFTWARE.																		|
+ |																					|
+\*----------------------------------------------------------------------------------*/
+
+//multithreaded scalability benchmarks - larson, threadtest, cache-scratch and producer/consumer
+//prints json with ops/sec, latency percentiles and peak rss for each thread count
+//each run is in its own process so the peak rss is that of the run alone
+//usage: benchmark_mt [workload filter] [max threads] [iteration scale]
+//to compare lock strategies add a run_pools<YourMutex>(...) line to main
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#define BENCH_HAS_FORK
+#endif
+
+#include "rcmalloc.hpp"
+
+using namespace std;
+using namespace rcmalloc;
+
+#define POOL_BENCH_MT	11
+#define POOL_BENCH_TC	12
+#define POOL_BENCH_SH	13
+
+//a test and test-and-set lock, an example of a user supplied Mtx
+struct bench_spin_lock {
+	std::atomic<bool> locked{false};
+
+	void lock() {
+		while(locked.exchange(true, std::memory_order_acquire))
+			while(locked.load(std::memory_order_relaxed))
+				std::this_thread::yield();
+	}
+	bool try_lock() {
+		return !locked.load(std::memory_order_relaxed) &&
+			   !locked.exchange(true, std::memory_order_acquire);
+	}
+	void unlock() {
+		locked.store(false, std::memory_order_release);
+	}
+};
+
+struct system_backend {
+	static inline void* alloc(uint32_t size) {
+		return malloc(size);
+	}
+	static inline void dealloc(void* ptr, uint32_t /*size*/) {
+		free(ptr);
+	}
+};
+template<typename IAllocator>
+struct pool_backend {
+	static inline void* alloc(uint32_t size) {
+		alloc_data dat = init_alloc_data_basic();
+		dat.size = size;
+		dat.size_of = 1;
+		return default_allocator<char, IAllocator>().allocate(&dat);
+	}
+	static inline void dealloc(void* ptr, uint32_t size) {
+		dealloc_data dat = init_dealloc_data_basic();
+		dat.ptr = ptr;
+		dat.size = size;
+		dat.size_of = 1;
+		default_allocator<char, IAllocator>().deallocate(&dat);
+	}
+};
+
+struct bench_rng {
+	uint64_t s;
+
+	bench_rng(uint64_t seed) : s(seed * 0x9E3779B97F4A7C15ULL + 1) {}
+	inline uint32_t next() {
+		s ^= s << 13;
+		s ^= s >> 7;
+		s ^= s << 17;
+		return (uint32_t)(s >> 32);
+	}
+	inline uint32_t size(uint32_t lo, uint32_t hi) {
+		return lo + next() % (hi - lo);
+	}
+};
+
+//every LATENCY_SAMPLE'th operation of a thread is timed
+const uint32_t LATENCY_SAMPLE = 16;
+struct thread_stats {
+	uint64_t ops = 0;
+	vector<uint32_t> latency;
+};
+template<typename B>
+inline void* timed_alloc(thread_stats& ts, uint32_t size) {
+	if(++ts.ops % LATENCY_SAMPLE != 0) {
+		void* rtn = B::alloc(size);
+		*(volatile char*)rtn = 1;
+		return rtn;
+	}
+	auto start = chrono::steady_clock::now();
+	void* rtn = B::alloc(size);
+	auto end = chrono::steady_clock::now();
+	*(volatile char*)rtn = 1;
+	ts.latency.push_back((uint32_t)chrono::duration_cast<chrono::nanoseconds>(end - start).count());
+	return rtn;
+}
+template<typename B>
+inline void timed_dealloc(thread_stats& ts, void* ptr, uint32_t size) {
+	if(++ts.ops % LATENCY_SAMPLE != 0) {
+		B::dealloc(ptr, size);
+		return;
+	}
+	auto start = chrono::steady_clock::now();
+	B::dealloc(ptr, size);
+	auto end = chrono::steady_clock::now();
+	ts.latency.push_back((uint32_t)chrono::duration_cast<chrono::nanoseconds>(end - start).count());
+}
+
+//workloads fill in one thread_stats per thread
+//larson - each thread replaces random objects in its own set, every round the set
+//is handed to a new thread so objects are freed by threads that didn't allocate them
+const uint32_t LARSON_SLOTS = 1000;
+const uint32_t LARSON_ROUND_OPS = 10000;
+template<typename B>
+void larson_round(vector<void*>& ptrs, vector<uint32_t>& sizes, bench_rng& rng, thread_stats& ts) {
+	for(uint32_t i = 0; i < LARSON_ROUND_OPS; ++i) {
+		uint32_t s = rng.next() % LARSON_SLOTS;
+		timed_dealloc<B>(ts, ptrs[s], sizes[s]);
+		sizes[s] = rng.size(16, 512);
+		ptrs[s] = timed_alloc<B>(ts, sizes[s]);
+	}
+}
+template<typename B>
+void bench_larson(uint32_t threads, uint32_t scale, vector<thread_stats>& stats) {
+	vector<thread> drivers;
+	for(uint32_t t = 0; t < threads; ++t)
+		drivers.emplace_back([t, scale, &stats]() {
+			bench_rng rng(t + 1);
+			vector<void*> ptrs(LARSON_SLOTS);
+			vector<uint32_t> sizes(LARSON_SLOTS);
+			for(uint32_t s = 0; s < LARSON_SLOTS; ++s) {
+				sizes[s] = rng.size(16, 512);
+				ptrs[s] = timed_alloc<B>(stats[t], sizes[s]);
+			}
+			for(uint32_t r = 0; r < 20 * scale; ++r) {
+				thread_stats ts;
+				thread next([&]() { larson_round<B>(ptrs, sizes, rng, ts); });
+				next.join();
+				stats[t].ops += ts.ops;
+				stats[t].latency.insert(stats[t].latency.end(), ts.latency.begin(), ts.latency.end());
+			}
+			for(uint32_t s = 0; s < LARSON_SLOTS; ++s)
+				timed_dealloc<B>(stats[t], ptrs[s], sizes[s]);
+		});
+	for(thread& th : drivers)
+		th.join();
+}
+//threadtest - each thread allocates a batch of objects then frees them all
+template<typename B>
+void bench_threadtest(uint32_t threads, uint32_t scale, vector<thread_stats>& stats) {
+	const uint32_t count = 10000;
+	uint32_t iters = 100 * scale / threads + 1;
+	vector<thread> workers;
+	for(uint32_t t = 0; t < threads; ++t)
+		workers.emplace_back([t, iters, &stats]() {
+			vector<void*> ptrs(count);
+			for(uint32_t i = 0; i < iters; ++i) {
+				for(uint32_t j = 0; j < count; ++j)
+					ptrs[j] = timed_alloc<B>(stats[t], 64);
+				for(uint32_t j = 0; j < count; ++j)
+					timed_dealloc<B>(stats[t], ptrs[j], 64);
+			}
+		});
+	for(thread& th : workers)
+		th.join();
+}
+//cache-scratch - neighbouring small objects are handed to different threads, each
+//frees its object and then allocates and writes its own, false sharing shows up as slowdown
+template<typename B>
+void bench_cache_scratch(uint32_t threads, uint32_t scale, vector<thread_stats>& stats) {
+	const uint32_t size = 8;
+	const uint32_t writes = 1000;
+	uint32_t iters = 20000 * scale / threads + 1;
+	vector<void*> initial(threads);
+	for(uint32_t t = 0; t < threads; ++t)
+		initial[t] = B::alloc(size);
+	vector<thread> workers;
+	for(uint32_t t = 0; t < threads; ++t)
+		workers.emplace_back([t, iters, &initial, &stats]() {
+			timed_dealloc<B>(stats[t], initial[t], size);
+			for(uint32_t i = 0; i < iters; ++i) {
+				volatile char* p = (volatile char*)timed_alloc<B>(stats[t], size);
+				for(uint32_t w = 0; w < writes; ++w)
+					p[w % size] = (char)w;
+				timed_dealloc<B>(stats[t], (void*)p, size);
+			}
+		});
+	for(thread& th : workers)
+		th.join();
+}
+//producer/consumer - every thread allocates for the next thread and frees what the
+//previous thread allocated, all frees are cross thread
+const uint32_t RING_SIZE = 1024;
+struct alignas(CACHE_LINE_SIZE) bench_ring {
+	std::atomic<uint32_t> head{0};
+	alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> tail{0};
+	void* ptrs[RING_SIZE];
+	uint32_t sizes[RING_SIZE];
+
+	bool push(void* ptr, uint32_t size) {
+		uint32_t t = tail.load(std::memory_order_relaxed);
+		if(t - head.load(std::memory_order_acquire) == RING_SIZE)
+			return false;
+		ptrs[t % RING_SIZE] = ptr;
+		sizes[t % RING_SIZE] = size;
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+	bool pop(void*& ptr, uint32_t& size) {
+		uint32_t h = head.load(std::memory_order_relaxed);
+		if(h == tail.load(std::memory_order_acquire))
+			return false;
+		ptr = ptrs[h % RING_SIZE];
+		size = sizes[h % RING_SIZE];
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+};
+template<typename B>
+void bench_producer_consumer(uint32_t threads, uint32_t scale, vector<thread_stats>& stats) {
+	uint64_t per_thread = 2000000ULL * scale / threads + 1;
+	vector<bench_ring> rings(threads);
+	std::atomic<uint64_t> consumed{0};
+	uint64_t total = per_thread * threads;
+	vector<thread> workers;
+	for(uint32_t t = 0; t < threads; ++t)
+		workers.emplace_back([t, threads, per_thread, total, &rings, &consumed, &stats]() {
+			bench_rng rng(t + 1);
+			bench_ring& mine = rings[t];
+			bench_ring& next = rings[(t + 1) % threads];
+			void* ptr;
+			uint32_t size;
+			auto drain = [&]() {
+				uint32_t n = 0;
+				while(mine.pop(ptr, size)) {
+					timed_dealloc<B>(stats[t], ptr, size);
+					++n;
+				}
+				if(n > 0)
+					consumed.fetch_add(n, std::memory_order_relaxed);
+			};
+			for(uint64_t i = 0; i < per_thread; ++i) {
+				size = rng.size(16, 256);
+				void* nptr = timed_alloc<B>(stats[t], size);
+				//the next thread is behind, free ours while it catches up
+				while(!next.push(nptr, size)) {
+					drain();
+					std::this_thread::yield();
+				}
+				if(i % 64 == 0)
+					drain();
+			}
+			while(consumed.load(std::memory_order_relaxed) < total) {
+				drain();
+				std::this_thread::yield();
+			}
+		});
+	for(thread& th : workers)
+		th.join();
+}
+
+struct bench_result {
+	uint64_t ops;
+	double ops_per_sec;
+	uint32_t p50_ns;
+	uint32_t p99_ns;
+	uint32_t p999_ns;
+	long peak_rss_kb;
+};
+typedef void (*bench_fn)(uint32_t, uint32_t, vector<thread_stats>&);
+
+static uint32_t percentile(const vector<uint32_t>& sorted, double p) {
+	if(sorted.empty()) return 0;
+	return sorted[std::min((size_t)(p * sorted.size()), sorted.size() - 1)];
+}
+static bench_result run_timed(bench_fn fn, uint32_t threads, uint32_t scale) {
+	vector<thread_stats> stats(threads);
+	auto start = chrono::steady_clock::now();
+	fn(threads, scale, stats);
+	auto end = chrono::steady_clock::now();
+
+	bench_result rtn;
+	rtn.ops = 0;
+	vector<uint32_t> latency;
+	for(const thread_stats& ts : stats) {
+		rtn.ops += ts.ops;
+		latency.insert(latency.end(), ts.latency.begin(), ts.latency.end());
+	}
+	std::sort(latency.begin(), latency.end());
+	rtn.ops_per_sec = rtn.ops / chrono::duration<double>(end - start).count();
+	rtn.p50_ns = percentile(latency, 0.5);
+	rtn.p99_ns = percentile(latency, 0.99);
+	rtn.p999_ns = percentile(latency, 0.999);
+	rtn.peak_rss_kb = 0;
+#if defined(BENCH_HAS_FORK)
+	struct rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage) == 0)
+		rtn.peak_rss_kb = usage.ru_maxrss;
+#if defined(__APPLE__)
+	//bytes on macos
+	rtn.peak_rss_kb /= 1024;
+#endif
+#endif
+	return rtn;
+}
+//in a child process where there is fork, 0 ops on failure
+static bench_result run_isolated(bench_fn fn, uint32_t threads, uint32_t scale) {
+#if defined(BENCH_HAS_FORK)
+	bench_result rtn = {0, 0, 0, 0, 0, 0};
+	int fds[2];
+	if(pipe(fds) != 0)
+		return rtn;
+	fflush(stdout);
+	pid_t pid = fork();
+	if(pid == 0) {
+		close(fds[0]);
+		bench_result res = run_timed(fn, threads, scale);
+		ssize_t wr = write(fds[1], &res, sizeof(res));
+		_exit(wr == (ssize_t)sizeof(res) ? 0 : 1);
+	}
+	close(fds[1]);
+	if(pid > 0) {
+		if(read(fds[0], &rtn, sizeof(rtn)) != (ssize_t)sizeof(rtn))
+			rtn.ops = 0;
+		waitpid(pid, 0, 0);
+	}
+	close(fds[0]);
+	return rtn;
+#else
+	return run_timed(fn, threads, scale);
+#endif
+}
+
+struct bench_options {
+	const char* filter;
+	uint32_t max_threads;
+	uint32_t scale;
+	bool first;
+};
+
+template<typename B>
+void run_workloads(bench_options& opt, const char* allocator, const char* mutex) {
+	struct {
+		const char* name;
+		bench_fn fn;
+	} workloads[] = {
+		{"larson", bench_larson<B>},
+		{"threadtest", bench_threadtest<B>},
+		{"cache_scratch", bench_cache_scratch<B>},
+		{"producer_consumer", bench_producer_consumer<B>},
+	};
+	for(auto& wl : workloads) {
+		if(strstr(wl.name, opt.filter) == 0)
+			continue;
+		for(uint32_t threads = 1; threads <= opt.max_threads; threads *= 2) {
+			bench_result res = run_isolated(wl.fn, threads, opt.scale);
+			printf("%s\n\t\t{\"workload\": \"%s\", \"allocator\": \"%s\", \"mutex\": \"%s\", \"threads\": %u, "
+				   "\"ops\": %llu, \"ops_per_sec\": %.0f, \"p50_ns\": %u, \"p99_ns\": %u, \"p999_ns\": %u, \"peak_rss_kb\": %ld}",
+				   opt.first ? "" : ",", wl.name, allocator, mutex, threads,
+				   (unsigned long long)res.ops, res.ops_per_sec, res.p50_ns, res.p99_ns, res.p999_ns, res.peak_rss_kb);
+			opt.first = false;
+		}
+	}
+}
+//the pools with the lock type Mtx
+template<typename Mtx>
+void run_pools(bench_options& opt, const char* mutex) {
+	run_workloads<pool_backend<rc_multi_threaded_internal_allocator<Mtx, ALLOC_PAGE_SIZE, POOL_BENCH_MT>>>(
+		opt, "rc_multi_threaded_internal_allocator", mutex);
+	run_workloads<pool_backend<rc_thread_cached_internal_allocator<Mtx, ALLOC_PAGE_SIZE, POOL_BENCH_TC>>>(
+		opt, "rc_thread_cached_internal_allocator", mutex);
+	run_workloads<pool_backend<rc_sharded_internal_allocator<Mtx, ALLOC_PAGE_SIZE, POOL_BENCH_SH>>>(
+		opt, "rc_sharded_internal_allocator", mutex);
+}
+
+int main(int argc, char** argv) {
+	bench_options opt;
+	opt.filter = argc > 1 ? argv[1] : "";
+	opt.max_threads = argc > 2 ? (uint32_t)atoi(argv[2]) : std::thread::hardware_concurrency();
+	opt.scale = argc > 3 ? (uint32_t)atoi(argv[3]) : 1;
+	opt.first = true;
+	if(opt.max_threads == 0) opt.max_threads = 1;
+	if(opt.scale == 0) opt.scale = 1;
+
+	printf("{\n\t\"scale\": %u,\n\t\"benchmarks\": [", opt.scale);
+	run_workloads<system_backend>(opt, "system", "");
+	run_pools<std::mutex>(opt, "std::mutex");
+	run_pools<bench_spin_lock>(opt, "bench_spin_lock");
+	run_pools<ticket_lock>(opt, "ticket_lock");
+	run_pools<mcs_lock>(opt, "mcs_lock");
+	run_pools<futex_mutex>(opt, "futex_mutex");
+	printf("\n\t]\n}\n");
+	return 0;
+}
@@ -26,8 +26,12 @@
 
 #include <iostream>
 #include <vector>
+#include <thread>
+#include <functional>
+#include <errno.h>
 
 #include "rcmalloc.hpp"
+#include "rcmalloc_c.h"
 
 using namespace std;
 using namespace rcmalloc;
@@ -39,6 +43,52 @@ struct a_struct {
 
 #define POOLB		1
 #define POOLC		2
+#define POOLD		3
+#define POOLE		4
+#define POOLF		5
+#define POOLG		6
+#define POOLH		7
+#define POOLI		8
+#define POOLJ		9
+#define POOLK		10
+#define POOLL		11
+#define POOLM		12
+#define POOLN		13
+#define POOLO		14
+#define POOLP		15
+#define POOLQ		16
+#define POOLR		17
+#define POOLS		18
+#define POOLT		19
+#define POOLU		20
+#define POOLV		21
+#define POOLW		22
+#define POOLX		23
+#define POOLY		24
+#define POOLZ		25
+
+//two threads allocating and freeing through a pool locked by Mtx
+template<typename Mtx, unsigned PoolID>
+void lock_pool_test() {
+	typedef rc_multi_threaded_internal_allocator<Mtx, ALLOC_PAGE_SIZE, PoolID> lock_pool;
+	auto work = []() {
+		for(unsigned j = 0; j < 100; ++j) {
+			a_struct* lst[50];
+			for(unsigned i = 0; i < 50; ++i)
+				lst[i] = allocate_init< default_allocator<a_struct, lock_pool> >();
+			for(unsigned i = 0; i < 50; ++i)
+				destruct_deallocate< default_allocator<a_struct, lock_pool> >(lst[i]);
+		}
+	};
+	thread t1(work);
+	thread t2(work);
+	t1.join();
+	t2.join();
+
+	alloc_stats st;
+	get_global_object<lock_pool>()->get_stats(&st);
+	cout << "live " << st.bytes_live << endl;
+}
 
 int main() {
 	//use new/new[] and delete/delete[] replacements
@@ -152,6 +202,760 @@ int main() {
 		vec.push_back(a_struct{350, 30.0f});
 		vec.push_back(a_struct{180, 72.0f});
 	}
+	//small allocations served from per thread caches - no lock taken on the fast path
+	cout << "Test 5" << endl;
+	{
+		auto work = []() {
+			for(unsigned j = 0; j < 100; ++j) {
+				a_struct* l5[50];
+				for(unsigned i = 0; i < 50; ++i)
+					l5[i] = allocate_init< default_allocator<a_struct, rc_thread_cached_internal_allocator<std::mutex, ALLOC_PAGE_SIZE, POOLD>> >();
+				for(unsigned i = 0; i < 50; ++i)
+					destruct_deallocate< default_allocator<a_struct, rc_thread_cached_internal_allocator<std::mutex, ALLOC_PAGE_SIZE, POOLD>> >(l5[i]);
+			}
+		};
+		thread t1(work);
+		thread t2(work);
+		t1.join();
+		t2.join();
+	}
+	cout << "Test 6" << endl;
+	{
+		typedef rc_internal_allocator<HUGE_PAGE_SIZE, POOLE> hp_pool;
+		static mmap_page_source hpsrc(HUGE_PAGES_ADVISE);
+		get_global_object<hp_pool>()->set_page_source(&hpsrc);
+
+		a_struct* l6[1000];
+		for(unsigned i = 0; i < 1000; ++i)
+			l6[i] = allocate_init< default_allocator<a_struct, hp_pool> >();
+		for(unsigned i = 0; i < 1000; ++i)
+			destruct_deallocate< default_allocator<a_struct, hp_pool> >(l6[i]);
+	}
+	//allocator statistics
+	cout << "Test 7" << endl;
+	{
+		typedef rc_multi_threaded_internal_allocator<std::mutex, ALLOC_PAGE_SIZE, POOLF> stats_pool;
+
+		a_struct* l7[1000];
+		for(unsigned i = 0; i < 1000; ++i)
+			l7[i] = allocate_init< default_allocator<a_struct, stats_pool> >();
+
+		alloc_stats st;
+		get_global_object<stats_pool>()->get_stats(&st);
+		cout << "mapped " << st.bytes_mapped << " live " << st.bytes_live
+			 << " free " << st.bytes_free << " blocks " << st.block_count << endl;
+
+		for(unsigned i = 0; i < 1000; ++i)
+			destruct_deallocate< default_allocator<a_struct, stats_pool> >(l7[i]);
+	}
+	//many objects of one size at once, the lock is taken once
+	cout << "Test 8" << endl;
+	{
+		default_allocator<char, rc_multi_threaded_internal_allocator<std::mutex, ALLOC_PAGE_SIZE, POOLG>> G;
+
+		alloc_data allcdt = init_alloc_data<char>();
+		allcdt.size = 2000;
+		void* l8[500];
+		uint32_t cnt = G.allocate_batch(&allcdt, l8, 500);
+		for(unsigned i = 0; i < cnt; ++i)
+			memset(l8[i], (int)i, 2000);
+
+		dealloc_data deallcdt = init_dealloc_data<char>();
+		deallcdt.size = 2000;
+		G.deallocate_batch(&deallcdt, l8, cnt);
+	}
+	//freed on another thread - queued for the owning arena without taking its lock
+	//and given back on the arena's next allocation
+	cout << "Test 9" << endl;
+	{
+		default_allocator<char, rc_sharded_internal_allocator<std::mutex, ALLOC_PAGE_SIZE, POOLH>> H;
+
+		alloc_data allcdt = init_alloc_data<char>();
+		allcdt.size = 64;
+		void* l9[1000];
+		for(unsigned i = 0; i < 1000; ++i)
+			l9[i] = H.allocate(&allcdt);
+		thread t1([&]() {
+			dealloc_data deallcdt = init_dealloc_data<char>();
+			deallcdt.size = 64;
+			for(unsigned i = 0; i < 1000; ++i) {
+				deallcdt.ptr = l9[i];
+				H.deallocate(&deallcdt);
+			}
+		});
+		t1.join();
+		l9[0] = H.allocate(&allcdt);
+
+		alloc_stats st;
+		H.get_allocator().do_get_stats(&st);
+		cout << "remote frees " << st.remote_frees << endl;
+
+		dealloc_data deallcdt = init_dealloc_data<char>();
+		deallcdt.ptr = l9[0];
+		deallcdt.size = 64;
+		H.deallocate(&deallcdt);
+	}
+	//empty blocks given back by one pool are reused by another before mapping more
+	cout << "Test 10" << endl;
+	{
+		typedef rc_internal_allocator<ALLOC_PAGE_SIZE, POOLI> pool_i;
+		typedef rc_internal_allocator<ALLOC_PAGE_SIZE, POOLJ> pool_j;
+		depot_page_source* depot = (depot_page_source*)default_page_source();
+
+		a_struct* l10[1000];
+		for(unsigned i = 0; i < 1000; ++i)
+			l10[i] = allocate_init_count< default_allocator<a_struct, pool_i> >(200);
+		for(unsigned i = 0; i < 1000; ++i)
+			destruct_deallocate_count< default_allocator<a_struct, pool_i> >(l10[i], 200);
+		get_global_object<pool_i>()->trim();
+		cout << "depot holds " << depot->held_bytes() << endl;
+
+		for(unsigned i = 0; i < 1000; ++i)
+			l10[i] = allocate_init_count< default_allocator<a_struct, pool_j> >(200);
+		cout << "depot holds " << depot->held_bytes() << endl;
+		for(unsigned i = 0; i < 1000; ++i)
+			destruct_deallocate_count< default_allocator<a_struct, pool_j> >(l10[i], 200);
+	}
+	//hot per thread counters each on their own cache lines, no false sharing
+	cout << "Test 11" << endl;
+	{
+		typedef rc_cache_line_isolated_allocator<rc_sharded_internal_allocator<std::mutex, ALLOC_PAGE_SIZE, POOLK>> isolated_pool;
+
+		a_struct* l11[4];
+		for(unsigned i = 0; i < 4; ++i)
+			l11[i] = allocate_init< default_allocator<a_struct, isolated_pool> >();
+		auto work = [](a_struct* cnt) {
+			for(unsigned j = 0; j < 100000; ++j)
+				++cnt->a;
+		};
+		thread t1(work, l11[0]);
+		thread t2(work, l11[1]);
+		t1.join();
+		t2.join();
+		for(unsigned i = 0; i < 4; ++i)
+			destruct_deallocate< default_allocator<a_struct, isolated_pool> >(l11[i]);
+	}
+	//arenas on each numa node, with one node this is round robin
+	cout << "Test 12" << endl;
+	{
+		default_allocator<char, rc_sharded_internal_allocator<std::mutex, ALLOC_PAGE_SIZE, POOLL,
+															  ARENA_COUNT, ARENA_BY_NODE>> L;
+		cout << "numa nodes " << numa_node_count() << endl;
+
+		alloc_data allcdt = init_alloc_data<char>();
+		allcdt.size = 64;
+		void* l12[1000];
+		for(unsigned i = 0; i < 1000; ++i)
+			l12[i] = L.allocate(&allcdt);
+		thread t1([&]() {
+			dealloc_data deallcdt = init_dealloc_data<char>();
+			deallcdt.size = 64;
+			for(unsigned i = 0; i < 1000; ++i) {
+				deallcdt.ptr = l12[i];
+				L.deallocate(&deallcdt);
+			}
+		});
+		t1.join();
+		l12[0] = L.allocate(&allcdt);
+
+		alloc_stats st;
+		L.get_allocator().do_get_stats(&st);
+		cout << "remote frees " << st.remote_frees << " from other nodes " << st.remote_node_frees << endl;
+
+		dealloc_data deallcdt = init_dealloc_data<char>();
+		deallcdt.ptr = l12[0];
+		deallcdt.size = 64;
+		L.deallocate(&deallcdt);
+	}
+	//the two level segregated fit block engine
+	cout << "Test 13" << endl;
+	{
+		default_allocator<a_struct, rc_internal_allocator<ALLOC_PAGE_SIZE, POOLM, tlsf_memblock>> M;
+
+		alloc_data allcdt = init_alloc_data<a_struct>();
+		allcdt.size = 100 * sizeof(a_struct);
+		a_struct* l13 = (a_struct*)M.allocate(&allcdt);
+		for(unsigned i = 0; i < 100; ++i)
+			l13[i] = a_struct{i, 1.5f};
+
+		//grow, the first 100 are kept
+		realloc_data rdat = init_realloc_data<a_struct>();
+		rdat.ptr = l13;
+		rdat.from_byte_size = 100 * sizeof(a_struct);
+		rdat.to_byte_size = 300 * sizeof(a_struct);
+		rdat.keep_byte_size_1 = 100 * sizeof(a_struct);
+		rdat.from_count_1 = 100;
+		l13 = (a_struct*)M.reallocate(&rdat);
+		cout << "kept " << (l13[99].a == 99) << endl;
+
+		alloc_data allcdt2 = init_alloc_data<a_struct>();
+		allcdt2.size = 10 * sizeof(a_struct);
+		allcdt2.alignment = 256;
+		a_struct* l13b = (a_struct*)M.allocate(&allcdt2);
+		cout << "aligned " << ((uintptr_t)l13b % 256 == 0) << endl;
+
+		dealloc_data deallcdt = init_dealloc_data<a_struct>();
+		deallcdt.ptr = l13;
+		deallcdt.size = 300 * sizeof(a_struct);
+		M.deallocate(&deallcdt);
+		deallcdt.ptr = l13b;
+		deallcdt.size = 10 * sizeof(a_struct);
+		deallcdt.alignment = 256;
+		M.deallocate(&deallcdt);
+	}
+	//large allocations get their own mapping, grown and shrunk with mremap
+	cout << "Test 14" << endl;
+	{
+		default_allocator<char, rc_internal_allocator<ALLOC_PAGE_SIZE, POOLN>> N;
+
+		alloc_data allcdt = init_alloc_data<char>();
+		allcdt.size = 256 * 1024;
+		char* l14 = (char*)N.allocate(&allcdt);
+		memset(l14, 5, 256 * 1024);
+
+		//grow, shrink below DIRECT_MAP_MIN_SIZE into a block, then grow back to a mapping
+		rc_size_t sizes[4] = {256 * 1024, 4 * 1024 * 1024, 64 * 1024, 512 * 1024};
+		for(unsigned i = 1; i < 4; ++i) {
+			realloc_data rdat = init_realloc_data<char>();
+			rdat.ptr = l14;
+			rdat.from_byte_size = sizes[i - 1];
+			rdat.to_byte_size = sizes[i];
+			rdat.keep_byte_size_1 = 64 * 1024;
+			rdat.from_count_1 = 64 * 1024;
+			l14 = (char*)N.reallocate(&rdat);
+
+			alloc_stats st;
+			N.get_allocator().do_get_stats(&st);
+			cout << "size " << sizes[i] << " kept " << (l14[64 * 1024 - 1] == 5)
+				 << " large " << st.large_count << endl;
+		}
+
+		dealloc_data deallcdt = init_dealloc_data<char>();
+		deallcdt.ptr = l14;
+		deallcdt.size = 512 * 1024;
+		N.deallocate(&deallcdt);
+	}
+	//sampling heap profiler, reallocated objects keep their samples
+	cout << "Test 15" << endl;
+	{
+		default_allocator<char, rc_internal_allocator<ALLOC_PAGE_SIZE, POOLO>> O;
+		set_heap_sample_rate(4096);
+
+		alloc_data allcdt = init_alloc_data<char>();
+		allcdt.size = 1000;
+		char* l15[200];
+		for(unsigned i = 0; i < 200; ++i)
+			l15[i] = (char*)O.allocate(&allcdt);
+		for(unsigned i = 0; i < 200; ++i) {
+			realloc_data rdat = init_realloc_data<char>();
+			rdat.ptr = l15[i];
+			rdat.from_byte_size = 1000;
+			rdat.to_byte_size = 3000;
+			l15[i] = (char*)O.reallocate(&rdat);
+		}
+		cout << "samples " << (heap_sample_count.load() > 0) << endl;
+
+		FILE* out = tmpfile();
+		cout << "profile written " << (out != 0 && write_heap_profile(out)) << endl;
+		if(out != 0)
+			fclose(out);
+
+		dealloc_data deallcdt = init_dealloc_data<char>();
+		deallcdt.size = 3000;
+		for(unsigned i = 0; i < 200; ++i) {
+			deallcdt.ptr = l15[i];
+			O.deallocate(&deallcdt);
+		}
+		set_heap_sample_rate(0);
+	}
+	//over aligned allocations, the last is a large mapping aligned inside
+	cout << "Test 16" << endl;
+	{
+		default_allocator<char, rc_internal_allocator<ALLOC_PAGE_SIZE, POOLP>> P;
+
+		uint32_t alignments[4] = {64, 4096, 64 * 1024, 64 * 1024};
+		rc_size_t sizes[4] = {100, 5000, 10000, 300 * 1024};
+		char* l16[4];
+		for(unsigned i = 0; i < 4; ++i) {
+			alloc_data allcdt = init_alloc_data<char>();
+			allcdt.size = sizes[i];
+			allcdt.alignment = alignments[i];
+			l16[i] = (char*)P.allocate(&allcdt);
+			memset(l16[i], 3, sizes[i]);
+			cout << "aligned " << alignments[i] << " " << ((uintptr_t)l16[i] % alignments[i] == 0) << endl;
+		}
+
+		//moved, still aligned
+		realloc_data rdat = init_realloc_data<char>();
+		rdat.ptr = l16[1];
+		rdat.from_byte_size = 5000;
+		rdat.to_byte_size = 20000;
+		rdat.keep_byte_size_1 = 5000;
+		rdat.from_count_1 = 5000;
+		rdat.alignment = 4096;
+		l16[1] = (char*)P.reallocate(&rdat);
+		sizes[1] = 20000;
+		cout << "realloc aligned " << ((uintptr_t)l16[1] % 4096 == 0) << " kept " << (l16[1][4999] == 3) << endl;
+
+		for(unsigned i = 0; i < 4; ++i) {
+			dealloc_data deallcdt = init_dealloc_data<char>();
+			deallcdt.ptr = l16[i];
+			deallcdt.size = sizes[i];
+			deallcdt.alignment = alignments[i];
+			P.deallocate(&deallcdt);
+		}
+	}
+	//the lock types as the pools lock
+	cout << "Test 17" << endl;
+	{
+		lock_pool_test<ticket_lock, POOLQ>();
+		lock_pool_test<mcs_lock, POOLR>();
+		lock_pool_test<futex_mutex, POOLS>();
+
+		//mcs locks held together and let go out of order
+		mcs_lock ma, mb, mc;
+		unsigned count = 0;
+		auto work = [&]() {
+			for(unsigned j = 0; j < 10000; ++j) {
+				ma.lock();
+				mb.lock();
+				ma.unlock();
+				mc.lock();
+				mb.unlock();
+				{
+					mcs_lock::guard g(ma);
+					++count;
+				}
+				mc.unlock();
+			}
+		};
+		thread t1(work);
+		thread t2(work);
+		t1.join();
+		t2.join();
+		cout << "count " << count << endl;
+	}
+	//containers bigger than a size can hold are refused, not cut short
+	cout << "Test 18" << endl;
+	{
+		vector<int, default_std_allocator<int>> vec;
+		try {
+			vec.reserve(vec.max_size() + 1);
+			cout << "reserved " << vec.capacity() << endl;
+		} catch(const std::length_error&) {
+			cout << "length_error" << endl;
+		}
+		default_std_allocator<int> allctr;
+		try {
+			allctr.allocate(allctr.max_size() + 1);
+		} catch(const std::bad_array_new_length&) {
+			cout << "bad_array_new_length" << endl;
+		}
+		cout << "max_size " << (std::allocator_traits<default_std_allocator<int>>::max_size(allctr) == allctr.max_size()) << endl;
+	}
+	//C realloc grows in place, over aligned C allocations cost the header not the alignment
+	cout << "Test 19" << endl;
+	{
+		char* p = (char*)rc_malloc(2000);
+		memset(p, 7, 2000);
+		unsigned inplace = 0;
+		for(size_t sz = 2016; sz <= 8000; sz += 16) {
+			char* q = (char*)rc_realloc(p, sz);
+			if(q == p) ++inplace;
+			p = q;
+		}
+		cout << "in place " << inplace << " of 375 kept " << (p[1999] == 7) << endl;
+		rc_free(p);
+
+		bool aligned = true;
+		bool cost = true;
+		const size_t sizes[] = {100, 5000, 300000};
+		for(size_t al = 32; al <= 8192; al <<= 1) {
+			for(size_t sz : sizes) {
+				size_t before = rc_mallinfo().uordblks;
+				void* ptr = 0;
+				if(rc_posix_memalign(&ptr, al, sz) != 0) {
+					aligned = false;
+					continue;
+				}
+				aligned = aligned && (uintptr_t)ptr % al == 0 && rc_malloc_usable_size(ptr) >= sz;
+				cost = cost && rc_mallinfo().uordblks - before <= sz + 32;
+				memset(ptr, 1, sz);
+				rc_free(ptr);
+			}
+		}
+		cout << "aligned " << aligned << " cost " << cost << endl;
+	}
+	//plain new is aligned for __STDCPP_DEFAULT_NEW_ALIGNMENT__, every layout of new (with rcnewdelete.cpp
+	//linked) frees through unsized and sized delete - a thread doing them leaves the pool as an idle one does
+	cout << "Test 20" << endl;
+	{
+		typedef rc_thread_cached_internal_allocator<std::mutex, ALLOC_PAGE_SIZE, 0> new_pool;
+		bool aligned = true;
+		auto work = [&]() {
+			//slab, header and large objects
+			const size_t sizes[] = {1, 8, 24, 100, 1000, 1024, 1040, 1500, 4000, 8000, 60000, 200000, 1 << 20};
+			for(size_t sz : sizes) {
+				void* p = ::operator new(sz);
+				aligned = aligned && (uintptr_t)p % __STDCPP_DEFAULT_NEW_ALIGNMENT__ == 0;
+				memset(p, 1, sz);
+				::operator delete(p);
+				p = ::operator new(sz);
+				aligned = aligned && (uintptr_t)p % __STDCPP_DEFAULT_NEW_ALIGNMENT__ == 0;
+				::operator delete(p, sz);
+			}
+			//over aligned slab slots, headers in blocks and in large mappings, large mappings
+			const size_t alsizes[][2] = {{100, 64}, {1000, 512}, {5000, 256}, {300000, 4096}, {300000, 16384}};
+			for(auto& as : alsizes) {
+				std::align_val_t al = (std::align_val_t)as[1];
+				void* p = ::operator new(as[0], al);
+				aligned = aligned && (uintptr_t)p % as[1] == 0;
+				memset(p, 1, as[0]);
+				::operator delete(p, al);
+				p = ::operator new(as[0], al);
+				aligned = aligned && (uintptr_t)p % as[1] == 0;
+				::operator delete(p, as[0], al);
+			}
+		};
+		//the thread itself is allocated here and freed on the thread
+		auto live_change = [](std::function<void()> fn) {
+			alloc_stats before, after;
+			get_global_object<new_pool>()->get_stats(&before);
+			thread t(fn);
+			t.join();
+			get_global_object<new_pool>()->get_stats(&after);
+			return (int64_t)after.bytes_live - (int64_t)before.bytes_live;
+		};
+		int64_t idle = live_change([]() {});
+		int64_t busy = live_change(work);
+		cout << "aligned " << aligned << " live balanced " << (idle == busy) << endl;
+	}
+	//the C functions - realloc keeps the data, errors are reported like libc, pointers from
+	//elsewhere are left alone
+	cout << "Test 21" << endl;
+	{
+		bool kept = true;
+		char* p = 0;
+		const size_t sizes[] = {10, 100, 3000, 70000, 500000, 2000000, 40000, 500, 20};
+		size_t last = 0;
+		for(size_t sz : sizes) {
+			p = (char*)rc_realloc(p, sz);
+			for(size_t i = 0; i < (last < sz ? last : sz); ++i)
+				kept = kept && p[i] == (char)i;
+			for(size_t i = 0; i < sz; ++i)
+				p[i] = (char)i;
+			last = sz;
+		}
+		rc_free(p);
+		cout << "realloc kept " << kept << endl;
+
+		char* z = (char*)rc_calloc(100, 30);
+		bool zeroed = z != 0;
+		for(size_t i = 0; z != 0 && i < 3000; ++i)
+			zeroed = zeroed && z[i] == 0;
+		rc_free(z);
+		errno = 0;
+		void* over = rc_calloc((size_t)1 << (sizeof(size_t) * 4), (size_t)1 << (sizeof(size_t) * 4));
+		cout << "calloc zeroed " << zeroed << " overflow " << (over == 0 && errno == ENOMEM) << endl;
+
+		void* al = 0;
+		int err = rc_posix_memalign(&al, 256, 1000);
+		bool aligned = err == 0 && (uintptr_t)al % 256 == 0;
+		rc_free(al);
+		al = rc_aligned_alloc(4096, 100);
+		aligned = aligned && al != 0 && (uintptr_t)al % 4096 == 0;
+		rc_free(al);
+		void* bad = 0;
+		errno = 0;
+		bool einval = rc_posix_memalign(&bad, 24, 100) == EINVAL && rc_posix_memalign(&bad, sizeof(void*) / 2, 100) == EINVAL &&
+					  bad == 0 && errno == 0;
+		einval = einval && rc_aligned_alloc(48, 100) == 0 && errno == EINVAL;
+		cout << "aligned " << aligned << " einval " << einval << endl;
+
+		void* u = rc_malloc(100);
+		size_t usable = rc_malloc_usable_size(u);
+		memset(u, 1, usable);
+		rc_free(u);
+		cout << "usable " << (usable >= 100) << " null " << (rc_malloc_usable_size(0) == 0) << endl;
+
+		//not from the pool - ignored rather than corrupting it
+		void* foreign = malloc(100);
+		int stack = 0;
+		rc_free(foreign);
+		rc_free(&stack);
+		cout << "foreign " << (rc_malloc_usable_size(foreign) == 0 && rc_malloc_usable_size(&stack) == 0) << endl;
+		free(foreign);
+	}
+	//mid sizes are bumped from a per thread chunk - freed and resized on another thread, and the
+	//chunks tail given back when the thread goes, nothing is left counted or mapped
+	//byte rounded sizes, so the padding to the granule is counted back out
+	cout << "Test 22" << endl;
+	{
+		typedef rc_thread_cached_internal_allocator<std::mutex, ALLOC_PAGE_SIZE, POOLT> bump_pool;
+		default_allocator<char, bump_pool> T;
+
+		const unsigned count = 2000;
+		vector<void*> l22(count);
+		thread t1([&]() {
+			alloc_data allcdt = init_alloc_data<char>();
+			allcdt.byterounding = 1;
+			for(unsigned i = 0; i < count; ++i) {
+				allcdt.size = 1100 + (i * 136) % 7000;
+				l22[i] = T.allocate(&allcdt);
+				memset(l22[i], (int)i, allcdt.size);
+			}
+		});
+		t1.join();
+		alloc_stats st;
+		get_global_object<bump_pool>()->get_stats(&st);
+		cout << "bumped " << (st.bytes_live > 0) << endl;
+		bool kept = true;
+		thread t2([&]() {
+			for(unsigned i = 0; i < count; ++i) {
+				rc_size_t size = 1100 + (i * 136) % 7000;
+				if(i % 2 == 0) {
+					realloc_data rdat = init_realloc_data<char>();
+					rdat.ptr = l22[i];
+					rdat.from_byte_size = size;
+					rdat.to_byte_size = size + 500;
+					rdat.keep_byte_size_1 = size;
+					rdat.from_count_1 = size;
+					rdat.byterounding = 1;
+					l22[i] = T.reallocate(&rdat);
+					kept = kept && ((char*)l22[i])[size - 1] == (char)i;
+					size += 500;
+				}
+				dealloc_data ddat = init_dealloc_data<char>();
+				ddat.ptr = l22[i];
+				ddat.size = size;
+				ddat.byterounding = 1;
+				T.deallocate(&ddat);
+			}
+		});
+		t2.join();
+		get_global_object<bump_pool>()->trim();
+		get_global_object<bump_pool>()->get_stats(&st);
+		cout << "kept " << kept << " live " << st.bytes_live << " blocks " << st.block_count << " all free " << (st.bytes_free == st.bytes_mapped) << endl;
+	}
+	//threads are given their own arenas in turn, objects are resized and freed by their
+	//owning arena whichever thread does it
+	cout << "Test 23" << endl;
+	{
+		typedef rc_sharded_internal_allocator<std::mutex, ALLOC_PAGE_SIZE, POOLU> sharded_pool;
+		default_allocator<char, sharded_pool> U;
+		sharded_pool* pool = get_global_object<sharded_pool>();
+
+		void* l23[2][200];
+		auto work = [&](unsigned t) {
+			alloc_data allcdt = init_alloc_data<char>();
+			allcdt.size = 3000;
+			for(unsigned i = 0; i < 200; ++i) {
+				l23[t][i] = U.allocate(&allcdt);
+				memset(l23[t][i], (int)t + 1, 3000);
+			}
+		};
+		thread t1(work, 0);
+		t1.join();
+		thread t2(work, 1);
+		t2.join();
+		bool owned = true;
+		for(unsigned t = 0; t < 2; ++t)
+			for(unsigned i = 0; i < 200; ++i)
+				owned = owned && pool->owning_arena(l23[t][i]) == pool->owning_arena(l23[t][0]);
+		cout << "arenas differ " << (pool->owning_arena(l23[0][0]) != pool->owning_arena(l23[1][0]))
+			 << " owned " << owned << endl;
+
+		//on a third thread and arena
+		bool kept = true;
+		for(unsigned i = 0; i < 200; ++i) {
+			realloc_data rdat = init_realloc_data<char>();
+			rdat.ptr = l23[0][i];
+			rdat.from_byte_size = 3000;
+			rdat.to_byte_size = 5000;
+			rdat.keep_byte_size_1 = 3000;
+			rdat.from_count_1 = 3000;
+			sharded_pool::arena_type* arn = pool->owning_arena(l23[0][i]);
+			void* nptr = U.reallocate(&rdat);
+			kept = kept && ((char*)nptr)[2999] == 1 && pool->owning_arena(nptr) == arn;
+			l23[0][i] = nptr;
+		}
+		cout << "resized in owning arena " << kept << endl;
+		dealloc_data deallcdt = init_dealloc_data<char>();
+		for(unsigned t = 0; t < 2; ++t) {
+			deallcdt.size = t == 0 ? 5000 : 3000;
+			U.deallocate_batch(&deallcdt, l23[t], 200);
+		}
+	}
+	//small sizes come from slabs of one size class, slots are carved in order and freed ones
+	//reused first, bigger sizes go to the blocks
+	cout << "Test 24" << endl;
+	{
+		default_allocator<char, rc_internal_allocator<ALLOC_PAGE_SIZE, POOLV>> V;
+
+		alloc_data allcdt = init_alloc_data<char>();
+		dealloc_data deallcdt = init_dealloc_data<char>();
+		bool classes = true;
+		const rc_size_t sizes[] = {1, 8, 24, 100, 129, 500, 1024};
+		for(rc_size_t sz : sizes) {
+			allcdt.size = sz;
+			void* p = V.allocate(&allcdt);
+			uint32_t idx;
+			slab_class_index(sz < 8 ? 8 : sz, 1, idx);
+			memblock_base* blck = page_map_get(p);
+			classes = classes && blck->slabsize == slab_class_size(idx) && blck->slabsize >= sz;
+			deallcdt.ptr = p;
+			deallcdt.size = sz;
+			V.deallocate(&deallcdt);
+		}
+
+		allcdt.size = 100;
+		char* a = (char*)V.allocate(&allcdt);
+		char* b = (char*)V.allocate(&allcdt);
+		uint32_t slot = page_map_get(a)->slabsize;
+		deallcdt.size = 100;
+		deallcdt.ptr = a;
+		V.deallocate(&deallcdt);
+		char* c = (char*)V.allocate(&allcdt);
+		cout << "slab classes " << classes << " in order " << (b == a + slot) << " reused " << (c == a) << endl;
+
+		allcdt.size = 1100;
+		void* d = V.allocate(&allcdt);
+		cout << "above slabs " << (page_map_get(d)->slabsize == 0) << endl;
+		deallcdt.ptr = d;
+		deallcdt.size = 1100;
+		V.deallocate(&deallcdt);
+		deallcdt.size = 100;
+		deallcdt.ptr = b;
+		V.deallocate(&deallcdt);
+		deallcdt.ptr = c;
+		V.deallocate(&deallcdt);
+	}
+	//any byte of an object finds its block through the page map, with many blocks and for large
+	//mappings, memory not from a pool finds nothing
+	cout << "Test 25" << endl;
+	{
+		default_allocator<char, rc_internal_allocator<ALLOC_PAGE_SIZE, POOLW>> W;
+
+		alloc_data allcdt = init_alloc_data<char>();
+		allcdt.size = 20000;
+		vector<void*> l25(500);
+		for(unsigned i = 0; i < 500; ++i)
+			l25[i] = W.allocate(&allcdt);
+		allcdt.size = 1024 * 1024;
+		char* big = (char*)W.allocate(&allcdt);
+
+		bool found = true;
+		for(unsigned i = 0; i < 500; ++i) {
+			char* p = (char*)l25[i];
+			memblock_base* blck = page_map_get(p);
+			found = found && blck != 0 && !blck->large && page_map_get(p + 19999) == blck &&
+					p >= blck->ptr && p + 20000 <= blck->ptr + blck->bytetotal;
+		}
+		memblock_base* bigblck = page_map_get(big);
+		bool large = bigblck != 0 && bigblck->large && page_map_get(big + 1024 * 1024 - 1) == bigblck;
+		int stack = 0;
+		cout << "lookups " << found << " large " << large << " foreign " << (page_map_get(&stack) == 0) << endl;
+
+		dealloc_data deallcdt = init_dealloc_data<char>();
+		deallcdt.size = 20000;
+		W.deallocate_batch(&deallcdt, l25.data(), 500);
+		deallcdt.ptr = big;
+		deallcdt.size = 1024 * 1024;
+		W.deallocate(&deallcdt);
+	}
+	//room freed in the oldest of many full blocks is found, no new block is added
+	cout << "Test 26" << endl;
+	{
+		typedef rc_internal_allocator<64 * 1024, POOLX> index_pool;
+		default_allocator<char, index_pool> X;
+
+		alloc_data allcdt = init_alloc_data<char>();
+		allcdt.size = 16000;
+		vector<void*> l26(100);
+		for(unsigned i = 0; i < 100; ++i)
+			l26[i] = X.allocate(&allcdt);
+		dealloc_data deallcdt = init_dealloc_data<char>();
+		deallcdt.size = 16000;
+		deallcdt.ptr = l26[1];
+		X.deallocate(&deallcdt);
+
+		alloc_stats before, after;
+		get_global_object<index_pool>()->get_stats(&before);
+		void* p = X.allocate(&allcdt);
+		get_global_object<index_pool>()->get_stats(&after);
+		cout << "blocks " << before.block_count << " same block " << (page_map_get(p) == page_map_get(l26[0]))
+			 << " new blocks " << (after.new_blocks - before.new_blocks) << endl;
+		l26[1] = p;
+		X.deallocate_batch(&deallcdt, l26.data(), 100);
+	}
+	//emptied blocks are kept and reused, fewer are kept the longer they stay empty, trim
+	//gives back all but one
+	cout << "Test 27" << endl;
+	{
+		typedef rc_internal_allocator<64 * 1024, POOLY> retain_pool;
+		default_allocator<char, retain_pool> Y;
+		retain_pool* pool = get_global_object<retain_pool>();
+
+		alloc_data allcdt = init_alloc_data<char>();
+		allcdt.size = 16000;
+		dealloc_data deallcdt = init_dealloc_data<char>();
+		deallcdt.size = 16000;
+		void* l27[24];
+		alloc_stats st;
+		for(unsigned round = 0; round < 2; ++round) {
+			for(unsigned i = 0; i < 24; ++i)
+				l27[i] = Y.allocate(&allcdt);
+			Y.deallocate_batch(&deallcdt, l27, 24);
+			pool->get_stats(&st);
+			cout << "blocks " << st.block_count << " retained " << st.retained_count << " new blocks " << st.new_blocks << endl;
+		}
+
+		//as if they had been empty for two and then five half lives
+		pool->fa.decay(monotonic_ms() + 2 * RETAIN_HALF_LIFE_MS);
+		pool->get_stats(&st);
+		cout << "decayed retained " << (st.retained_count <= retain_limit(2 * RETAIN_HALF_LIFE_MS)) << endl;
+		pool->fa.decay(monotonic_ms() + 5 * RETAIN_HALF_LIFE_MS);
+		pool->get_stats(&st);
+		cout << "decayed retained " << st.retained_count << " blocks " << st.block_count << endl;
+		pool->trim();
+		pool->get_stats(&st);
+		cout << "trimmed retained " << st.retained_count << " blocks " << st.block_count << endl;
+	}
+	//naturally aligned objects are the extent itself, no header or padding, packed back to back
+	//in one block - over aligned ones are placed at an aligned extent and cost only their size
+	cout << "Test 28" << endl;
+	{
+		typedef rc_internal_allocator<ALLOC_PAGE_SIZE, POOLZ> natural_pool;
+		default_allocator<char, natural_pool> Z;
+
+		alloc_data allcdt = init_alloc_data<uint64_t>();
+		const rc_size_t sizes[3] = {1100, 1304, 1600};
+		char* l28[4];
+		for(unsigned i = 0; i < 3; ++i) {
+			allcdt.size = sizes[i];
+			l28[i] = (char*)Z.allocate(&allcdt);
+		}
+		alloc_stats st;
+		get_global_object<natural_pool>()->get_stats(&st);
+		cout << "adjacent " << (l28[1] == l28[0] + 1104 && l28[2] == l28[1] + 1304)
+			 << " live " << st.bytes_live << endl;
+
+		allcdt.size = 1100;
+		allcdt.alignment = 256;
+		l28[3] = (char*)Z.allocate(&allcdt);
+		get_global_object<natural_pool>()->get_stats(&st);
+		cout << "over aligned " << ((uintptr_t)l28[3] % 256 == 0) << " live " << st.bytes_live << endl;
+
+		dealloc_data deallcdt = init_dealloc_data<uint64_t>();
+		for(unsigned i = 0; i < 4; ++i) {
+			deallcdt.ptr = l28[i];
+			deallcdt.size = i < 3 ? sizes[i] : 1100;
+			deallcdt.alignment = i < 3 ? alignof(uint64_t) : 256;
+			Z.deallocate(&deallcdt);
+		}
+		get_global_object<natural_pool>()->get_stats(&st);
+		cout << "live " << st.bytes_live << endl;
+	}
 	cout << "End Test" << endl;
 	return 0;
 }
@@ -1,711 +1,1865 @@
-/*----------------------------------------------------------------------------------*\
- |																					|
- | rcmalloc.cpp	 																	|
- |																					|
- | Copyright (c) 2019 Richard Cookman												|
- |																					|
- | Permission is hereby granted, free of charge, to any person obtaining a copy		|
- | of this software and associated documentation files (the "Software"), to deal	|
- | in the Software without restriction, including without limitation the rights		|
- | to use, copy, modify, merge, publish, distribute, sublicense, and/or sell		|
- | copies of the Software, and to permit persons to whom the Software is			|
- | furnished to do so, subject to the following conditions:							|
- |																					|
- | The above copyright notice and this permission notice shall be included in all	|
- | copies or substantial portions of the Software.									|
- |																					|
- | THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR		|
- | IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,			|
- | FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE		|
- | AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER			|
- | LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,	|
- | OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE	|
- | SOFTWARE.																		|
- |																					|
-\*----------------------------------------------------------------------------------*/
-
-#include "rcmalloc.hpp"
-
-namespace rcmalloc {
-
-alloc_data init_alloc_data_basic() {
-	alloc_data rtn;
-	memset((char*)&rtn, 0, sizeof(alloc_data));
-	rtn.minalignment = std::alignment_of<uintptr_t>();
-	rtn.byterounding = sizeof(uintptr_t);
-	return rtn;
-}
-realloc_data init_realloc_data_basic() {
-	realloc_data rtn;
-	memset((char*)&rtn, 0, sizeof(realloc_data));
-	rtn.minalignment = std::alignment_of<uintptr_t>();
-	rtn.byterounding = sizeof(uintptr_t);
-	return rtn;
-}
-alloc_data to_alloc_data(const realloc_data* dat) {
-	//copy across everything needed
-	alloc_data rtn;
-	memset((char*)&rtn, 0, sizeof(alloc_data));
-	rtn.size = dat->to_byte_size;
-	rtn.alignment = dat->alignment;
-	rtn.size_of = dat->size_of;
-	rtn.minalignment = dat->minalignment;
-	rtn.byterounding = dat->byterounding;
-	return rtn;
-}
-dealloc_data init_dealloc_data_basic() {
-	dealloc_data rtn;
-	memset((char*)&rtn, 0, sizeof(dealloc_data));
-	rtn.minalignment = std::alignment_of<uintptr_t>();
-	rtn.byterounding = sizeof(uintptr_t);
-	return rtn;
-}
-
-vgcsettings::~vgcsettings() {}
-
-vallocator::~vallocator() {}
-void vallocator::do_add_stack_variable(void* stkptr, stack_variable_cleanup fptr) {
-	//add pointer to stack item
-	//NEEDED by garbage collectors only
-}
-void vallocator::do_remove_stack_variable_range(void* stkptr, uint32_t frame_size) {
-	//remove pointers to stack items
-	//NEEDED by garbage collectors only
-}
-void vallocator::do_cleanup(const vgcsettings& settings) {
-	//do stop the world cleanup
-	//NEEDED by garbage collectors only
-}
-void vallocator::do_test_cleanup(const vgcsettings& settings) {
-	//do stop the world cleanup
-	//NEEDED by garbage collectors only
-}
-void* vallocator::do_dereference(void* ptr) {
-	//pointer dereference
-	//NEEDED by garbage collectors only
-	return ptr;
-}
-vallocator& vallocator::get_allocator() {
-	return *this;
-}
-const vallocator& vallocator::get_allocator() const {
-	return *this;
-}
-
-void roundAllocation(uint32_t minalignment, uint32_t byterounding,
-					 uint32_t& size, uint32_t& alignment) {
-	if(size == 0) size = 1;
-	if(alignment < minalignment) alignment = minalignment;
-	uint32_t md = size % byterounding;
-	if(md > 0) size += byterounding - md;
-}
-void roundAllocation(realloc_data& ldat) {
-	roundAllocation(ldat.minalignment, ldat.byterounding, ldat.from_byte_size, ldat.alignment);
-	roundAllocation(ldat.minalignment, ldat.byterounding, ldat.to_byte_size, ldat.alignment);
-}
-void* align(uint32_t alignment, uint32_t size_of, void*& ptr) {
-	size_t size = alignment + size_of;
-	std::align(alignment,
-			   size_of,
-			   ptr,
-			   size);
-	return ptr;
-}
-char getMemOffset(void* ptr, uint32_t alignment, uint32_t size_of) {
-	if(alignment < 2)
-		return 0;
-
-	void* rtn = ptr;
-	rcmalloc::align(alignment,
-					size_of,
-					rtn);
-
-	if(rtn == ptr)
-		rtn = (char*)rtn + alignment;
-
-	//store the offset to the true block of this
-	return dist((char*)ptr, (char*)rtn);
-}
-void* setAlignment(void* ptr, uint32_t alignment, uint32_t size_of) {
-	if(alignment < 2)
-		return ptr;
-
-	void* rtn = ptr;
-	rcmalloc::align(alignment,
-					size_of,
-					rtn);
-
-	if(rtn == ptr)
-		rtn = (char*)rtn + alignment;
-
-	//store the offset to the true block of this
-	char offset = dist((char*)ptr, (char*)rtn);
-	*((char*)rtn - 1) = offset;
-	return rtn;
-}
-void* getAlignment(void* ptr, uint32_t alignment, uint32_t& size, uint32_t& offset) {
-	if(alignment < 2) {
-		offset = 0;
-		return ptr;
-	}
-
-	size += alignment;
-	offset = *((char*)ptr - 1);
-	return (char*)ptr - offset;
-}
-
-void move_object_list_forward(void* begto, void* begfrm, void* endfrm, uint32_t count,
-							  uint32_t size_of, object_move_func move_func) {
-	char* lclbegfrm = (char*)begfrm;
-	//char* lclendfrm = (char*)endfrm;
-	char* lclbegto = (char*)begto;
-
-	for(; count > 0; lclbegfrm+=size_of, lclbegto+=size_of, --count)
-		move_func(lclbegto, lclbegfrm);
-}
-void move_object_list_backward(void* endto, void* begfrm, void* endfrm, uint32_t count,
-							   uint32_t size_of, object_move_func move_func) {
-	//char* lclbegfrm = (char*)begfrm - size_of;
-	char* lclendfrm = (char*)endfrm - size_of;
-	char* lclendto = (char*)endto - size_of;
-
-	for(; count > 0; lclendfrm-=size_of, lclendto-=size_of, --count)
-		move_func(lclendto, lclendfrm);
-}
-void memMove(void* begto, void* begfrm, void* endfrm, void* endto,
-			 uint32_t count, const realloc_data& dat) {
-	//no move if moving to same place
-	if(begfrm == begto)
-		return;
-
-	if(dat.istrivial) {
-		//better performance for trivially copyable types
-		memmove((char*)begto, (char*)begfrm, dist((char*)begfrm, (char*)endfrm));
-	} else {
-		object_move_func mvfunc;
-		if((uint32_t)abs(dist((char*)begfrm, (char*)begto)) < dat.size_of)
-			//if we need an intermediary (partial object overlap)
-			mvfunc = dat.intermediary_move_func;
-		else
-			mvfunc = dat.move_func;
-		if((char*)begto >= (char*)begfrm && (char*)begto < (char*)endfrm) {
-			//overlap at the beginning
-			move_object_list_backward(endto, begfrm, endfrm, count,
-									  dat.size_of, mvfunc);
-			return;
-		} else if((char*)endto >= (char*)begfrm && (char*)endto < (char*)endfrm) {
-			//overlap at the end
-			move_object_list_forward(begto, begfrm, endfrm, count,
-									 dat.size_of, mvfunc);
-			return;
-		}
-		//just move
-		move_object_list_forward(begto, begfrm, endfrm, count,
-								 dat.size_of, dat.move_func);
-	}
-	return;
-}
-inline bool moveEndFirst(char* toptr, int32_t keep_to_byte_offset,
-						 char* frmptr, int32_t keep_from_byte_offset) {
-	return (toptr + keep_to_byte_offset) > (frmptr + keep_from_byte_offset);
-}
-void* doMemMove(char* toPtr, char* frmPtr,
-				const realloc_data& dat) {
-	uint32_t keep_byte_size_1 = dat.keep_byte_size_1;
-	uint32_t keep_byte_size_2 = dat.keep_byte_size_2;
-	int32_t keep_from_byte_offset_1 = dat.keep_from_byte_offset_1;
-	int32_t keep_from_byte_offset_2 = dat.keep_from_byte_offset_2;
-	int32_t keep_to_byte_offset_1 = dat.keep_to_byte_offset_1;
-	int32_t keep_to_byte_offset_2 = dat.keep_to_byte_offset_2;
-	uint32_t count_1 = dat.from_count_1;
-	uint32_t count_2 = dat.from_count_2;
-
-	//move the memory
-	if(moveEndFirst((char*)toPtr, keep_to_byte_offset_2,
-					(char*)frmPtr, keep_from_byte_offset_2)) {
-		std::swap(keep_from_byte_offset_1, keep_from_byte_offset_2);
-		std::swap(keep_to_byte_offset_1, keep_to_byte_offset_2);
-		std::swap(keep_byte_size_1, keep_byte_size_2);
-		std::swap(count_1, count_2);
-	}
-	//memmove((char*)toPtr + keep_to_byte_offset_1, (char*)frmPtr + keep_from_byte_offset_1, keep_byte_size_1);
-	memMove((char*)toPtr + keep_to_byte_offset_1, (char*)toPtr + keep_to_byte_offset_1 + keep_byte_size_1,
-			(char*)frmPtr + keep_from_byte_offset_1, (char*)frmPtr + keep_from_byte_offset_1 + keep_byte_size_1,
-			count_1, dat);
-	//memmove((char*)toPtr + keep_to_byte_offset_2, (char*)frmPtr + keep_from_byte_offset_2, keep_byte_size_2);
-	memMove((char*)toPtr + keep_to_byte_offset_2, (char*)toPtr + keep_to_byte_offset_2 + keep_byte_size_2,
-			(char*)frmPtr + keep_from_byte_offset_2, (char*)frmPtr + keep_from_byte_offset_2 + keep_byte_size_2,
-			count_2, dat);
-	return toPtr;
-}
-
-void sortMemUp(basic_list& sizes, bytesizes* itr) {
-	//move this about in the sizes list
-	while(itr != begin_basic_list<bytesizes>(sizes)) {
-		auto tmp = itr;
-		--tmp;
-		//test less - not less than then break
-		if(!(itr->bytecount < tmp->bytecount || (itr->bytecount == tmp->bytecount && itr->ptr < tmp->ptr)))
-			break;
-		std::swap(*tmp, *itr);
-		--itr;
-	}
-}
-void sortMemDown(basic_list& sizes, bytesizes* itr) {
-	//move this about in the sizes list
-	while(itr != end_basic_list<bytesizes>(sizes) - 1) {
-		auto tmp = itr;
-		++tmp;
-		//test less - not less than then break
-		if(!(tmp->bytecount < itr->bytecount || (tmp->bytecount == itr->bytecount && tmp->ptr < itr->ptr)))
-			break;
-		std::swap(*tmp, *itr);
-		++itr;
-	}
-}
-void memblock::init() {
-	sizes = init_basic_list<bytesizes>(30);
-	freelst = init_basic_list<bytesizes>(30);
-}
-memblock::~memblock() {
-	//NOTE doesn't free ptr here - faster final cleanup!!!
-	/*uint32_t bytetotal;
-	uint32_t byteremain;
-	char* ptr;*/
-	dtor_basic_list<bytesizes>(sizes);
-	dtor_basic_list<bytesizes>(freelst);
-}
-void* memblock::internal_malloc_at_hint(uint32_t size, bytesizes* pfrelst, void* hint) {
-	//can we allocate here??
-	if(pfrelst != end_basic_list<bytesizes>(freelst) &&
-	   (char*)hint >= pfrelst->ptr && ((char*)hint + size) <= (pfrelst->ptr + pfrelst->bytecount)) {
-		//get the size for this
-		bytesizes* sout;
-		rcmalloc::binary_search(begin_basic_list<bytesizes>(sizes), end_basic_list<bytesizes>(sizes), *pfrelst,
-			[](const bytesizes& lhs,
-			   const bytesizes& rhs) {
-				return (lhs.bytecount < rhs.bytecount || (lhs.bytecount == rhs.bytecount && lhs.ptr < rhs.ptr));
-			}, sout);
-
-		//allocate this here and now
-		if(((char*)hint == pfrelst->ptr) & (((char*)hint + size) == (pfrelst->ptr + pfrelst->bytecount))) {
-			//takes whole block - remove block and size
-			erase_basic_list<bytesizes>(freelst, pfrelst);
-			erase_basic_list<bytesizes>(sizes, sout);
-		} else if((char*)hint == pfrelst->ptr) {
-			//matches front of block
-			pfrelst->bytecount -= size;
-			pfrelst->ptr += size;
-			sout->bytecount -= size;
-			sout->ptr += size;
-
-			sortMemUp(sizes, sout);
-		} else if(((char*)hint + size) == (pfrelst->ptr + pfrelst->bytecount)) {
-			//matches back of block
-			pfrelst->bytecount -= size;
-			sout->bytecount -= size;
-
-			sortMemUp(sizes, sout);
-		} else {
-			//split block and size
-			bytesizes nszs;
-			nszs.bytecount = pfrelst->bytecount - (dist(pfrelst->ptr, (char*)hint) + size);
-			nszs.ptr = (char*)hint + size;
-			bytesizes tszs = nszs;
-
-			pfrelst->bytecount = dist(pfrelst->ptr, (char*)hint);
-			sout->bytecount = dist(pfrelst->ptr, (char*)hint);
-
-			sortMemUp(sizes, sout);
-
-			//insert a new block after this one
-			insert_basic_list<bytesizes>(freelst, pfrelst + 1, std::move(nszs));
-
-			bytesizes* iout;
-			rcmalloc::binary_search(begin_basic_list<bytesizes>(sizes), end_basic_list<bytesizes>(sizes), tszs,
-				[](const bytesizes& lhs,
-				   const bytesizes& rhs) {
-					return (lhs.bytecount < rhs.bytecount || (lhs.bytecount == rhs.bytecount && lhs.ptr < rhs.ptr));
-				}, iout);
-			insert_basic_list<bytesizes>(sizes, iout, std::move(tszs));
-		}
-		return hint;
-	}
-	return 0;
-}
-void* memblock::internal_malloc(uint32_t size) {
-	//NOTE size always > 0
-	if(byteremain < size) return 0;
-
-	bytesizes bszs;
-	bszs.bytecount = size;
-
-	//search the sizes
-	bytesizes* sout;
-	rcmalloc::binary_search(begin_basic_list<bytesizes>(sizes), end_basic_list<bytesizes>(sizes), bszs,
-		[](const bytesizes& lhs,
-		   const bytesizes& rhs) {
-			return lhs.bytecount < rhs.bytecount;
-		}, sout);
-
-	//couldn't find big enough
-	if(sout == end_basic_list<bytesizes>(sizes)) return 0;
-
-	//search the pointers
-	bszs.ptr = sout->ptr;
-	bytesizes* pout;
-	rcmalloc::binary_search(begin_basic_list<bytesizes>(freelst), end_basic_list<bytesizes>(freelst), bszs,
-		[](const bytesizes& lhs,
-		   const bytesizes& rhs) {
-			return lhs.ptr < rhs.ptr;
-		}, pout);
-
-	void* rslt = pout->ptr;
-
-	byteremain -= size;
-	if(sout->bytecount == size) {
-		//just remove both of these
-		erase_basic_list<bytesizes>(freelst, pout);
-		erase_basic_list<bytesizes>(sizes, sout);
-	} else {
-		//"split" this
-		//modify both of these
-		sout->bytecount -= size;
-		sout->ptr += size;
-
-		pout->bytecount -= size;
-		pout->ptr += size;
-
-		//move this about in the sizes list
-		sortMemUp(sizes, sout);
-	}
-	return rslt;
-}
-inline bool connectsBefore(basic_list& freelst, const bytesizes& fm,
-						   bytesizes* before,
-						   bytesizes* after) {
-	if(before == begin_basic_list<bytesizes>(freelst) - 1)
-		return false;
-	return (before->ptr + before->bytecount) == fm.ptr;
-}
-inline bool connectsAfter(basic_list& freelst, const bytesizes& fm,
-						  bytesizes* before,
-						  bytesizes* after) {
-	if(after == end_basic_list<bytesizes>(freelst))
-		return false;
-	return (fm.ptr + fm.bytecount) == after->ptr;
-}
-inline bool connectsBeforeAndAfter(basic_list& freelst, const bytesizes& fm,
-								   bytesizes* before,
-								   bytesizes* after) {
-	return connectsBefore(freelst, fm, before, after) &&
-		   connectsAfter(freelst, fm, before, after);
-}
-void* memblock::internal_realloc(
-		const realloc_data* dat,
-		char offset,
-		bytesizes*& freeOut
-) {
-	/*hints - user hint*/
-	bytesizes* bsize0 = 0;
-	void* hint0 = dat->hint;
-	/*keep before in place - minimise move - just expand*/
-	bytesizes* bsize1 = 0;
-	void* hint1 = 0;
-	/*keep after in place - minimise move - just expand*/
-	bytesizes* bsize2 = 0;
-	void* hint2 = 0;
-	/*give this space at the beginning - minimise relocation*/
-	bytesizes* bsize3 = 0;
-	void* hint3 = 0;
-	/*into the current memory block - minimise fragmentation*/
-	bytesizes* bsize4 = 0;
-	void* hint4 = 0;
-
-	if(!dat->ptr) {
-		void* rslt = 0;
-		if(rslt == 0 && hint0) {
-			bytesizes bszs;
-			bszs.bytecount = dat->to_byte_size;
-			bszs.ptr = (char*)hint0;
-			rcmalloc::binary_search(begin_basic_list<bytesizes>(freelst), end_basic_list<bytesizes>(freelst), bszs,
-				[](const bytesizes& lhs,
-				   const bytesizes& rhs) {
-					return lhs.ptr < rhs.ptr;
-				}, bsize0);
-			//try to allocate at the hint
-			rslt = internal_malloc_at_hint(dat->to_byte_size, bsize0, hint0);
-		}
-		if(rslt == 0)
-			rslt = internal_malloc(dat->to_byte_size);
-		if(rslt == 0)
-			return 0;
-		//do alignment
-		if(dat->alignment < 2)
-			return rslt;
-
-		void* rtn = rslt;
-		rcmalloc::align(dat->alignment,
-						dat->size_of,
-						rtn);
-
-		if(rtn == rslt)
-			rtn = (char*)rtn + dat->alignment;
-
-		//store the offset to the true block of this
-		char offset = dist((char*)rslt, (char*)rtn);
-		*((char*)rtn - 1) = offset;
-		return rtn;
-	}
-
-	//do free before allocation!
-	internal_free(dat->ptr, dat->from_byte_size, freeOut);
-
-	void* rslt = 0;
-	{
-		//calculate the hints
-		if(rslt == 0 && hint0) {
-			bytesizes bszs;
-			bszs.bytecount = dat->to_byte_size;
-			bszs.ptr = (char*)hint0;
-			rcmalloc::binary_search(begin_basic_list<bytesizes>(freelst), end_basic_list<bytesizes>(freelst), bszs,
-				[](const bytesizes& lhs,
-				   const bytesizes& rhs) {
-					return lhs.ptr < rhs.ptr;
-				}, bsize0);
-			//try to allocate at the hint
-			rslt = internal_malloc_at_hint(dat->to_byte_size, bsize0, hint0);
-		}
-
-		if(rslt == 0) {
-			//keep the front the same
-			bsize1 = freeOut;
-			hint1 = ((char*)dat->ptr + offset + dat->keep_from_byte_offset_1) - dat->keep_to_byte_offset_1 - offset;
-			//keep the back the same
-			bsize2 = freeOut;
-			hint2 = ((char*)dat->ptr + offset + dat->keep_from_byte_offset_2) - dat->keep_to_byte_offset_2 - offset;
-
-			//try to allocate the largest of the two first
-			if(dat->keep_byte_size_2 > dat->keep_byte_size_1) {
-				std::swap(hint1, hint2);
-				std::swap(bsize1, bsize2);
-			}
-
-			if(rslt == 0)
-				rslt = internal_malloc_at_hint(dat->to_byte_size, bsize1, hint1);
-			if(rslt == 0)
-				rslt = internal_malloc_at_hint(dat->to_byte_size, bsize2, hint2);
-		}
-
-		//move this into the largest of the free blocks - give this space at the beginning
-		if(rslt == 0) {
-			bytesizes bszs = *(end_basic_list<bytesizes>(sizes) - 1);
-			rcmalloc::binary_search(begin_basic_list<bytesizes>(freelst), end_basic_list<bytesizes>(freelst), bszs,
-				[](const bytesizes& lhs,
-				   const bytesizes& rhs) {
-					return lhs.ptr < rhs.ptr;
-				}, bsize3);
-			hint3 = bsize3->ptr + dat->to_byte_size;
-
-			rslt = internal_malloc_at_hint(dat->to_byte_size, bsize3, hint3);
-		}
-
-		if(rslt == 0) {
-			bsize4 = freeOut;
-			hint4 = freeOut->ptr;
-			rslt = internal_malloc_at_hint(dat->to_byte_size, bsize4, hint4);
-		}
-
-		//tried malloc at all of the hint locations - just malloc
-		if(rslt == 0)
-			rslt = internal_malloc(dat->to_byte_size);
-		if(rslt == 0)
-			return 0;
-	}
-
-
-	//do alignment
-	if(dat->alignment >= 2) {
-		void* rtn = rslt;
-		rcmalloc::align(dat->alignment,
-						dat->size_of,
-						rtn);
-
-		if(rtn == rslt)
-			rtn = (char*)rtn + dat->alignment;
-
-		//store the offset to the true block of this
-		char offset = dist((char*)rslt, (char*)rtn);
-		*((char*)rtn - 1) = offset;
-		rslt = rtn;
-	}
-
-	//do memove
-	return doMemMove((char*)rslt, (char*)dat->ptr + offset, *dat);
-}
-void memblock::internal_free(void* p, uint32_t size, bytesizes*& freeOut) {
-	/*uint32_t bytetotal;
-	uint32_t byteremain;
-	char* ptr;
-	vector<bytesizes, basic_aligned_allocator<bytesizes>> sizes;
-	vector<bytecount, basic_aligned_allocator<bytecount>> freelst;*/
-
-	//if this isn't within this!
-	if((char*)p < ptr || (char*)p >= (ptr + bytetotal))
-		return;
-
-	if(byteremain == 0) {
-		//simply return this, everything allocated
-		byteremain += size;
-
-		bytesizes fm;
-		fm.bytecount = size;
-		fm.ptr = (char*)p;
-		bytesizes tm = fm;
-
-		push_back_basic_list<bytesizes>(sizes, std::move(fm));
-		push_back_basic_list<bytesizes>(freelst, std::move(tm));
-		freeOut = begin_basic_list<bytesizes>(freelst);
-		return;
-	}
-
-	//find the before and after on the free list
-	bytesizes fm;
-	fm.bytecount = size;
-	fm.ptr = (char*)p;
-	bytesizes* before;
-	bytesizes* after;
-	rcmalloc::binary_search(begin_basic_list<bytesizes>(freelst), end_basic_list<bytesizes>(freelst), fm,
-		[](const bytesizes& lhs,
-		   const bytesizes& rhs) {
-			return lhs.ptr < rhs.ptr;
-		}, after);
-
-	before = after;
-	--before;
-
-	if(connectsBeforeAndAfter(freelst, fm, before, after)) {
-		//increase the size of before
-		//search the sizes to update
-		bytesizes* sout;
-		rcmalloc::binary_search(begin_basic_list<bytesizes>(sizes), end_basic_list<bytesizes>(sizes), *before,
-			[](const bytesizes& lhs,
-			   const bytesizes& rhs) {
-				return (lhs.bytecount < rhs.bytecount || (lhs.bytecount == rhs.bytecount && lhs.ptr < rhs.ptr));
-			}, sout);
-		bytesizes* aout;
-		rcmalloc::binary_search(begin_basic_list<bytesizes>(sizes), end_basic_list<bytesizes>(sizes), *after,
-			[](const bytesizes& lhs,
-			   const bytesizes& rhs) {
-				return (lhs.bytecount < rhs.bytecount || (lhs.bytecount == rhs.bytecount && lhs.ptr < rhs.ptr));
-			}, aout);
-
-		before->bytecount += fm.bytecount;
-		before->bytecount += after->bytecount;
-		*sout = *before;
-
-		//remove after
-		uint32_t beforePos = dist(begin_basic_list<bytesizes>(sizes), sout);
-		uint32_t afterPos = dist(begin_basic_list<bytesizes>(sizes), aout);
-
-		freeOut = erase_basic_list<bytesizes>(freelst, after);
-		erase_basic_list<bytesizes>(sizes, aout);
-		--freeOut;
-
-		if(afterPos <= beforePos)
-			--beforePos;
-
-		sortMemDown(sizes, begin_basic_list<bytesizes>(sizes) + beforePos);
-	} else if(connectsBefore(freelst, fm, before, after)) {
-		//increase the size of before
-		//search the sizes to update
-		bytesizes* sout;
-		rcmalloc::binary_search(begin_basic_list<bytesizes>(sizes), end_basic_list<bytesizes>(sizes), *before,
-			[](const bytesizes& lhs,
-			   const bytesizes& rhs) {
-				return (lhs.bytecount < rhs.bytecount || (lhs.bytecount == rhs.bytecount && lhs.ptr < rhs.ptr));
-			}, sout);
-
-		before->bytecount += fm.bytecount;
-		*sout = *before;
-		sortMemDown(sizes, sout);
-		freeOut = before;
-	} else if(connectsAfter(freelst, fm, before, after)) {
-		//increate the size of after
-		//search the sizes to update
-		bytesizes* sout;
-		rcmalloc::binary_search(begin_basic_list<bytesizes>(sizes), end_basic_list<bytesizes>(sizes), *after,
-			[](const bytesizes& lhs,
-			   const bytesizes& rhs) {
-				return (lhs.bytecount < rhs.bytecount || (lhs.bytecount == rhs.bytecount && lhs.ptr < rhs.ptr));
-			}, sout);
-
-		after->ptr = fm.ptr;
-		after->bytecount += fm.bytecount;
-		*sout = *after;
-		sortMemDown(sizes, sout);
-		freeOut = after;
-	} else {
-		bytesizes tm = fm;
-		//connects neither - reinsert
-		freeOut = insert_basic_list<bytesizes>(freelst, after, std::move(fm));
-
-		//search the sizes to insert
-		bytesizes* sout;
-		rcmalloc::binary_search(begin_basic_list<bytesizes>(sizes), end_basic_list<bytesizes>(sizes), tm,
-			[](const bytesizes& lhs,
-			   const bytesizes& rhs) {
-				return (lhs.bytecount < rhs.bytecount || (lhs.bytecount == rhs.bytecount && lhs.ptr < rhs.ptr));
-			}, sout);
-		insert_basic_list<bytesizes>(sizes, sout, std::move(tm));
-	}
-
-	byteremain += size;
-	return;
-}
-
-void addMemBlock(basic_list& blocklst, memblock* nMmBlck) {
-	memblock** out;
-	rcmalloc::binary_search(begin_basic_list<memblock*>(blocklst), end_basic_list<memblock*>(blocklst), nMmBlck,
-		[](memblock* lhs, memblock* rhs) {
-			return lhs->ptr < rhs->ptr;
-		}, out);
-	insert_basic_list<memblock*>(blocklst, out, std::move(nMmBlck));
-}
-void findBlockForPointer(basic_list& blocklst, void* ptr,
-						 memblock**& out) {
-	memblock stkBlck;
-	stkBlck.ptr = (char*)ptr;
-	memblock* sMmBlck = &stkBlck;
-
-	bool rtn = rcmalloc::binary_search(begin_basic_list<memblock*>(blocklst), end_basic_list<memblock*>(blocklst), sMmBlck,
-					[=](memblock* lhs, memblock* rhs) {
-						return lhs->ptr < rhs->ptr;
-					}, out);
-	//if we don't find it then, go one back this is what we are searching for
-	if(!rtn)
-		--out;
-}
-void sortMemBlockDown(basic_list& blockfreespace,
-					  memblock** blk) {
-	//search blockfreespace for this block
-	auto itr = end_basic_list<memblock*>(blockfreespace) - 1;
-	for(; itr != begin_basic_list<memblock*>(blockfreespace) - 1; --itr)
-		if(*itr == *blk)
-			break;
-
-	//move this about in the sizes list
-	while(itr != end_basic_list<memblock*>(blockfreespace) - 1) {
-		auto tmp = itr;
-		++tmp;
-		//test less - not less than then break
-		if(!((*itr)->byteremain > (*tmp)->byteremain))
-			break;
-		std::swap(*tmp, *itr);
-		++itr;
-	}
-}
-
-
-}
-
+/*----------------------------------------------------------------------------------*\
+ |																					|
+ | rcmalloc.cpp	 																	|
+ |																					|
+ | Copyright (c) 2019 Richard Cookman												|
+ |																					|
+ | Permission is hereby granted, free of charge, to any person obtaining a copy		|
+ | of this software and associated documentation files (the "Software"), to deal	|
+ | in the Software without restriction, including without limitation the rights		|
+ | to use, copy, modify, merge, publish, distribute, sublicense, and/or sell		|
+ | copies of the Software, and to permit persons to whom the Software is			|
+ | furnished to do so, subject to the following conditions:							|
+ |																					|
+ | The above copyright notice and this permission notice shall be included in all	|
+ | copies or substantial portions of the Software.									|
+ |																					|
+ | THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR		|
+ | IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,			|
+ | FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE		|
+ | AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER			|
+ | LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,	|
+ | OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE	|
+ | SOFTWARE.																		|
+ |																					|
+\*----------------------------------------------------------------------------------*/
+
+#include "rcmalloc.hpp"
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <linux/futex.h>
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#if defined(_MSC_VER)
+#include <malloc.h>
+#endif
+#if defined(__GLIBC__) || defined(__APPLE__)
+#include <execinfo.h>
+#define RCMALLOC_HAS_BACKTRACE
+#elif defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#endif
+#if defined(RCMALLOC_OVERRIDE_MALLOC)
+#if !defined(__GLIBC__)
+#error "RCMALLOC_OVERRIDE_MALLOC needs glibc"
+#endif
+//malloc is rcmalloc, the bookkeeping goes to glibc's own entry points
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void __libc_free(void* ptr);
+void* __libc_memalign(size_t alignment, size_t size);
+}
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#define RCMALLOC_HAS_MMAP
+#if !defined(MAP_ANONYMOUS)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
+namespace rcmalloc {
+
+alloc_data init_alloc_data_basic() {
+	alloc_data rtn;
+	memset((char*)&rtn, 0, sizeof(alloc_data));
+	rtn.minalignment = std::alignment_of<uintptr_t>();
+	rtn.byterounding = sizeof(uintptr_t);
+	return rtn;
+}
+realloc_data init_realloc_data_basic() {
+	realloc_data rtn;
+	memset((char*)&rtn, 0, sizeof(realloc_data));
+	rtn.minalignment = std::alignment_of<uintptr_t>();
+	rtn.byterounding = sizeof(uintptr_t);
+	return rtn;
+}
+alloc_data to_alloc_data(const realloc_data* dat) {
+	//copy across everything needed
+	alloc_data rtn;
+	memset((char*)&rtn, 0, sizeof(alloc_data));
+	rtn.size = dat->to_byte_size;
+	rtn.alignment = dat->alignment;
+	rtn.size_of = dat->size_of;
+	rtn.minalignment = dat->minalignment;
+	rtn.byterounding = dat->byterounding;
+	return rtn;
+}
+dealloc_data init_dealloc_data_basic() {
+	dealloc_data rtn;
+	memset((char*)&rtn, 0, sizeof(dealloc_data));
+	rtn.minalignment = std::alignment_of<uintptr_t>();
+	rtn.byterounding = sizeof(uintptr_t);
+	return rtn;
+}
+
+vgcsettings::~vgcsettings() {}
+
+vallocator::~vallocator() {}
+uint32_t vallocator::do_malloc_batch(const alloc_data* dat, void** out, uint32_t count) {
+	//one at a time unless the allocator does better
+	for(uint32_t i = 0; i < count; ++i) {
+		out[i] = do_malloc(dat);
+		if(out[i] == 0)
+			return i;
+	}
+	return count;
+}
+void vallocator::do_free_batch(const dealloc_data* dat, void* const* ptrs, uint32_t count) {
+	dealloc_data ldat = *dat;
+	for(uint32_t i = 0; i < count; ++i) {
+		ldat.ptr = ptrs[i];
+		do_free(&ldat);
+	}
+}
+void vallocator::do_add_stack_variable(void* stkptr, stack_variable_cleanup fptr) {
+	//add pointer to stack item
+	//NEEDED by garbage collectors only
+}
+void vallocator::do_remove_stack_variable_range(void* stkptr, uint32_t frame_size) {
+	//remove pointers to stack items
+	//NEEDED by garbage collectors only
+}
+void vallocator::do_cleanup(const vgcsettings& settings) {
+	//do stop the world cleanup
+	//NEEDED by garbage collectors only
+}
+void vallocator::do_test_cleanup(const vgcsettings& settings) {
+	//do stop the world cleanup
+	//NEEDED by garbage collectors only
+}
+void* vallocator::do_dereference(void* ptr) {
+	//pointer dereference
+	//NEEDED by garbage collectors only
+	return ptr;
+}
+void* meta_malloc(size_t size) {
+#if defined(RCMALLOC_OVERRIDE_MALLOC)
+	return __libc_malloc(size);
+#else
+	return malloc(size);
+#endif
+}
+void* meta_calloc(size_t count, size_t size) {
+#if defined(RCMALLOC_OVERRIDE_MALLOC)
+	return __libc_calloc(count, size);
+#else
+	return calloc(count, size);
+#endif
+}
+void* meta_realloc(void* ptr, size_t size) {
+#if defined(RCMALLOC_OVERRIDE_MALLOC)
+	return __libc_realloc(ptr, size);
+#else
+	return realloc(ptr, size);
+#endif
+}
+void meta_free(void* ptr) {
+#if defined(RCMALLOC_OVERRIDE_MALLOC)
+	__libc_free(ptr);
+#else
+	free(ptr);
+#endif
+}
+#if !defined(_MSC_VER)
+void* meta_memalign(size_t alignment, size_t size) {
+#if defined(RCMALLOC_OVERRIDE_MALLOC)
+	return __libc_memalign(alignment, size);
+#else
+	void* rtn;
+	if(posix_memalign(&rtn, alignment, size) != 0)
+		return 0;
+	return rtn;
+#endif
+}
+#endif
+
+bool vallocator::do_get_stats(alloc_stats* /*out*/) const {
+	return false;
+}
+vallocator& vallocator::get_allocator() {
+	return *this;
+}
+const vallocator& vallocator::get_allocator() const {
+	return *this;
+}
+
+void roundAllocation(uint32_t minalignment, uint32_t byterounding,
+					 rc_size_t& size, uint32_t& alignment) {
+	if(size == 0) size = 1;
+	if(alignment < minalignment) alignment = minalignment;
+	uint32_t md = size % byterounding;
+	if(md > 0) size += byterounding - md;
+}
+void roundAllocation(realloc_data& ldat) {
+	roundAllocation(ldat.minalignment, ldat.byterounding, ldat.from_byte_size, ldat.alignment);
+	roundAllocation(ldat.minalignment, ldat.byterounding, ldat.to_byte_size, ldat.alignment);
+}
+void move_object_list_forward(void* begto, void* begfrm, void* endfrm, rc_size_t count,
+							  uint32_t size_of, object_move_func move_func) {
+	char* lclbegfrm = (char*)begfrm;
+	//char* lclendfrm = (char*)endfrm;
+	char* lclbegto = (char*)begto;
+
+	for(; count > 0; lclbegfrm+=size_of, lclbegto+=size_of, --count)
+		move_func(lclbegto, lclbegfrm);
+}
+void move_object_list_backward(void* endto, void* begfrm, void* endfrm, rc_size_t count,
+							   uint32_t size_of, object_move_func move_func) {
+	//char* lclbegfrm = (char*)begfrm - size_of;
+	char* lclendfrm = (char*)endfrm - size_of;
+	char* lclendto = (char*)endto - size_of;
+
+	for(; count > 0; lclendfrm-=size_of, lclendto-=size_of, --count)
+		move_func(lclendto, lclendfrm);
+}
+void memMove(void* begto, void* endto, void* begfrm, void* endfrm,
+			 rc_size_t count, const realloc_data& dat) {
+	//no move if moving to same place
+	if(begfrm == begto)
+		return;
+
+	if(dat.istrivial) {
+		//better performance for trivially copyable types
+		memmove((char*)begto, (char*)begfrm, dist((char*)begfrm, (char*)endfrm));
+	} else {
+		object_move_func mvfunc;
+		if((uint32_t)abs(dist((char*)begfrm, (char*)begto)) < dat.size_of)
+			//if we need an intermediary (partial object overlap)
+			mvfunc = dat.intermediary_move_func;
+		else
+			mvfunc = dat.move_func;
+		if((char*)begto >= (char*)begfrm && (char*)begto < (char*)endfrm) {
+			//overlap at the beginning
+			move_object_list_backward(endto, begfrm, endfrm, count,
+									  dat.size_of, mvfunc);
+			return;
+		} else if((char*)endto >= (char*)begfrm && (char*)endto < (char*)endfrm) {
+			//overlap at the end
+			move_object_list_forward(begto, begfrm, endfrm, count,
+									 dat.size_of, mvfunc);
+			return;
+		}
+		//just move
+		move_object_list_forward(begto, begfrm, endfrm, count,
+								 dat.size_of, dat.move_func);
+	}
+	return;
+}
+inline bool moveEndFirst(char* toptr, rc_offset_t keep_to_byte_offset,
+						 char* frmptr, rc_offset_t keep_from_byte_offset) {
+	return (toptr + keep_to_byte_offset) > (frmptr + keep_from_byte_offset);
+}
+void* doMemMove(char* toPtr, char* frmPtr,
+				const realloc_data& dat) {
+	rc_size_t keep_byte_size_1 = dat.keep_byte_size_1;
+	rc_size_t keep_byte_size_2 = dat.keep_byte_size_2;
+	rc_offset_t keep_from_byte_offset_1 = dat.keep_from_byte_offset_1;
+	rc_offset_t keep_from_byte_offset_2 = dat.keep_from_byte_offset_2;
+	rc_offset_t keep_to_byte_offset_1 = dat.keep_to_byte_offset_1;
+	rc_offset_t keep_to_byte_offset_2 = dat.keep_to_byte_offset_2;
+	rc_size_t count_1 = dat.from_count_1;
+	rc_size_t count_2 = dat.from_count_2;
+
+	//move the memory
+	if(moveEndFirst((char*)toPtr, keep_to_byte_offset_2,
+					(char*)frmPtr, keep_from_byte_offset_2)) {
+		std::swap(keep_from_byte_offset_1, keep_from_byte_offset_2);
+		std::swap(keep_to_byte_offset_1, keep_to_byte_offset_2);
+		std::swap(keep_byte_size_1, keep_byte_size_2);
+		std::swap(count_1, count_2);
+	}
+	//memmove((char*)toPtr + keep_to_byte_offset_1, (char*)frmPtr + keep_from_byte_offset_1, keep_byte_size_1);
+	memMove((char*)toPtr + keep_to_byte_offset_1, (char*)toPtr + keep_to_byte_offset_1 + keep_byte_size_1,
+			(char*)frmPtr + keep_from_byte_offset_1, (char*)frmPtr + keep_from_byte_offset_1 + keep_byte_size_1,
+			count_1, dat);
+	//memmove((char*)toPtr + keep_to_byte_offset_2, (char*)frmPtr + keep_from_byte_offset_2, keep_byte_size_2);
+	memMove((char*)toPtr + keep_to_byte_offset_2, (char*)toPtr + keep_to_byte_offset_2 + keep_byte_size_2,
+			(char*)frmPtr + keep_from_byte_offset_2, (char*)frmPtr + keep_from_byte_offset_2 + keep_byte_size_2,
+			count_2, dat);
+	return toPtr;
+}
+
+void sortMemUp(basic_list& sizes, bytesizes* itr) {
+	//move this about in the sizes list
+	while(itr != begin_basic_list<bytesizes>(sizes)) {
+		auto tmp = itr;
+		--tmp;
+		//test less - not less than then break
+		if(!(itr->bytecount < tmp->bytecount || (itr->bytecount == tmp->bytecount && itr->ptr < tmp->ptr)))
+			break;
+		std::swap(*tmp, *itr);
+		--itr;
+	}
+}
+void sortMemDown(basic_list& sizes, bytesizes* itr) {
+	//move this about in the sizes list
+	while(itr != end_basic_list<bytesizes>(sizes) - 1) {
+		auto tmp = itr;
+		++tmp;
+		//test less - not less than then break
+		if(!(tmp->bytecount < itr->bytecount || (tmp->bytecount == itr->bytecount && tmp->ptr < itr->ptr)))
+			break;
+		std::swap(*tmp, *itr);
+		++itr;
+	}
+}
+bool slab_class_index(rc_size_t lsize, uint32_t alignment, uint32_t& idx) {
+	if(lsize > SLAB_MAX_SIZE || alignment > SLAB_MAX_ALIGNMENT)
+		return false;
+	uint32_t size = (uint32_t)lsize;
+	//8 byte steps up to 128 then 4 classes per power of two
+	if(size <= 128)
+		idx = (size - 1) >> 3;
+	else {
+		uint32_t f = highest_bit(size - 1);
+		idx = 16 + ((f - 7) << 2) + ((size - 1) >> (f - 2)) - 4;
+	}
+	//slots are only aligned to the size of the slot
+	while(slab_class_size(idx) % alignment != 0)
+		++idx;
+	return true;
+}
+uint32_t slab_class_size(uint32_t idx) {
+	if(idx < 16)
+		return (idx + 1) << 3;
+	uint32_t g = (idx - 16) >> 2;
+	return (128 << g) + (((idx - 16) & 3) + 1) * (32 << g);
+}
+void memblock_base::slab_init(uint32_t idx) {
+	slabsize = slab_class_size(idx);
+	slabused = 0;
+	slabclass = idx;
+	slabfree = 0;
+	slabbump = ptr;
+	slabnext = 0;
+	slabprev = 0;
+}
+void* memblock_base::slab_malloc() {
+	void* rtn;
+	if(slabfree != 0) {
+		rtn = slabfree;
+		slabfree = *(void**)rtn;
+	} else {
+		//slots never used yet
+		rtn = slabbump;
+		slabbump += slabsize;
+	}
+	++slabused;
+	return rtn;
+}
+void memblock_base::slab_free(void* p) {
+	*(void**)p = slabfree;
+	slabfree = p;
+	--slabused;
+}
+void memblock::init() {
+	sizes = init_basic_list<bytesizes>(30);
+	freelst = init_basic_list<bytesizes>(30);
+}
+void memblock::init_block(char* p, uint32_t total, uint32_t used) {
+	bytetotal = total;
+	byteremain = total - used;
+	ptr = p;
+	if(used < total) {
+		init();
+		push_back_basic_list<bytesizes>(sizes, bytesizes{total - used, p + used});
+		push_back_basic_list<bytesizes>(freelst, bytesizes{total - used, p + used});
+	}
+}
+memblock::~memblock() {
+	//NOTE doesn't free ptr here - faster final cleanup!!!
+	/*uint32_t bytetotal;
+	uint32_t byteremain;
+	char* ptr;*/
+	dtor_basic_list<bytesizes>(sizes);
+	dtor_basic_list<bytesizes>(freelst);
+}
+void* memblock::internal_malloc_at_hint(uint32_t size, bytesizes* pfrelst, void* hint) {
+	//realloc hints are byte offsets, keep extents aligned to granule
+	hint = (void*)((uintptr_t)hint & ~(uintptr_t)(granule - 1));
+	//can we allocate here??
+	if(pfrelst != end_basic_list<bytesizes>(freelst) &&
+	   (char*)hint >= pfrelst->ptr && ((char*)hint + size) <= (pfrelst->ptr + pfrelst->bytecount)) {
+		//get the size for this
+		bytesizes* sout;
+		rcmalloc::binary_search(begin_basic_list<bytesizes>(sizes), end_basic_list<bytesizes>(sizes), *pfrelst,
+			[](const bytesizes& lhs,
+			   const bytesizes& rhs) {
+				return (lhs.bytecount < rhs.bytecount || (lhs.bytecount == rhs.bytecount && lhs.ptr < rhs.ptr));
+			}, sout);
+
+		//allocate this here and now
+		if(((char*)hint == pfrelst->ptr) & (((char*)hint + size) == (pfrelst->ptr + pfrelst->bytecount))) {
+			//takes whole block - remove block and size
+			erase_basic_list<bytesizes>(freelst, pfrelst);
+			erase_basic_list<bytesizes>(sizes, sout);
+		} else if((char*)hint == pfrelst->ptr) {
+			//matches front of block
+			pfrelst->bytecount -= size;
+			pfrelst->ptr += size;
+			sout->bytecount -= size;
+			sout->ptr += size;
+
+			sortMemUp(sizes, sout);
+		} else if(((char*)hint + size) == (pfrelst->ptr + pfrelst->bytecount)) {
+			//matches back of block
+			pfrelst->bytecount -= size;
+			sout->bytecount -= size;
+
+			sortMemUp(sizes, sout);
+		} else {
+			//split block and size
+			bytesizes nszs;
+			nszs.bytecount = pfrelst->bytecount - (dist(pfrelst->ptr, (char*)hint) + size);
+			nszs.ptr = (char*)hint + size;
+			bytesizes tszs = nszs;
+
+			pfrelst->bytecount = dist(pfrelst->ptr, (char*)hint);
+			sout->bytecount = dist(pfrelst->ptr, (char*)hint);
+
+			sortMemUp(sizes, sout);
+
+			//insert a new block after this one
+			insert_basic_list<bytesizes>(freelst, pfrelst + 1, std::move(nszs));
+
+			bytesizes* iout;
+			rcmalloc::binary_search(begin_basic_list<bytesizes>(sizes), end_basic_list<bytesizes>(sizes), tszs,
+				[](const bytesizes& lhs,
+				   const bytesizes& rhs) {
+					return (lhs.bytecount < rhs.bytecount || (lhs.bytecount == rhs.bytecount && lhs.ptr < rhs.ptr));
+				}, iout);
+			insert_basic_list<bytesizes>(sizes, iout, std::move(tszs));
+		}
+		byteremain -= size;
+		return hint;
+	}
+	return 0;
+}
+void* memblock::internal_malloc_aligned(uint32_t size, uint32_t alignment, uint32_t offset) {
+	//NOTE size always > 0 and a multiple of granule
+	if(byteremain < size) return 0;
+
+	bytesizes bszs;
+	bszs.bytecount = size;
+
+	//the smallest extent with size bytes at an aligned position
+	bytesizes* sout;
+	rcmalloc::binary_search(begin_basic_list<bytesizes>(sizes), end_basic_list<bytesizes>(sizes), bszs,
+		[](const bytesizes& lhs,
+		   const bytesizes& rhs) {
+			return lhs.bytecount < rhs.bytecount;
+		}, sout);
+	for(; sout != end_basic_list<bytesizes>(sizes); ++sout) {
+		char* aligned = (char*)((((uintptr_t)sout->ptr + offset + alignment - 1) & ~(uintptr_t)(alignment - 1)) - offset);
+		if(aligned + size > sout->ptr + sout->bytecount)
+			continue;
+
+		//search the pointers
+		bszs.ptr = sout->ptr;
+		bytesizes* pout;
+		rcmalloc::binary_search(begin_basic_list<bytesizes>(freelst), end_basic_list<bytesizes>(freelst), bszs,
+			[](const bytesizes& lhs,
+			   const bytesizes& rhs) {
+				return lhs.ptr < rhs.ptr;
+			}, pout);
+		return internal_malloc_at_hint(size, pout, aligned);
+	}
+	return 0;
+}
+void memblock::purge_free(vpagesource* src, uint32_t minsize) {
+	//sizes is sorted so the largest are at the end
+	for(auto it = end_basic_list<bytesizes>(sizes) - 1;
+		it != begin_basic_list<bytesizes>(sizes) - 1 && it->bytecount >= minsize;
+		--it)
+		purge_extent(src, it->ptr, it->bytecount, 0);
+}
+void* memblock::internal_malloc(uint32_t size) {
+	//NOTE size always > 0
+	if(byteremain < size) return 0;
+
+	bytesizes bszs;
+	bszs.bytecount = size;
+
+	//search the sizes
+	bytesizes* sout;
+	rcmalloc::binary_search(begin_basic_list<bytesizes>(sizes), end_basic_list<bytesizes>(sizes), bszs,
+		[](const bytesizes& lhs,
+		   const bytesizes& rhs) {
+			return lhs.bytecount < rhs.bytecount;
+		}, sout);
+
+	//couldn't find big enough
+	if(sout == end_basic_list<bytesizes>(sizes)) return 0;
+
+	//search the pointers
+	bszs.ptr = sout->ptr;
+	bytesizes* pout;
+	rcmalloc::binary_search(begin_basic_list<bytesizes>(freelst), end_basic_list<bytesizes>(freelst), bszs,
+		[](const bytesizes& lhs,
+		   const bytesizes& rhs) {
+			return lhs.ptr < rhs.ptr;
+		}, pout);
+
+	void* rslt = pout->ptr;
+
+	byteremain -= size;
+	if(sout->bytecount == size) {
+		//just remove both of these
+		erase_basic_list<bytesizes>(freelst, pout);
+		erase_basic_list<bytesizes>(sizes, sout);
+	} else {
+		//"split" this
+		//modify both of these
+		sout->bytecount -= size;
+		sout->ptr += size;
+
+		pout->bytecount -= size;
+		pout->ptr += size;
+
+		//move this about in the sizes list
+		sortMemUp(sizes, sout);
+	}
+	return rslt;
+}
+inline bool connectsBefore(basic_list& freelst, const bytesizes& fm,
+						   bytesizes* before,
+						   bytesizes* after) {
+	if(before == begin_basic_list<bytesizes>(freelst) - 1)
+		return false;
+	return (before->ptr + before->bytecount) == fm.ptr;
+}
+inline bool connectsAfter(basic_list& freelst, const bytesizes& fm,
+						  bytesizes* before,
+						  bytesizes* after) {
+	if(after == end_basic_list<bytesizes>(freelst))
+		return false;
+	return (fm.ptr + fm.bytecount) == after->ptr;
+}
+inline bool connectsBeforeAndAfter(basic_list& freelst, const bytesizes& fm,
+								   bytesizes* before,
+								   bytesizes* after) {
+	return connectsBefore(freelst, fm, before, after) &&
+		   connectsAfter(freelst, fm, before, after);
+}
+void* memblock::internal_realloc(
+		const realloc_data* dat,
+		bytesizes*& freeOut
+) {
+	/*hints - user hint*/
+	bytesizes* bsize0 = 0;
+	void* hint0 = dat->hint;
+	/*keep before in place - minimise move - just expand*/
+	bytesizes* bsize1 = 0;
+	void* hint1 = 0;
+	/*keep after in place - minimise move - just expand*/
+	bytesizes* bsize2 = 0;
+	void* hint2 = 0;
+	/*give this space at the beginning - minimise relocation*/
+	bytesizes* bsize3 = 0;
+	void* hint3 = 0;
+	/*into the current memory block - minimise fragmentation*/
+	bytesizes* bsize4 = 0;
+	void* hint4 = 0;
+
+	if(!dat->ptr) {
+		void* rslt = 0;
+		if(rslt == 0 && hint0) {
+			bytesizes bszs;
+			bszs.bytecount = dat->to_byte_size;
+			bszs.ptr = (char*)hint0;
+			rcmalloc::binary_search(begin_basic_list<bytesizes>(freelst), end_basic_list<bytesizes>(freelst), bszs,
+				[](const bytesizes& lhs,
+				   const bytesizes& rhs) {
+					return lhs.ptr < rhs.ptr;
+				}, bsize0);
+			//try to allocate at the hint
+			rslt = internal_malloc_at_hint(dat->to_byte_size, bsize0, hint0);
+		}
+		if(rslt == 0)
+			rslt = internal_malloc(dat->to_byte_size);
+		return rslt;
+	}
+
+	//do free before allocation!
+	internal_free(dat->ptr, dat->from_byte_size, freeOut);
+
+	void* rslt = 0;
+	{
+		//calculate the hints
+		if(rslt == 0 && hint0) {
+			bytesizes bszs;
+			bszs.bytecount = dat->to_byte_size;
+			bszs.ptr = (char*)hint0;
+			rcmalloc::binary_search(begin_basic_list<bytesizes>(freelst), end_basic_list<bytesizes>(freelst), bszs,
+				[](const bytesizes& lhs,
+				   const bytesizes& rhs) {
+					return lhs.ptr < rhs.ptr;
+				}, bsize0);
+			//try to allocate at the hint
+			rslt = internal_malloc_at_hint(dat->to_byte_size, bsize0, hint0);
+		}
+
+		if(rslt == 0) {
+			//keep the front the same
+			bsize1 = freeOut;
+			hint1 = ((char*)dat->ptr + dat->keep_from_byte_offset_1) - dat->keep_to_byte_offset_1;
+			//keep the back the same
+			bsize2 = freeOut;
+			hint2 = ((char*)dat->ptr + dat->keep_from_byte_offset_2) - dat->keep_to_byte_offset_2;
+
+			//try to allocate the largest of the two first
+			if(dat->keep_byte_size_2 > dat->keep_byte_size_1) {
+				std::swap(hint1, hint2);
+				std::swap(bsize1, bsize2);
+			}
+
+			if(rslt == 0)
+				rslt = internal_malloc_at_hint(dat->to_byte_size, bsize1, hint1);
+			if(rslt == 0)
+				rslt = internal_malloc_at_hint(dat->to_byte_size, bsize2, hint2);
+		}
+
+		//move this into the largest of the free blocks - give this space at the beginning
+		if(rslt == 0) {
+			bytesizes bszs = *(end_basic_list<bytesizes>(sizes) - 1);
+			rcmalloc::binary_search(begin_basic_list<bytesizes>(freelst), end_basic_list<bytesizes>(freelst), bszs,
+				[](const bytesizes& lhs,
+				   const bytesizes& rhs) {
+					return lhs.ptr < rhs.ptr;
+				}, bsize3);
+			hint3 = bsize3->ptr + dat->to_byte_size;
+
+			rslt = internal_malloc_at_hint(dat->to_byte_size, bsize3, hint3);
+		}
+
+		if(rslt == 0) {
+			bsize4 = freeOut;
+			hint4 = freeOut->ptr;
+			rslt = internal_malloc_at_hint(dat->to_byte_size, bsize4, hint4);
+		}
+
+		//tried malloc at all of the hint locations - just malloc
+		if(rslt == 0)
+			rslt = internal_malloc(dat->to_byte_size);
+		if(rslt == 0)
+			return 0;
+	}
+
+
+	//do memove
+	doMemMove((char*)rslt, (char*)dat->ptr, *dat);
+	return rslt;
+}
+void memblock::internal_free(void* p, uint32_t size, bytesizes*& freeOut) {
+	/*uint32_t bytetotal;
+	uint32_t byteremain;
+	char* ptr;
+	vector<bytesizes, basic_aligned_allocator<bytesizes>> sizes;
+	vector<bytecount, basic_aligned_allocator<bytecount>> freelst;*/
+
+	//if this isn't within this!
+	if((char*)p < ptr || (char*)p >= (ptr + bytetotal))
+		return;
+
+	if(byteremain == 0) {
+		//simply return this, everything allocated
+		byteremain += size;
+
+		bytesizes fm;
+		fm.bytecount = size;
+		fm.ptr = (char*)p;
+		bytesizes tm = fm;
+
+		push_back_basic_list<bytesizes>(sizes, std::move(fm));
+		push_back_basic_list<bytesizes>(freelst, std::move(tm));
+		freeOut = begin_basic_list<bytesizes>(freelst);
+		return;
+	}
+
+	//find the before and after on the free list
+	bytesizes fm;
+	fm.bytecount = size;
+	fm.ptr = (char*)p;
+	bytesizes* before;
+	bytesizes* after;
+	rcmalloc::binary_search(begin_basic_list<bytesizes>(freelst), end_basic_list<bytesizes>(freelst), fm,
+		[](const bytesizes& lhs,
+		   const bytesizes& rhs) {
+			return lhs.ptr < rhs.ptr;
+		}, after);
+
+	before = after;
+	--before;
+
+	if(connectsBeforeAndAfter(freelst, fm, before, after)) {
+		//increase the size of before
+		//search the sizes to update
+		bytesizes* sout;
+		rcmalloc::binary_search(begin_basic_list<bytesizes>(sizes), end_basic_list<bytesizes>(sizes), *before,
+			[](const bytesizes& lhs,
+			   const bytesizes& rhs) {
+				return (lhs.bytecount < rhs.bytecount || (lhs.bytecount == rhs.bytecount && lhs.ptr < rhs.ptr));
+			}, sout);
+		bytesizes* aout;
+		rcmalloc::binary_search(begin_basic_list<bytesizes>(sizes), end_basic_list<bytesizes>(sizes), *after,
+			[](const bytesizes& lhs,
+			   const bytesizes& rhs) {
+				return (lhs.bytecount < rhs.bytecount || (lhs.bytecount == rhs.bytecount && lhs.ptr < rhs.ptr));
+			}, aout);
+
+		before->bytecount += fm.bytecount;
+		before->bytecount += after->bytecount;
+		*sout = *before;
+
+		//remove after
+		uint32_t beforePos = dist(begin_basic_list<bytesizes>(sizes), sout);
+		uint32_t afterPos = dist(begin_basic_list<bytesizes>(sizes), aout);
+
+		freeOut = erase_basic_list<bytesizes>(freelst, after);
+		erase_basic_list<bytesizes>(sizes, aout);
+		--freeOut;
+
+		if(afterPos <= beforePos)
+			--beforePos;
+
+		sortMemDown(sizes, begin_basic_list<bytesizes>(sizes) + beforePos);
+	} else if(connectsBefore(freelst, fm, before, after)) {
+		//increase the size of before
+		//search the sizes to update
+		bytesizes* sout;
+		rcmalloc::binary_search(begin_basic_list<bytesizes>(sizes), end_basic_list<bytesizes>(sizes), *before,
+			[](const bytesizes& lhs,
+			   const bytesizes& rhs) {
+				return (lhs.bytecount < rhs.bytecount || (lhs.bytecount == rhs.bytecount && lhs.ptr < rhs.ptr));
+			}, sout);
+
+		before->bytecount += fm.bytecount;
+		*sout = *before;
+		sortMemDown(sizes, sout);
+		freeOut = before;
+	} else if(connectsAfter(freelst, fm, before, after)) {
+		//increate the size of after
+		//search the sizes to update
+		bytesizes* sout;
+		rcmalloc::binary_search(begin_basic_list<bytesizes>(sizes), end_basic_list<bytesizes>(sizes), *after,
+			[](const bytesizes& lhs,
+			   const bytesizes& rhs) {
+				return (lhs.bytecount < rhs.bytecount || (lhs.bytecount == rhs.bytecount && lhs.ptr < rhs.ptr));
+			}, sout);
+
+		after->ptr = fm.ptr;
+		after->bytecount += fm.bytecount;
+		*sout = *after;
+		sortMemDown(sizes, sout);
+		freeOut = after;
+	} else {
+		bytesizes tm = fm;
+		//connects neither - reinsert
+		freeOut = insert_basic_list<bytesizes>(freelst, after, std::move(fm));
+
+		//search the sizes to insert
+		bytesizes* sout;
+		rcmalloc::binary_search(begin_basic_list<bytesizes>(sizes), end_basic_list<bytesizes>(sizes), tm,
+			[](const bytesizes& lhs,
+			   const bytesizes& rhs) {
+				return (lhs.bytecount < rhs.bytecount || (lhs.bytecount == rhs.bytecount && lhs.ptr < rhs.ptr));
+			}, sout);
+		insert_basic_list<bytesizes>(sizes, sout, std::move(tm));
+	}
+
+	byteremain += size;
+	return;
+}
+
+inline void tlsf_mapping_insert(uint32_t size, uint32_t& fl, uint32_t& sl) {
+	if(size < TLSF_SMALL_SIZE) {
+		//small sizes get a list each
+		fl = 0;
+		sl = size >> TLSF_GRANULE_LOG2;
+	} else {
+		uint32_t f = highest_bit(size);
+		sl = (size >> (f - TLSF_SL_LOG2)) ^ TLSF_SL_COUNT;
+		fl = f - (TLSF_SL_LOG2 + TLSF_GRANULE_LOG2 - 1);
+	}
+}
+inline void tlsf_mapping_search(uint32_t size, uint32_t& fl, uint32_t& sl) {
+	//round up to the next list so anything found in that list fits
+	if(size >= TLSF_SMALL_SIZE)
+		size += (1 << (highest_bit(size) - TLSF_SL_LOG2)) - 1;
+	tlsf_mapping_insert(size, fl, sl);
+}
+inline tlsf_node& tlsf_get_node(basic_list& nodes, uint32_t idx) {
+	return index_basic_list<tlsf_node>(nodes, idx);
+}
+tlsf_memblock::~tlsf_memblock() {
+	//NOTE doesn't free ptr here - faster final cleanup!!!
+	dtor_basic_list<tlsf_node>(nodes);
+	meta_free(slbitmaps);
+	meta_free(freestarts);
+}
+void tlsf_memblock::init_block(char* p, uint32_t total, uint32_t used) {
+	bytetotal = total;
+	byteremain = total - used;
+	ptr = p;
+	nodes = init_basic_list<tlsf_node>(16);
+	freenode = TLSF_NONE;
+	flbitmap = 0;
+
+	//only enough first level lists for the size of this block
+	uint32_t fl, sl;
+	tlsf_mapping_insert(total, fl, sl);
+	flcount = fl + 1;
+	slbitmaps = (uint32_t*)meta_calloc(flcount * (TLSF_SL_COUNT + 1), sizeof(uint32_t));
+	heads = slbitmaps + flcount;
+	memset((char*)heads, 0xFF, flcount * TLSF_SL_COUNT * sizeof(uint32_t));
+	uint32_t words = ((total >> TLSF_GRANULE_LOG2) + 63) / 64;
+	freestarts = (uint64_t*)meta_calloc(words * 2, sizeof(uint64_t));
+	freeends = freestarts + words;
+
+	if(used < total)
+		insert_free(p + used, total - used);
+}
+uint32_t tlsf_memblock::insert_free(char* p, uint32_t size) {
+	//reuse a node if we can
+	uint32_t idx;
+	if(freenode != TLSF_NONE) {
+		idx = freenode;
+		freenode = tlsf_get_node(nodes, idx).next;
+	} else {
+		idx = size_basic_list<tlsf_node>(nodes);
+		push_back_basic_list<tlsf_node>(nodes, tlsf_node{0, 0, TLSF_NONE, TLSF_NONE});
+	}
+
+	uint32_t fl, sl;
+	tlsf_mapping_insert(size, fl, sl);
+	uint32_t& head = heads[fl * TLSF_SL_COUNT + sl];
+
+	tlsf_node& nd = tlsf_get_node(nodes, idx);
+	nd.ptr = p;
+	nd.bytecount = size;
+	nd.prev = TLSF_NONE;
+	nd.next = head;
+	if(head != TLSF_NONE)
+		tlsf_get_node(nodes, head).prev = idx;
+	head = idx;
+	flbitmap |= 1u << fl;
+	slbitmaps[fl] |= 1u << sl;
+
+	//boundary tags - the node index at both ends of the free extent
+	memcpy(p, (char*)&idx, sizeof(uint32_t));
+	memcpy(p + size - sizeof(uint32_t), (char*)&idx, sizeof(uint32_t));
+	uint32_t first = dist(ptr, p) >> TLSF_GRANULE_LOG2;
+	uint32_t last = (dist(ptr, p + size) - 1) >> TLSF_GRANULE_LOG2;
+	freestarts[first >> 6] |= 1ull << (first & 63);
+	freeends[last >> 6] |= 1ull << (last & 63);
+	return idx;
+}
+void tlsf_memblock::remove_free(uint32_t idx) {
+	tlsf_node& nd = tlsf_get_node(nodes, idx);
+	uint32_t fl, sl;
+	tlsf_mapping_insert(nd.bytecount, fl, sl);
+
+	if(nd.prev != TLSF_NONE)
+		tlsf_get_node(nodes, nd.prev).next = nd.next;
+	else {
+		heads[fl * TLSF_SL_COUNT + sl] = nd.next;
+		if(nd.next == TLSF_NONE) {
+			//list now empty
+			slbitmaps[fl] &= ~(1u << sl);
+			if(slbitmaps[fl] == 0)
+				flbitmap &= ~(1u << fl);
+		}
+	}
+	if(nd.next != TLSF_NONE)
+		tlsf_get_node(nodes, nd.next).prev = nd.prev;
+
+	uint32_t first = dist(ptr, nd.ptr) >> TLSF_GRANULE_LOG2;
+	uint32_t last = (dist(ptr, nd.ptr + nd.bytecount) - 1) >> TLSF_GRANULE_LOG2;
+	freestarts[first >> 6] &= ~(1ull << (first & 63));
+	freeends[last >> 6] &= ~(1ull << (last & 63));
+
+	//recycle the node
+	nd.ptr = 0;
+	nd.bytecount = 0;
+	nd.next = freenode;
+	freenode = idx;
+}
+uint32_t tlsf_memblock::largest_free() const {
+	if(flbitmap == 0)
+		return 0;
+	uint32_t fl = highest_bit(flbitmap);
+	uint32_t sl = highest_bit(slbitmaps[fl]);
+	if(fl == 0)
+		return sl << TLSF_GRANULE_LOG2;
+	//inverse of tlsf_mapping_insert
+	uint32_t f = fl + (TLSF_SL_LOG2 + TLSF_GRANULE_LOG2 - 1);
+	return (TLSF_SL_COUNT | sl) << (f - TLSF_SL_LOG2);
+}
+void tlsf_memblock::purge_free(vpagesource* src, uint32_t minsize) {
+	uint32_t fl, sl;
+	tlsf_mapping_insert(minsize, fl, sl);
+	for(; fl < flcount; ++fl, sl = 0) {
+		for(; sl < TLSF_SL_COUNT; ++sl) {
+			for(uint32_t idx = heads[fl * TLSF_SL_COUNT + sl]; idx != TLSF_NONE;) {
+				tlsf_node& nd = tlsf_get_node(nodes, idx);
+				//the boundary tags must survive
+				if(nd.bytecount >= minsize)
+					purge_extent(src, nd.ptr, nd.bytecount, granule);
+				idx = nd.next;
+			}
+		}
+	}
+}
+uint32_t tlsf_memblock::find_free(uint32_t size) {
+	uint32_t fl, sl;
+	tlsf_mapping_search(size, fl, sl);
+	if(fl >= flcount)
+		return TLSF_NONE;
+
+	uint32_t slmap = slbitmaps[fl] & (~0u << sl);
+	if(slmap == 0) {
+		//nothing in this first level list, use the next larger one
+		uint32_t flmap = (fl + 1 < 32 ? flbitmap & (~0u << (fl + 1)) : 0);
+		if(flmap == 0)
+			return TLSF_NONE;
+		fl = lowest_bit(flmap);
+		slmap = slbitmaps[fl];
+	}
+	sl = lowest_bit(slmap);
+	return heads[fl * TLSF_SL_COUNT + sl];
+}
+uint32_t tlsf_memblock::free_before(char* p) {
+	//free extent ending at p?
+	if(p <= ptr)
+		return TLSF_NONE;
+	uint32_t last = (dist(ptr, p) >> TLSF_GRANULE_LOG2) - 1;
+	if((freeends[last >> 6] & (1ull << (last & 63))) == 0)
+		return TLSF_NONE;
+	uint32_t idx;
+	memcpy((char*)&idx, p - sizeof(uint32_t), sizeof(uint32_t));
+	return idx;
+}
+uint32_t tlsf_memblock::free_after(char* p) {
+	//free extent starting at p?
+	if(p >= (ptr + bytetotal))
+		return TLSF_NONE;
+	uint32_t first = dist(ptr, p) >> TLSF_GRANULE_LOG2;
+	if((freestarts[first >> 6] & (1ull << (first & 63))) == 0)
+		return TLSF_NONE;
+	uint32_t idx;
+	memcpy((char*)&idx, p, sizeof(uint32_t));
+	return idx;
+}
+void* tlsf_memblock::internal_malloc(uint32_t size) {
+	//NOTE size always > 0 and a multiple of granule
+	if(byteremain < size) return 0;
+
+	uint32_t idx = find_free(size);
+	if(idx == TLSF_NONE) return 0;
+
+	tlsf_node nd = tlsf_get_node(nodes, idx);
+	remove_free(idx);
+	//"split" this
+	if(nd.bytecount > size)
+		insert_free(nd.ptr + size, nd.bytecount - size);
+	byteremain -= size;
+	return nd.ptr;
+}
+void* tlsf_memblock::internal_malloc_aligned(uint32_t size, uint32_t alignment, uint32_t offset) {
+	//NOTE size always > 0 and a multiple of granule
+	if(byteremain < size) return 0;
+
+	//the extent found for size may happen to fit, any extent of worst does
+	uint32_t idx = find_free(size);
+	char* aligned = 0;
+	if(idx != TLSF_NONE) {
+		tlsf_node nd = tlsf_get_node(nodes, idx);
+		aligned = (char*)((((uintptr_t)nd.ptr + offset + alignment - 1) & ~(uintptr_t)(alignment - 1)) - offset);
+		if(aligned + size > nd.ptr + nd.bytecount)
+			idx = TLSF_NONE;
+	}
+	if(idx == TLSF_NONE) {
+		idx = find_free(size + alignment - granule);
+		if(idx == TLSF_NONE) return 0;
+		char* p = tlsf_get_node(nodes, idx).ptr;
+		aligned = (char*)((((uintptr_t)p + offset + alignment - 1) & ~(uintptr_t)(alignment - 1)) - offset);
+	}
+
+	tlsf_node nd = tlsf_get_node(nodes, idx);
+	remove_free(idx);
+	//give back the slack before and after
+	uint32_t lead = (uint32_t)dist(nd.ptr, aligned);
+	if(lead > 0)
+		insert_free(nd.ptr, lead);
+	if(nd.bytecount > lead + size)
+		insert_free(aligned + size, nd.bytecount - lead - size);
+	byteremain -= size;
+	return aligned;
+}
+void* tlsf_memblock::internal_realloc(
+		const realloc_data* dat,
+		uint32_t& freeOut
+) {
+	char* p = (char*)dat->ptr;
+	uint32_t from = dat->from_byte_size;
+	uint32_t to = dat->to_byte_size;
+
+	if(to <= from) {
+		//shrink in place - move the kept ranges before giving back the end
+		doMemMove(p, p, *dat);
+		if(to < from)
+			internal_free(p + to, from - to, freeOut);
+		return p;
+	}
+
+	//grow in place into the free extent after this
+	uint32_t after = free_after(p + from);
+	if(after != TLSF_NONE && tlsf_get_node(nodes, after).bytecount >= (to - from)) {
+		tlsf_node nd = tlsf_get_node(nodes, after);
+		remove_free(after);
+		if(nd.bytecount > (to - from))
+			insert_free(nd.ptr + (to - from), nd.bytecount - (to - from));
+		byteremain -= to - from;
+		return doMemMove(p, p, *dat);
+	}
+
+	//move elsewhere in this block, only free the old memory once moved
+	void* rslt = internal_malloc(to);
+	if(rslt == 0)
+		return 0;
+
+	//do memove - no overlap
+	doMemMove((char*)rslt, p, *dat);
+	internal_free(p, from, freeOut);
+	return rslt;
+}
+void tlsf_memblock::internal_free(void* p, uint32_t size, uint32_t& freeOut) {
+	//if this isn't within this!
+	if((char*)p < ptr || (char*)p >= (ptr + bytetotal))
+		return;
+
+	byteremain += size;
+
+	//coalesce with the free extents either side
+	char* start = (char*)p;
+	uint32_t total = size;
+	uint32_t before = free_before(start);
+	if(before != TLSF_NONE) {
+		start = tlsf_get_node(nodes, before).ptr;
+		total += tlsf_get_node(nodes, before).bytecount;
+		remove_free(before);
+	}
+	uint32_t after = free_after((char*)p + size);
+	if(after != TLSF_NONE) {
+		total += tlsf_get_node(nodes, after).bytecount;
+		remove_free(after);
+	}
+	freeOut = insert_free(start, total);
+}
+
+void addMemBlock(basic_list& blocklst, memblock_base* nMmBlck) {
+	nMmBlck->slot = size_basic_list<memblock_base*>(blocklst);
+	push_back_basic_list<memblock_base*>(blocklst, std::move(nMmBlck));
+}
+void removeMemBlock(basic_list& blocklst, memblock_base* blck) {
+	//move the last block into this slot
+	memblock_base** slt = begin_basic_list<memblock_base*>(blocklst) + blck->slot;
+	memblock_base** lst = end_basic_list<memblock_base*>(blocklst) - 1;
+	*slt = *lst;
+	(*slt)->slot = blck->slot;
+	erase_basic_list<memblock_base*>(blocklst, lst);
+}
+free_index init_free_index(uint32_t leaves) {
+	free_index rtn;
+	rtn.leaves = leaves;
+	rtn.tree = (uint32_t*)meta_calloc(2 * leaves, sizeof(uint32_t));
+	return rtn;
+}
+void dtor_free_index(free_index& fi) {
+	meta_free(fi.tree);
+	fi.tree = 0;
+	fi.leaves = 0;
+}
+void set_free_index(free_index& fi, uint32_t slot, uint32_t largest) {
+	if(slot >= fi.leaves) {
+		//double the leaves, then rebuild the inner nodes
+		uint32_t nleaves = fi.leaves;
+		while(slot >= nleaves)
+			nleaves *= 2;
+		uint32_t* ntree = (uint32_t*)meta_calloc(2 * nleaves, sizeof(uint32_t));
+		memcpy((char*)(ntree + nleaves), (char*)(fi.tree + fi.leaves), fi.leaves * sizeof(uint32_t));
+		for(uint32_t i = nleaves - 1; i > 0; --i)
+			ntree[i] = std::max(ntree[2 * i], ntree[2 * i + 1]);
+		meta_free(fi.tree);
+		fi.tree = ntree;
+		fi.leaves = nleaves;
+	}
+	uint32_t i = fi.leaves + slot;
+	if(fi.tree[i] == largest)
+		return;
+	fi.tree[i] = largest;
+	//walk up until a parent doesn't change
+	for(i >>= 1; i > 0; i >>= 1) {
+		uint32_t mx = std::max(fi.tree[2 * i], fi.tree[2 * i + 1]);
+		if(fi.tree[i] == mx)
+			break;
+		fi.tree[i] = mx;
+	}
+}
+void move_free_index(free_index& fi, uint32_t from, uint32_t to) {
+	uint32_t largest = (from == to ? 0 : fi.tree[fi.leaves + from]);
+	set_free_index(fi, from, 0);
+	set_free_index(fi, to, largest);
+}
+uint32_t find_free_index(const free_index& fi, uint32_t size) {
+	if(fi.tree[1] < size)
+		return FREE_INDEX_NONE;
+	//prefer the lowest slot - older blocks fill up, newer ones can empty
+	uint32_t i = 1;
+	while(i < fi.leaves)
+		i = (fi.tree[2 * i] >= size ? 2 * i : 2 * i + 1);
+	return i - fi.leaves;
+}
+void* vpagesource::do_remap(void* /*ptr*/, rc_size_t /*size*/, rc_size_t /*newsize*/) {
+	return 0;
+}
+void vpagesource::do_purge(void* ptr, rc_size_t size) {
+	//MADV_DONTNEED over MADV_FREE, lazily freed pages still count as resident
+#if defined(RCMALLOC_HAS_MMAP) && defined(MADV_DONTNEED)
+	madvise(ptr, size, MADV_DONTNEED);
+#elif defined(RCMALLOC_HAS_MMAP) && defined(MADV_FREE)
+	madvise(ptr, size, MADV_FREE);
+#endif
+}
+uint32_t vpagesource::page_size() const {
+	return ALLOC_PAGE_SIZE;
+}
+vpagesource::~vpagesource() {}
+
+const char* heap_page_source::name() const {
+	return "heap_page_source";
+}
+void* heap_page_source::do_map(rc_size_t size) {
+#if defined(_MSC_VER)
+	return _aligned_malloc(size, ALLOC_PAGE_SIZE);
+#else
+	return meta_memalign(ALLOC_PAGE_SIZE, size);
+#endif
+}
+void heap_page_source::do_unmap(void* ptr, rc_size_t size) {
+	//the heap keeps freed memory resident, at least let the os have the pages
+	do_purge(ptr, size);
+#if defined(_MSC_VER)
+	_aligned_free(ptr);
+#else
+	meta_free(ptr);
+#endif
+}
+
+mmap_page_source::mmap_page_source(huge_page_mode mode) : mode(mode) {}
+const char* mmap_page_source::name() const {
+	return "mmap_page_source";
+}
+#if defined(RCMALLOC_HAS_MMAP)
+//map size bytes aligned to alignment, trims the over allocation
+static void* mmap_aligned(rc_size_t size, uint32_t alignment) {
+	size_t mapsz = (size_t)size + alignment - ALLOC_PAGE_SIZE;
+	char* mem = (char*)mmap(0, mapsz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(mem == (char*)MAP_FAILED)
+		return 0;
+	char* rtn = (char*)(((uintptr_t)mem + alignment - 1) & ~((uintptr_t)alignment - 1));
+	if(rtn != mem)
+		munmap(mem, dist(mem, rtn));
+	if((rtn + size) != (mem + mapsz))
+		munmap(rtn + size, dist(rtn + size, mem + mapsz));
+	return rtn;
+}
+#endif
+void* mmap_page_source::do_map(rc_size_t size) {
+#if defined(RCMALLOC_HAS_MMAP)
+	if(mode == HUGE_PAGES_NONE) {
+		void* rtn = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		return rtn == MAP_FAILED ? 0 : rtn;
+	}
+#if defined(MAP_HUGETLB)
+	if(mode == HUGE_PAGES_EXPLICIT) {
+		void* rtn = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if(rtn != MAP_FAILED)
+			return rtn;
+		//no reserved huge pages left - try transparent huge pages
+	}
+#endif
+	void* rtn = mmap_aligned(size, HUGE_PAGE_SIZE);
+#if defined(MADV_HUGEPAGE)
+	if(rtn != 0)
+		madvise(rtn, size, MADV_HUGEPAGE);
+#endif
+	return rtn;
+#else
+	return default_page_source()->do_map(size);
+#endif
+}
+void mmap_page_source::do_unmap(void* ptr, rc_size_t size) {
+#if defined(RCMALLOC_HAS_MMAP)
+	munmap(ptr, size);
+#else
+	default_page_source()->do_unmap(ptr, size);
+#endif
+}
+void* mmap_page_source::do_remap(void* ptr, rc_size_t size, rc_size_t newsize) {
+#if defined(RCMALLOC_HAS_MMAP) && defined(MREMAP_MAYMOVE)
+	void* rtn = mremap(ptr, size, newsize, MREMAP_MAYMOVE);
+	return rtn == MAP_FAILED ? 0 : rtn;
+#else
+	return 0;
+#endif
+}
+uint32_t mmap_page_source::page_size() const {
+	return mode == HUGE_PAGES_NONE ? ALLOC_PAGE_SIZE : HUGE_PAGE_SIZE;
+}
+numa_page_source::numa_page_source(uint32_t node) : mmap_page_source(HUGE_PAGES_NONE), node(node) {}
+const char* numa_page_source::name() const {
+	return "numa_page_source";
+}
+void* numa_page_source::do_map(rc_size_t size) {
+	void* rtn = mmap_page_source::do_map(size);
+#if defined(__linux__) && defined(RCMALLOC_HAS_MMAP) && defined(SYS_mbind)
+	//before first touch, the pages aren't placed yet - a failed bind just leaves them local
+	if(rtn != 0 && node < NUMA_MAX_NODES) {
+		unsigned long mask[NUMA_MAX_NODES / (8 * sizeof(unsigned long))] = {};
+		mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+		syscall(SYS_mbind, rtn, (unsigned long)size, MPOL_PREFERRED, mask, NUMA_MAX_NODES + 1, 0);
+	}
+#endif
+	return rtn;
+}
+static void depot_push(depot_stack& stk, depot_node* nodes, uint32_t idx) {
+	uint64_t old = stk.head.load(std::memory_order_relaxed);
+	for(;;) {
+		nodes[idx].next.store((uint32_t)old, std::memory_order_relaxed);
+		uint64_t nhead = (((old >> 32) + 1) << 32) | (idx + 1);
+		if(stk.head.compare_exchange_weak(old, nhead, std::memory_order_release, std::memory_order_relaxed))
+			return;
+	}
+}
+//BLOCK_DEPOT_SLOTS if empty
+static uint32_t depot_pop(depot_stack& stk, depot_node* nodes) {
+	uint64_t old = stk.head.load(std::memory_order_acquire);
+	for(;;) {
+		uint32_t top = (uint32_t)old;
+		if(top == 0)
+			return BLOCK_DEPOT_SLOTS;
+		//may be stale, then the tag has moved on and the exchange fails
+		uint32_t next = nodes[top - 1].next.load(std::memory_order_relaxed);
+		uint64_t nhead = (((old >> 32) + 1) << 32) | next;
+		if(stk.head.compare_exchange_weak(old, nhead, std::memory_order_acquire, std::memory_order_acquire))
+			return top - 1;
+	}
+}
+//BLOCK_DEPOT_CLASSES if the size isn't kept
+static uint32_t depot_class(rc_size_t size) {
+	if(size < ALLOC_PAGE_SIZE || size > ((rc_size_t)ALLOC_PAGE_SIZE << (BLOCK_DEPOT_CLASSES - 1)) ||
+	   (size & (size - 1)) != 0)
+		return BLOCK_DEPOT_CLASSES;
+	return highest_bit((uint32_t)size) - ALLOC_PAGE_SHIFT;
+}
+depot_page_source::depot_page_source(vpagesource* src) : src(src) {
+	for(uint32_t i = 0; i < BLOCK_DEPOT_SLOTS; ++i)
+		depot_push(unused, nodes, i);
+}
+const char* depot_page_source::name() const {
+	return "depot_page_source";
+}
+void* depot_page_source::do_map(rc_size_t size) {
+	uint32_t cls = depot_class(size);
+	if(cls != BLOCK_DEPOT_CLASSES) {
+		uint32_t idx = depot_pop(classes[cls], nodes);
+		if(idx != BLOCK_DEPOT_SLOTS) {
+			void* rtn = nodes[idx].ptr;
+			depot_push(unused, nodes, idx);
+			bytes.fetch_sub(size, std::memory_order_relaxed);
+			return rtn;
+		}
+	}
+	return src->do_map(size);
+}
+void depot_page_source::do_unmap(void* ptr, rc_size_t size) {
+	uint32_t cls = depot_class(size);
+	if(cls != BLOCK_DEPOT_CLASSES) {
+		//reserve the bytes first so the limit holds with many threads
+		if(bytes.fetch_add(size, std::memory_order_relaxed) + size <= BLOCK_DEPOT_MAX_BYTES) {
+			uint32_t idx = depot_pop(unused, nodes);
+			if(idx != BLOCK_DEPOT_SLOTS) {
+				//kept mapped but the os can have the pages until it is used again
+				src->do_purge(ptr, size);
+				nodes[idx].ptr = ptr;
+				depot_push(classes[cls], nodes, idx);
+				return;
+			}
+		}
+		bytes.fetch_sub(size, std::memory_order_relaxed);
+	}
+	src->do_unmap(ptr, size);
+}
+void* depot_page_source::do_remap(void* ptr, rc_size_t size, rc_size_t newsize) {
+	return src->do_remap(ptr, size, newsize);
+}
+void depot_page_source::do_purge(void* ptr, rc_size_t size) {
+	src->do_purge(ptr, size);
+}
+uint32_t depot_page_source::page_size() const {
+	return src->page_size();
+}
+uint64_t depot_page_source::held_bytes() const {
+	return bytes.load(std::memory_order_relaxed);
+}
+
+vpagesource* default_page_source() {
+	//never destroyed, blocks can still be released during static destruction
+	alignas(depot_page_source) static char storage[sizeof(depot_page_source)];
+#if defined(RCMALLOC_OVERRIDE_MALLOC)
+	//the heap is rcmalloc
+	static depot_page_source* src = new (storage) depot_page_source(default_large_page_source());
+#else
+	alignas(heap_page_source) static char heapstorage[sizeof(heap_page_source)];
+	static depot_page_source* src = new (storage) depot_page_source(new (heapstorage) heap_page_source());
+#endif
+	return src;
+}
+vpagesource* default_large_page_source() {
+	alignas(mmap_page_source) static char storage[sizeof(mmap_page_source)];
+	static mmap_page_source* src = new (storage) mmap_page_source(HUGE_PAGES_NONE);
+	return src;
+}
+vpagesource* numa_node_page_source(uint32_t node) {
+	alignas(numa_page_source) static char storage[NUMA_MAX_NODES][sizeof(numa_page_source)];
+	static bool made = []() {
+		for(uint32_t i = 0; i < NUMA_MAX_NODES; ++i)
+			new (storage[i]) numa_page_source(i);
+		return true;
+	}();
+	(void)made;
+	return (numa_page_source*)storage[node % NUMA_MAX_NODES];
+}
+
+//three levels of 4096 entries, 48 bit addresses on 64 bit, the root is static
+//nodes are never freed, they are shared by every allocator and cover 16 MiB per leaf
+const uint32_t PAGE_MAP_LEVEL_BITS = 12;
+const uintptr_t PAGE_MAP_FANOUT = (uintptr_t)1 << PAGE_MAP_LEVEL_BITS;
+const uintptr_t PAGE_MAP_MASK = PAGE_MAP_FANOUT - 1;
+
+typedef std::atomic<memblock_base*> page_map_leaf[PAGE_MAP_FANOUT];
+typedef std::atomic<page_map_leaf*> page_map_node[PAGE_MAP_FANOUT];
+static std::atomic<page_map_node*> page_map_root[PAGE_MAP_FANOUT];
+
+template<typename T>
+T* page_map_child(std::atomic<T*>& slt, bool create) {
+	T* rtn = slt.load(std::memory_order_acquire);
+	if(rtn != 0 || !create)
+		return rtn;
+	T* nnode = (T*)meta_calloc(1, sizeof(T));
+	if(nnode == 0)
+		return 0;
+	//another thread may have added it first
+	if(!slt.compare_exchange_strong(rtn, nnode, std::memory_order_acq_rel)) {
+		meta_free(nnode);
+		return rtn;
+	}
+	return nnode;
+}
+page_map_leaf* page_map_find_leaf(uintptr_t page, bool create) {
+	uintptr_t root = page >> (2 * PAGE_MAP_LEVEL_BITS);
+	if(root >= PAGE_MAP_FANOUT)
+		return 0;
+	page_map_node* node = page_map_child(page_map_root[root], create);
+	if(node == 0)
+		return 0;
+	return page_map_child((*node)[(page >> PAGE_MAP_LEVEL_BITS) & PAGE_MAP_MASK], create);
+}
+bool page_map_set(void* ptr, rc_size_t size, memblock_base* blck) {
+	uintptr_t first = (uintptr_t)ptr >> ALLOC_PAGE_SHIFT;
+	uintptr_t last = ((uintptr_t)ptr + size - 1) >> ALLOC_PAGE_SHIFT;
+	page_map_leaf* leaf = 0;
+	for(uintptr_t page = first; page <= last; ++page) {
+		if(leaf == 0 || (page & PAGE_MAP_MASK) == 0) {
+			leaf = page_map_find_leaf(page, true);
+			if(leaf == 0) {
+				//out of memory - undo the pages set so far
+				if(page != first)
+					page_map_clear(ptr, (rc_size_t)((page - first) << ALLOC_PAGE_SHIFT));
+				return false;
+			}
+		}
+		(*leaf)[page & PAGE_MAP_MASK].store(blck, std::memory_order_relaxed);
+	}
+	return true;
+}
+void page_map_clear(void* ptr, rc_size_t size) {
+	uintptr_t first = (uintptr_t)ptr >> ALLOC_PAGE_SHIFT;
+	uintptr_t last = ((uintptr_t)ptr + size - 1) >> ALLOC_PAGE_SHIFT;
+	page_map_leaf* leaf = 0;
+	for(uintptr_t page = first; page <= last; ++page) {
+		if(leaf == 0 || (page & PAGE_MAP_MASK) == 0)
+			leaf = page_map_find_leaf(page, false);
+		if(leaf != 0)
+			(*leaf)[page & PAGE_MAP_MASK].store(0, std::memory_order_relaxed);
+	}
+}
+memblock_base* page_map_get(void* ptr) {
+	uintptr_t page = (uintptr_t)ptr >> ALLOC_PAGE_SHIFT;
+	page_map_leaf* leaf = page_map_find_leaf(page, false);
+	if(leaf == 0)
+		return 0;
+	return (*leaf)[page & PAGE_MAP_MASK].load(std::memory_order_relaxed);
+}
+uint64_t monotonic_ms() {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+uint32_t retain_limit(uint64_t idle_ms) {
+	return (uint32_t)(RETAIN_MAX_BLOCKS * std::exp2(-(double)idle_ms / RETAIN_HALF_LIFE_MS));
+}
+void purge_extent(vpagesource* src, char* ptr, uint32_t size, uint32_t keep) {
+	//whole pages only, huge pages aren't split
+	uintptr_t pgsz = src->page_size();
+	uintptr_t beg = ((uintptr_t)ptr + keep + pgsz - 1) & ~(pgsz - 1);
+	uintptr_t end = ((uintptr_t)ptr + size - keep) & ~(pgsz - 1);
+	if(end > beg)
+		src->do_purge((void*)beg, (uint32_t)(end - beg));
+}
+alloc_stats init_alloc_stats() {
+	alloc_stats rtn;
+	memset(&rtn, 0, sizeof(rtn));
+	return rtn;
+}
+void add_alloc_stats(alloc_stats& to, const alloc_stats& frm) {
+	to.bytes_mapped += frm.bytes_mapped;
+	to.bytes_live += frm.bytes_live;
+	to.bytes_free += frm.bytes_free;
+	to.block_count += frm.block_count;
+	to.large_count += frm.large_count;
+	to.retained_count += frm.retained_count;
+	if(frm.largest_free > to.largest_free)
+		to.largest_free = frm.largest_free;
+	to.new_blocks += frm.new_blocks;
+	to.realloc_in_place += frm.realloc_in_place;
+	to.realloc_moved += frm.realloc_moved;
+	to.lock_acquisitions += frm.lock_acquisitions;
+	to.remote_frees += frm.remote_frees;
+	to.remote_node_frees += frm.remote_node_frees;
+	for(uint32_t i = 0; i < STATS_SIZE_BUCKETS; ++i)
+		to.size_histogram[i] += frm.size_histogram[i];
+}
+void alloc_counters::read(alloc_stats* out) const {
+	out->bytes_mapped = bytes_mapped.get();
+	out->bytes_live = bytes_live.get();
+	//the counters are read one by one, live may briefly run ahead of mapped
+	out->bytes_free = out->bytes_mapped > out->bytes_live ? out->bytes_mapped - out->bytes_live : 0;
+	out->block_count = block_count.get();
+	out->large_count = large_count.get();
+	out->retained_count = retained_count.get();
+	out->largest_free = largest_free.get();
+	out->new_blocks = new_blocks.get();
+	out->realloc_in_place = realloc_in_place.get();
+	out->realloc_moved = realloc_moved.get();
+	out->lock_acquisitions = lock_acquisitions.get();
+	out->remote_frees = remote_frees.get();
+	out->remote_node_frees = remote_node_frees.get();
+	for(uint32_t i = 0; i < STATS_SIZE_BUCKETS; ++i)
+		out->size_histogram[i] = size_histogram[i].get();
+}
+//heap profiler
+//sampled allocations with the same stack
+struct heap_sample_bucket {
+	uint64_t hash;
+	uint32_t depth;
+	void* stack[HEAP_SAMPLE_MAX_DEPTH];
+	uint64_t allocs;
+	uint64_t alloc_bytes;
+	uint64_t frees;
+	uint64_t free_bytes;
+	heap_sample_bucket* next;
+};
+struct heap_sample {
+	uint64_t size;
+	heap_sample_bucket* bucket;
+};
+const uint32_t HEAP_SAMPLE_BUCKET_HEADS = 4096;
+//slots looked at from a pointers hash
+const uint32_t HEAP_SAMPLE_PROBES = 8;
+
+std::atomic<uint32_t> heap_sample_count{0};
+static std::atomic<uint64_t> heap_sample_rate_bytes{0};
+static std::atomic<uint64_t> heap_sample_seed{0};
+static std::mutex heap_sample_mutex;
+//the rate the samples were taken at, kept when sampling is turned off
+static uint64_t heap_sample_profile_rate = HEAP_SAMPLE_DEFAULT_RATE;
+//live samples by pointer, read without the lock - 0 is an empty slot
+static std::atomic<uintptr_t> heap_sample_ptrs[HEAP_SAMPLE_SLOTS];
+static heap_sample heap_samples[HEAP_SAMPLE_SLOTS];
+static heap_sample_bucket* heap_sample_buckets[HEAP_SAMPLE_BUCKET_HEADS];
+//the profilers own allocations aren't sampled
+static thread_local bool heap_sample_busy = false;
+
+static inline uint64_t mix64(uint64_t v) {
+	v ^= v >> 33;
+	v *= 0xff51afd7ed558ccdULL;
+	v ^= v >> 33;
+	v *= 0xc4ceb9fe1a85ec53ULL;
+	v ^= v >> 33;
+	return v;
+}
+//exponential with mean rate
+static int64_t heap_sample_gap(uint64_t& rng, uint64_t rate) {
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+	//uniform in (0, 1]
+	double u = (double)((rng >> 11) + 1) / 9007199254740992.0;
+	return (int64_t)(-std::log(u) * (double)rate) + 1;
+}
+static uint32_t heap_sample_stack(void** stack) {
+#if defined(RCMALLOC_HAS_BACKTRACE)
+	void* frames[HEAP_SAMPLE_MAX_DEPTH + 1];
+	int depth = backtrace(frames, HEAP_SAMPLE_MAX_DEPTH + 1);
+	//skip heap_sample_malloc
+	if(depth <= 1) return 0;
+	memcpy(stack, frames + 1, (depth - 1) * sizeof(void*));
+	return depth - 1;
+#elif defined(_WIN32)
+	return CaptureStackBackTrace(1, HEAP_SAMPLE_MAX_DEPTH, stack, 0);
+#else
+	return 0;
+#endif
+}
+//call with the lock held
+static heap_sample_bucket* heap_sample_find_bucket(void** stack, uint32_t depth) {
+	uint64_t hash = depth;
+	for(uint32_t i = 0; i < depth; ++i)
+		hash = mix64(hash ^ (uintptr_t)stack[i]);
+	heap_sample_bucket** head = &heap_sample_buckets[hash % HEAP_SAMPLE_BUCKET_HEADS];
+	for(heap_sample_bucket* bkt = *head; bkt != 0; bkt = bkt->next)
+		if(bkt->hash == hash && bkt->depth == depth &&
+		   memcmp(bkt->stack, stack, depth * sizeof(void*)) == 0)
+			return bkt;
+	//buckets are never freed, they keep the counts of freed samples
+	heap_sample_bucket* bkt = (heap_sample_bucket*)meta_malloc(sizeof(heap_sample_bucket));
+	if(bkt == 0) return 0;
+	memset(bkt, 0, sizeof(heap_sample_bucket));
+	bkt->hash = hash;
+	bkt->depth = depth;
+	memcpy(bkt->stack, stack, depth * sizeof(void*));
+	bkt->next = *head;
+	*head = bkt;
+	return bkt;
+}
+static inline uint32_t heap_sample_slot(void* ptr) {
+	return (uint32_t)(mix64((uintptr_t)ptr) % HEAP_SAMPLE_SLOTS);
+}
+
+void set_heap_sample_rate(uint64_t rate) {
+#if defined(RCMALLOC_HAS_BACKTRACE)
+	//the first backtrace loads the unwinder which allocates, do it now rather than
+	//while an allocator is locked
+	if(rate != 0) {
+		void* frame;
+		backtrace(&frame, 1);
+	}
+#endif
+	std::lock_guard<std::mutex> lg(heap_sample_mutex);
+	if(rate != 0)
+		heap_sample_profile_rate = rate;
+	heap_sample_rate_bytes.store(rate, std::memory_order_relaxed);
+}
+uint64_t heap_sample_rate() {
+	return heap_sample_rate_bytes.load(std::memory_order_relaxed);
+}
+void heap_sample_malloc(heap_sampler& smp, void* ptr, rc_size_t size) {
+	if(heap_sample_busy) return;
+	uint64_t rate = heap_sample_rate_bytes.load(std::memory_order_relaxed);
+	if(rate == 0) {
+		smp.rng = 0;
+		smp.countdown = HEAP_SAMPLE_OFF_RECHECK;
+		return;
+	}
+	//first use or sampling was just turned on, start counting from here
+	if(smp.rng == 0) {
+		smp.rng = mix64(heap_sample_seed.fetch_add(1, std::memory_order_relaxed) + (uintptr_t)&smp) | 1;
+		smp.countdown = heap_sample_gap(smp.rng, rate);
+		return;
+	}
+	smp.countdown = heap_sample_gap(smp.rng, rate);
+
+	heap_sample_busy = true;
+	void* stack[HEAP_SAMPLE_MAX_DEPTH];
+	uint32_t depth = heap_sample_stack(stack);
+	{
+		std::lock_guard<std::mutex> lg(heap_sample_mutex);
+		uint32_t slot = heap_sample_slot(ptr);
+		for(uint32_t i = 0; i < HEAP_SAMPLE_PROBES; ++i, slot = (slot + 1) % HEAP_SAMPLE_SLOTS) {
+			if(heap_sample_ptrs[slot].load(std::memory_order_relaxed) != 0)
+				continue;
+			heap_sample_bucket* bkt = heap_sample_find_bucket(stack, depth);
+			if(bkt == 0) break;
+			++bkt->allocs;
+			bkt->alloc_bytes += size;
+			heap_samples[slot].size = size;
+			heap_samples[slot].bucket = bkt;
+			heap_sample_ptrs[slot].store((uintptr_t)ptr, std::memory_order_relaxed);
+			heap_sample_count.fetch_add(1, std::memory_order_relaxed);
+			break;
+		}
+	}
+	heap_sample_busy = false;
+}
+void heap_sample_free(void* ptr) {
+	uint32_t slot = heap_sample_slot(ptr);
+	for(uint32_t i = 0; i < HEAP_SAMPLE_PROBES; ++i, slot = (slot + 1) % HEAP_SAMPLE_SLOTS) {
+		if(heap_sample_ptrs[slot].load(std::memory_order_relaxed) != (uintptr_t)ptr)
+			continue;
+		std::lock_guard<std::mutex> lg(heap_sample_mutex);
+		if(heap_sample_ptrs[slot].load(std::memory_order_relaxed) != (uintptr_t)ptr)
+			return;
+		heap_sample_bucket* bkt = heap_samples[slot].bucket;
+		++bkt->frees;
+		bkt->free_bytes += heap_samples[slot].size;
+		heap_sample_ptrs[slot].store(0, std::memory_order_relaxed);
+		heap_sample_count.fetch_sub(1, std::memory_order_relaxed);
+		return;
+	}
+}
+heap_sample_bucket* heap_sample_take(void* ptr, rc_size_t& size) {
+	uint32_t slot = heap_sample_slot(ptr);
+	for(uint32_t i = 0; i < HEAP_SAMPLE_PROBES; ++i, slot = (slot + 1) % HEAP_SAMPLE_SLOTS) {
+		if(heap_sample_ptrs[slot].load(std::memory_order_relaxed) != (uintptr_t)ptr)
+			continue;
+		std::lock_guard<std::mutex> lg(heap_sample_mutex);
+		if(heap_sample_ptrs[slot].load(std::memory_order_relaxed) != (uintptr_t)ptr)
+			return 0;
+		size = (rc_size_t)heap_samples[slot].size;
+		heap_sample_ptrs[slot].store(0, std::memory_order_relaxed);
+		heap_sample_count.fetch_sub(1, std::memory_order_relaxed);
+		return heap_samples[slot].bucket;
+	}
+	return 0;
+}
+void heap_sample_put(heap_sample_bucket* bkt, void* ptr, rc_size_t oldsize, rc_size_t size) {
+	std::lock_guard<std::mutex> lg(heap_sample_mutex);
+	uint32_t empty = HEAP_SAMPLE_SLOTS;
+	bool sampled = false;
+	uint32_t slot = heap_sample_slot(ptr);
+	for(uint32_t i = 0; i < HEAP_SAMPLE_PROBES; ++i, slot = (slot + 1) % HEAP_SAMPLE_SLOTS) {
+		uintptr_t cur = heap_sample_ptrs[slot].load(std::memory_order_relaxed);
+		//the new memory was sampled when allocated, it has a sample already
+		if(cur == (uintptr_t)ptr)
+			sampled = true;
+		else if(cur == 0 && empty == HEAP_SAMPLE_SLOTS)
+			empty = slot;
+	}
+	if(sampled || empty == HEAP_SAMPLE_SLOTS) {
+		//dropped like a free
+		++bkt->frees;
+		bkt->free_bytes += oldsize;
+		return;
+	}
+	if(size != oldsize) {
+		++bkt->frees;
+		bkt->free_bytes += oldsize;
+		++bkt->allocs;
+		bkt->alloc_bytes += size;
+	}
+	heap_samples[empty].size = size;
+	heap_samples[empty].bucket = bkt;
+	heap_sample_ptrs[empty].store((uintptr_t)ptr, std::memory_order_relaxed);
+	heap_sample_count.fetch_add(1, std::memory_order_relaxed);
+}
+bool write_heap_profile(FILE* out) {
+	std::lock_guard<std::mutex> lg(heap_sample_mutex);
+	heap_sample_busy = true;
+	uint64_t inuse = 0, inuse_bytes = 0, allocs = 0, alloc_bytes = 0;
+	for(uint32_t i = 0; i < HEAP_SAMPLE_BUCKET_HEADS; ++i)
+		for(heap_sample_bucket* bkt = heap_sample_buckets[i]; bkt != 0; bkt = bkt->next) {
+			inuse += bkt->allocs - bkt->frees;
+			inuse_bytes += bkt->alloc_bytes - bkt->free_bytes;
+			allocs += bkt->allocs;
+			alloc_bytes += bkt->alloc_bytes;
+		}
+	//the counts are samples, pprof scales them back up using the rate
+	fprintf(out, "heap profile: %6llu: %8llu [%6llu: %8llu] @ heap_v2/%llu\n",
+			(unsigned long long)inuse, (unsigned long long)inuse_bytes,
+			(unsigned long long)allocs, (unsigned long long)alloc_bytes,
+			(unsigned long long)heap_sample_profile_rate);
+	for(uint32_t i = 0; i < HEAP_SAMPLE_BUCKET_HEADS; ++i)
+		for(heap_sample_bucket* bkt = heap_sample_buckets[i]; bkt != 0; bkt = bkt->next) {
+			fprintf(out, "%6llu: %8llu [%6llu: %8llu] @",
+					(unsigned long long)(bkt->allocs - bkt->frees),
+					(unsigned long long)(bkt->alloc_bytes - bkt->free_bytes),
+					(unsigned long long)bkt->allocs, (unsigned long long)bkt->alloc_bytes);
+			for(uint32_t j = 0; j < bkt->depth; ++j)
+				fprintf(out, " 0x%llx", (unsigned long long)(uintptr_t)bkt->stack[j]);
+			fprintf(out, "\n");
+		}
+	//pprof needs the mappings to symbolize the addresses
+	fprintf(out, "\nMAPPED_LIBRARIES:\n");
+#if defined(__linux__)
+	FILE* maps = fopen("/proc/self/maps", "r");
+	if(maps != 0) {
+		char buf[4096];
+		size_t n;
+		while((n = fread(buf, 1, sizeof(buf), maps)) > 0)
+			fwrite(buf, 1, n, out);
+		fclose(maps);
+	}
+#endif
+	heap_sample_busy = false;
+	return ferror(out) == 0;
+}
+bool write_heap_profile(const char* path) {
+	FILE* out = fopen(path, "w");
+	if(out == 0) return false;
+	bool rtn = write_heap_profile(out);
+	return fclose(out) == 0 && rtn;
+}
+uint64_t monotonic_ns() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//locks
+void lock_yield() {
+	std::this_thread::yield();
+}
+//a node for each lock the thread holds or waits for
+static thread_local mcs_node mcs_nodes[MCS_MAX_HELD];
+//nodes ever used, the rest have never been looked at
+static thread_local uint32_t mcs_used = 0;
+mcs_node* mcs_take_node(mcs_lock* lck) {
+	mcs_node* node = 0;
+	for(uint32_t i = 0; i < mcs_used && node == 0; ++i)
+		if(mcs_nodes[i].owner == 0)
+			node = &mcs_nodes[i];
+	if(node == 0) {
+		//more than MCS_MAX_HELD mcs_locks held or waited for by one thread
+		if(mcs_used == MCS_MAX_HELD)
+			abort();
+		node = &mcs_nodes[mcs_used++];
+	}
+	node->owner = lck;
+	return node;
+}
+mcs_node* mcs_find_node(mcs_lock* lck) {
+	for(uint32_t i = 0; i < mcs_used; ++i)
+		if(mcs_nodes[i].owner == lck)
+			return &mcs_nodes[i];
+	//unlocked without being held by this thread
+	abort();
+}
+void futex_mutex::lock_slow() {
+	//the holder is usually about to let go
+	for(uint32_t i = 0; i < LOCK_SPIN_COUNT; ++i) {
+		cpu_relax();
+		uint32_t unlocked = 0;
+		if(state.load(std::memory_order_relaxed) == 0 &&
+		   state.compare_exchange_weak(unlocked, 1, std::memory_order_acquire, std::memory_order_relaxed))
+			return;
+	}
+	//2 so the unlock knows to wake a sleeper, even when this takes the lock
+	while(state.exchange(2, std::memory_order_acquire) != 0) {
+#if defined(__linux__)
+		syscall(SYS_futex, (uint32_t*)&state, FUTEX_WAIT_PRIVATE, 2, 0, 0, 0);
+#else
+		lock_yield();
+#endif
+	}
+}
+void futex_mutex::wake() {
+#if defined(__linux__)
+	syscall(SYS_futex, (uint32_t*)&state, FUTEX_WAKE_PRIVATE, 1, 0, 0, 0);
+#endif
+}
+
+uint32_t current_cpu() {
+#if defined(__linux__)
+	int cpu = sched_getcpu();
+	if(cpu >= 0)
+		return cpu;
+#endif
+	return 0;
+}
+
+//numa
+//cpus past this are on node 0
+const uint32_t NUMA_MAX_CPUS = 4096;
+struct numa_topology {
+	uint32_t nodes = 1;
+	uint8_t cpunode[NUMA_MAX_CPUS] = {};
+
+	numa_topology();
+};
+#if defined(__linux__)
+//a sysfs id list like "0-3,8,10-11", calls set for each id below max
+template<typename Set>
+static bool read_id_list(const char* path, uint32_t max, Set set) {
+	FILE* in = fopen(path, "r");
+	if(in == 0) return false;
+	char buf[4096];
+	size_t n = fread(buf, 1, sizeof(buf) - 1, in);
+	fclose(in);
+	buf[n] = 0;
+	char* pos = buf;
+	while(*pos >= '0' && *pos <= '9') {
+		unsigned long beg = strtoul(pos, &pos, 10);
+		unsigned long end = beg;
+		if(*pos == '-')
+			end = strtoul(pos + 1, &pos, 10);
+		for(unsigned long id = beg; id <= end && id < max; ++id)
+			set((uint32_t)id);
+		if(*pos == ',')
+			++pos;
+	}
+	return true;
+}
+#endif
+numa_topology::numa_topology() {
+#if defined(__linux__)
+	//no sysfs node directory - not numa, everything is node 0
+	uint32_t maxnode = 0;
+	if(!read_id_list("/sys/devices/system/node/online", NUMA_MAX_NODES,
+					 [&](uint32_t id) { if(id > maxnode) maxnode = id; }))
+		return;
+	nodes = maxnode + 1;
+	for(uint32_t node = 1; node < nodes; ++node) {
+		char path[64];
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", node);
+		read_id_list(path, NUMA_MAX_CPUS, [&](uint32_t cpu) { cpunode[cpu] = (uint8_t)node; });
+	}
+#endif
+}
+static const numa_topology& get_numa_topology() {
+	static numa_topology topo;
+	return topo;
+}
+uint32_t numa_node_count() {
+	return get_numa_topology().nodes;
+}
+uint32_t current_numa_node() {
+	const numa_topology& topo = get_numa_topology();
+	if(topo.nodes == 1)
+		return 0;
+	uint32_t cpu = current_cpu();
+	return cpu < NUMA_MAX_CPUS ? topo.cpunode[cpu] : 0;
+}
+
+
+}
+
@@ -1,875 +1,2705 @@
-/*----------------------------------------------------------------------------------*\
- |																					|
- | rcmalloc.hpp	 																	|
- |																					|
- | Copyright (c) 2019 Richard Cookman												|
- |																					|
- | Permission is hereby granted, free of charge, to any person obtaining a copy		|
- | of this software and associated documentation files (the "Software"), to deal	|
- | in the Software without restriction, including without limitation the rights		|
- | to use, copy, modify, merge, publish, distribute, sublicense, and/or sell		|
- | copies of the Software, and to permit persons to whom the Software is			|
- | furnished to do so, subject to the following conditions:							|
- |																					|
- | The above copyright notice and this permission notice shall be included in all	|
- | copies or substantial portions of the Software.									|
- |																					|
- | THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR		|
- | IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,			|
- | FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE		|
- | AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER			|
- | LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,	|
- | OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE	|
- | SOFTWARE.																		|
- |																					|
-\*----------------------------------------------------------------------------------*/
-#pragma once
-
-#include <stdlib.h>
-#include <string.h>
-#include <memory>
-#include <algorithm>
-#include <mutex>
-#include <type_traits>
-
-namespace rcmalloc {
-
-const uint32_t ALLOC_PAGE_SIZE = 4096;
-
-template<typename U>
-inline ptrdiff_t dist(U* first, U* last) {
-	return last - first;
-}
-inline int midpoint(unsigned imin, unsigned imax) {
-	return ((imax - imin) >> 1) + imin;
-}
-//basic binary search
-template<typename Itr, typename T, typename Less>
-bool binary_search(Itr beg, Itr end, const T& item,
-				   Less comp, Itr& out) {
-	//binary search return the insertion point, in both the found and not found case
-	int sze = rcmalloc::dist(beg, end);
-	if(sze == 0) {
-		out = end;
-		return false;
-	}
-
-	int imin = 0;
-	int imax = sze - 1;
-	int imid = 0;
-
-	// continue searching while [imin,imax] is not empty
-	while(imin <= imax) {
-		// calculate the midpoint for roughly equal partition
-		imid = midpoint(imin, imax);
-		// determine which subarray to search
-		if (comp(*(beg + imid), item))
-			// change min index to search upper subarray
-			imin = imid + 1;
-		else if(comp(item, *(beg + imid)))
-			// change max index to search lower subarray
-			imax = imid - 1;
-		else {
-			out = (beg + imid);
-			return true;
-		}
-	}
-	// item was not found return the insertion point
-	out = (beg + imin);
-	return false;
-}
-
-template<typename T>
-T* get_global_object() {
-	static T object{};
-	return &object;
-}
-
-//basic replacement for vector
-struct basic_list {
-	void* ptr = 0;
-	uint32_t reserved = 0;
-	uint32_t size = 0;
-};
-
-template<typename T>
-inline T* basic_list_realloc(T* ptr, uint32_t newsize) {
-	if(ptr == 0)
-		return (T*)malloc(newsize);
-	return (T*)realloc((void*)ptr, newsize);
-}
-template<typename T>
-inline T* begin_basic_list(basic_list& ths) {
-	return (T*)ths.ptr;
-}
-template<typename T>
-inline T* end_basic_list(basic_list& ths) {
-	return ((T*)ths.ptr) + ths.size;
-}
-template<typename T>
-inline const T* begin_basic_list(const basic_list& ths) {
-	return (const T*)ths.ptr;
-}
-template<typename T>
-inline const T* end_basic_list(const basic_list& ths) {
-	return ((const T*)ths.ptr) + ths.size;
-}
-template<typename T>
-basic_list init_basic_list(uint32_t rsvr = 10) {
-	if(rsvr == 0) rsvr = 10;
-	basic_list rtn;
-	rtn.ptr = calloc(rsvr, sizeof(T));
-	rtn.reserved = rsvr;
-	rtn.size = 0;
-	return rtn;
-}
-template<typename T>
-void dtor_basic_list(basic_list& ths) {
-	for(auto it = begin_basic_list<T>(ths); it != end_basic_list<T>(ths); ++it)
-		it->~T();
-	free(ths.ptr);
-	ths.ptr = 0;
-	ths.reserved = 0;
-	ths.size = 0;
-}
-template<typename T>
-void clear_basic_list(basic_list& ths) {
-	dtor_basic_list<T>(ths);
-}
-template<typename T>
-T* insert_basic_list(basic_list& ths, T* insrt, T&& item) {
-	if(ths.size == ths.reserved) {
-		ths.reserved = (ths.reserved == 0 ? 10 : ths.reserved * 2);
-		uint32_t pst = dist(begin_basic_list<T>(ths), insrt);
-		ths.ptr = basic_list_realloc<T>((T*)ths.ptr, sizeof(T) * ths.reserved);
-		insrt = (T*)ths.ptr + pst;
-	}
-
-	memmove((char*)(insrt + 1), (char*)insrt, sizeof(T) * dist(insrt, end_basic_list<T>(ths)));
-	new (insrt) T(std::move(item));
-	++ths.size;
-	memset((char*)&item, 0, sizeof(T));
-	return insrt;
-}
-template<typename T>
-T* erase_basic_list(basic_list& ths, T* item) {
-	//call destructor
-	item->~T();
-	memmove((char*)item, (char*)(item + 1), sizeof(T) * dist(item + 1, end_basic_list<T>(ths)));
-	--ths.size;
-	return item;
-}
-template<typename T>
-inline T* push_back_basic_list(basic_list& ths, T&& item) {
-	return insert_basic_list(ths, end_basic_list<T>(ths), std::move(item));
-}
-template<typename T>
-inline T* pop_back_basic_list(basic_list& ths) {
-	return erase_basic_list<T>(ths, end_basic_list<T>(ths) - 1);
-}
-template<typename T>
-inline T& index_basic_list(basic_list& ths, uint32_t idx) {
-	return *((T*)ths.ptr + idx);
-}
-template<typename T>
-inline const T& index_basic_list(const basic_list& ths, uint32_t idx) {
-	return *((const T*)ths.ptr + idx);
-}
-template<typename T>
-inline uint32_t size_basic_list(const basic_list& ths) {
-	return ths.size;
-}
-
-template<typename T>
-void readLclInt(const uint8_t* bfr, uint32_t& bfrPos, T& val) {
-	val = 0;
-	for(uint32_t i = 0; i < sizeof(T); ++i) {
-		val <<= 8;
-		val |= bfr[bfrPos];
-		++bfrPos;
-	}
-}
-
-//prevent circular reference to new/delete
-template<typename T>
-T* malloc_new() {
-	T* rtn = (T*)malloc(sizeof(T));
-	new (rtn) T();
-	return rtn;
-}
-template<typename T>
-void delete_free(T* ptr) {
-	ptr->~T();
-	free(ptr);
-}
-
-struct object_data {
-	uint32_t alignment;
-	uint32_t size_of;
-};
-
-template<typename T>
-struct object_move_generator {
-	static void object_move(void* to, void* frm) {
-		if constexpr(!std::is_trivially_move_constructible<T>::value)
-			new (to) T(std::move(*(T*)frm));
-	}
-	static void object_intermediary_move(void* to, void* frm) {
-		if constexpr(!std::is_trivially_move_constructible<T>::value) {
-			//move to intermediary memory first
-			//do no destructor array move ctor
-			alignas(T) char scrtch[sizeof(T)];
-			new (scrtch) T(std::move(*(T*)frm));
-			new (to) T(std::move(*(T*)scrtch));
-		}
-	}
-};
-
-typedef void (*object_move_func)(void* to, void* frm);
-
-struct alloc_data {
-	uint32_t size;
-	uint32_t alignment;
-	uint32_t size_of;
-	uint32_t minalignment;
-	uint32_t byterounding;
-};
-
-struct realloc_data {
-	void* ptr;
-	void* hint;
-	uint32_t from_byte_size;
-	uint32_t to_byte_size;
-	uint32_t keep_byte_size_1;
-	uint32_t keep_byte_size_2;
-	int32_t keep_from_byte_offset_1;
-	int32_t keep_from_byte_offset_2;
-	int32_t keep_to_byte_offset_1;
-	int32_t keep_to_byte_offset_2;
-	uint32_t from_count_1;
-	uint32_t from_count_2;
-	uint32_t alignment;
-	uint32_t size_of;
-	uint32_t minalignment;
-	uint32_t byterounding;
-	object_move_func move_func;
-	object_move_func intermediary_move_func;
-	bool istrivial;
-};
-
-struct dealloc_data {
-	void* ptr;
-	uint32_t size;
-	uint32_t alignment;
-	uint32_t size_of;
-	uint32_t minalignment;
-	uint32_t byterounding;
-};
-
-
-template<typename T>
-alloc_data init_alloc_data() {
-	alloc_data rtn;
-	memset((char*)&rtn, 0, sizeof(alloc_data));
-	rtn.size = sizeof(T);
-	rtn.alignment = std::alignment_of<T>();
-	rtn.size_of = sizeof(T);
-	rtn.minalignment = std::alignment_of<uintptr_t>();
-	rtn.byterounding = sizeof(uintptr_t);
-	return rtn;
-}
-alloc_data init_alloc_data_basic();
-
-template<typename T>
-realloc_data init_realloc_data() {
-	realloc_data rtn;
-	memset((char*)&rtn, 0, sizeof(realloc_data));
-	rtn.to_byte_size = sizeof(T);
-	rtn.alignment = std::alignment_of<T>();
-	rtn.size_of = sizeof(T);
-	if constexpr (!std::is_trivially_move_constructible<T>::value) {
-		rtn.move_func = object_move_generator<T>::object_move;
-		rtn.intermediary_move_func = object_move_generator<T>::object_intermediary_move;
-	}
-	rtn.istrivial = std::is_trivially_move_constructible<T>::value;
-	rtn.minalignment = std::alignment_of<uintptr_t>();
-	rtn.byterounding = sizeof(uintptr_t);
-	return rtn;
-}
-realloc_data init_realloc_data_basic();
-alloc_data to_alloc_data(const realloc_data* dat);
-
-template<typename T>
-dealloc_data init_dealloc_data() {
-	dealloc_data rtn;
-	memset((char*)&rtn, 0, sizeof(dealloc_data));
-	rtn.size = sizeof(T);
-	rtn.alignment = std::alignment_of<T>();
-	rtn.size_of = sizeof(T);
-	rtn.minalignment = std::alignment_of<uintptr_t>();
-	rtn.byterounding = sizeof(uintptr_t);
-	return rtn;
-}
-dealloc_data init_dealloc_data_basic();
-
-struct vallocator;
-typedef void (*stack_variable_cleanup)(vallocator* allocator, void* stkptr);
-
-struct vgcsettings {
-	//general virtual base class
-	virtual const char* name() const = 0;
-	virtual void ctorCopy(void* dat) const = 0;
-	virtual void ctorMove(void* dat) = 0;
-	virtual rcmalloc::object_data getDataDesc() const = 0;
-	virtual ~vgcsettings();
-};
-
-struct vallocator {
-	//general virtual base class
-	virtual const char* name() const = 0;
-	virtual void ctorCopy(void* dat) const = 0;
-	virtual void ctorMove(void* dat) = 0;
-	virtual rcmalloc::object_data getDataDesc() const = 0;
-	virtual ~vallocator();
-	//object allocation
-	virtual void* do_malloc(const alloc_data* dat) = 0;
-	virtual void* do_realloc(const realloc_data* dat) = 0;
-	virtual void do_free(const dealloc_data* dat) = 0;
-	//garbage collectors
-	virtual void do_add_stack_variable(void* stkptr, stack_variable_cleanup fptr);
-	virtual void do_remove_stack_variable_range(void* stkptr, uint32_t frame_size);
-	virtual void do_cleanup(const vgcsettings& settings);
-	virtual void do_test_cleanup(const vgcsettings& settings);
-	virtual void* do_dereference(void* ptr);
-	//get pointer to this
-	vallocator& get_allocator();
-	const vallocator& get_allocator() const;
-};
-
-struct memblock;
-
-void roundAllocation(uint32_t minalignment, uint32_t byterounding,
-					 uint32_t& size, uint32_t& alignment);
-void roundAllocation(realloc_data& ldat);
-void* align(uint32_t alignment, uint32_t size_of, void*& ptr);
-char getMemOffset(void* ptr, uint32_t alignment, uint32_t size_of);
-void* setAlignment(void* ptr, uint32_t alignment, uint32_t size_of);
-void* getAlignment(void* ptr, uint32_t alignment, uint32_t& size, uint32_t& offset);
-
-bool moveEndFirst(char* toptr, int32_t keep_to_byte_offset,
-				  char* frmptr, int32_t keep_from_byte_offset);
-void* doMemMove(char* toPtr, char* frmPtr,
-				const realloc_data& dat);
-void addMemBlock(basic_list& blocklst, memblock* nMmBlck);
-void findBlockForPointer(basic_list& blocklst, void* ptr,
-						 memblock**& out);
-void sortMemBlockDown(basic_list& blockfreespace,
-					  memblock** itr);
-
-struct bytesizes {
-	uint32_t bytecount;
-	char* ptr;
-};
-struct memblock {
-	uint32_t bytetotal;
-	uint32_t byteremain;
-	char* ptr;
-	//sorted by bytecount
-	basic_list sizes;
-	//sorted by ptr
-	basic_list freelst;
-
-	void init();
-	~memblock();
-	void* internal_malloc_at_hint(uint32_t size, bytesizes* pfrelst, void* hint);
-	void* internal_malloc(uint32_t size);
-	void* internal_realloc(
-			const realloc_data* dat,
-			char offset,
-			bytesizes*& freeOut
-	);
-	void internal_free(void* ptr, uint32_t size, bytesizes*& freeOut);
-};
-
-template<unsigned AllocSize,
-		 unsigned BlockID>
-struct rc_allocator : public vallocator {
-	//ordered by most recently allocated
-	basic_list blockfreespace;
-	basic_list blocklst;
-
-	rc_allocator() {
-		blockfreespace = init_basic_list<memblock*>(30);
-		blocklst = init_basic_list<memblock*>(30);
-	}
-	~rc_allocator() {
-		dtor_basic_list<memblock*>(blockfreespace);
-		dtor_basic_list<memblock*>(blocklst);
-	}
-	void* malloc_new_block(uint32_t size) {
-		uint32_t resz = ((size / AllocSize) + (size % AllocSize != 0 ? 1 : 0)) * AllocSize;
-
-		void* nmem = malloc(resz);
-		if(nmem == 0) return 0;
-
-		memblock* nMmBlck = malloc_new<memblock>();
-		memblock* tMmBlck = nMmBlck;
-		nMmBlck->init();
-		nMmBlck->bytetotal = resz;
-		nMmBlck->byteremain = resz - size;
-		nMmBlck->ptr = (char*)nmem;
-
-		if((resz - size) > 0) {
-			push_back_basic_list<bytesizes>(nMmBlck->sizes, bytesizes{resz - size, (char*)nmem + size});
-			push_back_basic_list<bytesizes>(nMmBlck->freelst, bytesizes{resz - size, (char*)nmem + size});
-
-			if(resz > AllocSize)
-				insert_basic_list<memblock*>(blockfreespace, begin_basic_list<memblock*>(blockfreespace), std::move(nMmBlck));
-			else
-				push_back_basic_list<memblock*>(blockfreespace, std::move(nMmBlck));
-		} else
-			insert_basic_list<memblock*>(blockfreespace, begin_basic_list<memblock*>(blockfreespace), std::move(nMmBlck));
-
-		addMemBlock(blocklst, tMmBlck);
-		return nmem;
-	}
-
-	void* internal_malloc_i(uint32_t size) {
-		//if allocation >= AllocSize do new allocSize
-		if(size >= AllocSize) {
-			void* nmem = malloc(size);
-			if(nmem == 0) return 0;
-
-			memblock* nMmBlck = malloc_new<memblock>();
-			memblock* tMmBlck = nMmBlck;
-			nMmBlck->init();
-			nMmBlck->bytetotal = size;
-			nMmBlck->byteremain = 0;
-			nMmBlck->ptr = (char*)nmem;
-
-			insert_basic_list<memblock*>(blockfreespace, begin_basic_list<memblock*>(blockfreespace), std::move(nMmBlck));
-			addMemBlock(blocklst, tMmBlck);
-			return nmem;
-		}
-
-		//ensure we don't take too long trying to allocate, only search the first 10 blocks!!
-		uint32_t i = 0;
-		for(auto it = end_basic_list<memblock*>(blockfreespace) - 1;
-			it != begin_basic_list<memblock*>(blockfreespace) - 1 && i < 10;
-			--it, ++i) {
-			void* nmem = 0;
-			if((nmem = (*it)->internal_malloc(size)) != 0)
-				return nmem;
-		}
-
-		//add a new block to hold this
-		return malloc_new_block(size);
-	}
-	void* internal_realloc_i(
-			const realloc_data* dat,
-			char offset
-	) {
-		realloc_data lclDat = *dat;
-		uint32_t alignbytes = 0;
-		if(lclDat.alignment >= 2)
-			alignbytes = lclDat.alignment;
-		lclDat.from_byte_size += alignbytes;
-		lclDat.to_byte_size += alignbytes;
-		lclDat.ptr = (char*)lclDat.ptr - offset;
-		lclDat.hint = (char*)lclDat.hint - offset;
-
-		//search
-		memblock** out;
-		findBlockForPointer(blocklst, lclDat.ptr, out);
-
-		bytesizes* freeOut = 0;
-		void* rtn = (*out)->internal_realloc(
-						&lclDat,
-						offset,
-						freeOut
-					);
-
-		if(rtn == 0) {
-			//allocate a new block to move this to
-			void* rslt = malloc_new_block(lclDat.to_byte_size);
-			if(rslt == 0) {
-				//we have freed this, don't allow that, restore the old size block!!
-				rtn = (*out)->internal_malloc_at_hint(lclDat.from_byte_size, freeOut, lclDat.ptr);
-				return 0;
-			}
-
-			//do alignment
-			if(lclDat.alignment >= 2) {
-				void* rtn = rslt;
-				rcmalloc::align(lclDat.alignment,
-							 lclDat.size_of,
-							 rtn);
-
-				if(rtn == rslt)
-					rtn = (char*)rtn + lclDat.alignment;
-
-				//store the offset to the true block of this
-				char offset = dist((char*)rslt, (char*)rtn);
-				*((char*)rtn - 1) = offset;
-				rslt = rtn;
-			}
-
-			//do memove - guaranteed to have no overlap
-			doMemMove((char*)lclDat.ptr + offset, (char*)rslt, lclDat);
-
-			//free this block
-			sortMemBlockDown(blockfreespace, out);
-			return rslt;
-		}
-		if(lclDat.to_byte_size < lclDat.from_byte_size)
-			sortMemBlockDown(blockfreespace, out);
-		return rtn;
-	}
-	void internal_free_i(void* ptr, uint32_t size) {
-		if(ptr == 0) return;
-		//search
-		memblock** out;
-		findBlockForPointer(blocklst, ptr, out);
-
-		bytesizes* freeOut = 0;
-		(*out)->internal_free(ptr, size, freeOut);
-
-		if(size_basic_list<memblock*>(blocklst) > 1 && (*out)->byteremain == (*out)->bytetotal) {
-			//do we want to free this block?
-			//free/cleanup these
-			memblock* crnt = (*out);
-			free(crnt->ptr);
-			erase_basic_list<memblock*>(blocklst, out);
-			delete_free(crnt);
-
-			auto it = std::find(begin_basic_list<memblock*>(blockfreespace),
-								end_basic_list<memblock*>(blockfreespace),
-								crnt);
-			erase_basic_list<memblock*>(blockfreespace, it);
-			return;
-		}
-
-		sortMemBlockDown(blockfreespace, out);
-	}
-
-	//virtual functions
-	const char* name() const {
-		return "rc_allocator";
-	}
-	void ctorCopy(void* dat) const {
-		new (dat) rc_allocator(*this);
-	}
-	void ctorMove(void* dat) {
-		new (dat) rc_allocator(std::move(*this));
-	}
-	rcmalloc::object_data getDataDesc() const {
-		return rcmalloc::object_data{(uint32_t)std::alignment_of<rc_allocator>(), sizeof(rc_allocator)};
-	}
-
-	void* do_malloc(const alloc_data* dat) {
-		//handle alignment
-		//always allocate atleast one byte!
-		alloc_data ldat = *dat;
-		roundAllocation(ldat.minalignment, ldat.byterounding, ldat.size, ldat.alignment);
-		if(ldat.alignment < 2)
-			return internal_malloc_i(ldat.size);
-
-		uint32_t totalbytes = ldat.size + ldat.alignment;
-		void* alc = internal_malloc_i(totalbytes);
-		void* rtn = alc;
-
-		rcmalloc::align(ldat.alignment,
-					 ldat.size_of,
-					 rtn);
-
-		if(rtn == alc)
-			rtn = (char*)rtn + ldat.alignment;
-
-		//store the offset to the true block of this
-		char offset = dist((char*)alc, (char*)rtn);
-		*((char*)rtn - 1) = offset;
-		return rtn;
-	}
-	void* do_realloc(const realloc_data* dat) {
-		realloc_data lclDat = *dat;
-		if(lclDat.ptr == 0) {
-			alloc_data lclAllocDat = to_alloc_data(dat);
-			return do_malloc(&lclAllocDat);
-		}
-		roundAllocation(lclDat);
-		//always allocate atleast one byte, assume one byte was allocated last time!
-		if(lclDat.from_byte_size == lclDat.to_byte_size)
-			//just move the memory
-			return doMemMove((char*)lclDat.ptr, (char*)lclDat.ptr, lclDat);
-
-		//handle alignment - note alignment handled in internal_realloc_i
-		char offset = 0;
-		if(lclDat.alignment >= 2)
-			offset = *((char*)lclDat.ptr - 1);
-		//no need to store the alignment - simply realloc
-		return internal_realloc_i(
-				&lclDat,
-				offset
-			);
-	}
-	void do_free(const dealloc_data* dat) {
-		//handle alignment
-		if(dat->ptr == 0)
-			return;
-		dealloc_data ldat = *dat;
-		roundAllocation(ldat.minalignment, ldat.byterounding, ldat.size, ldat.alignment);
-		if(ldat.alignment < 2) {
-			internal_free_i(ldat.ptr, ldat.size);
-			return;
-		}
-		char offset = *((char*)ldat.ptr - 1);
-		internal_free_i((char*)ldat.ptr - offset, ldat.size + ldat.alignment);
-	}
-};
-
-template<unsigned AllocSize,
-		 unsigned BlockID>
-struct rc_internal_allocator {
-	rc_allocator<AllocSize, BlockID> fa;
-
-	inline void* do_malloc(const alloc_data* dat) {
-		return fa.do_malloc(dat);
-	}
-	inline void* do_realloc(const realloc_data* dat) {
-		return fa.do_realloc(dat);
-	}
-	inline void do_free(const dealloc_data* dat) {
-		fa.do_free(dat);
-	}
-	inline vallocator& get_allocator() {
-		return fa.get_allocator();
-	}
-};
-
-template<typename Mtx = std::mutex,
-		 unsigned AllocSize = ALLOC_PAGE_SIZE,
-		 unsigned BlockID = 0>
-struct rc_multi_threaded_internal_allocator {
-	Mtx mutex;
-	rc_allocator<AllocSize, BlockID> fia;
-
-	void* do_malloc(const alloc_data* dat) {
-		std::lock_guard<Mtx> lg(mutex);
-		return fia.do_malloc(dat);
-	}
-	void* do_realloc(const realloc_data* dat) {
-		//for performance - don't lock on no change
-		if(dat->from_byte_size == dat->to_byte_size && dat->from_byte_size != 0)
-			//just move the memory
-			return doMemMove((char*)dat->ptr, (char*)dat->ptr, *dat);
-
-		std::lock_guard<Mtx> lg(mutex);
-		return fia.do_realloc(dat);
-	}
-	void do_free(const dealloc_data* dat) {
-		if(dat->ptr == 0) return;
-		std::lock_guard<Mtx> lg(mutex);
-		fia.do_free(dat);
-	}
-	inline vallocator& get_allocator() {
-		return fia.get_allocator();
-	}
-};
-
-template<typename T,
-		 typename IAllocator = rc_multi_threaded_internal_allocator<std::mutex, ALLOC_PAGE_SIZE, 0>>
-struct default_allocator {
-	typedef T value_type;
-	typedef T& reference;
-	typedef T const& const_reference;
-	typedef T* pointer;
-	typedef T const* const_pointer;
-	typedef ptrdiff_t difference_type;
-
-	inline void* allocate(const alloc_data* dat) {
-		IAllocator* allocator = get_global_object<IAllocator>();
-		return allocator->do_malloc(dat);
-	}
-	inline void* reallocate(const realloc_data* dat) {
-		IAllocator* allocator = get_global_object<IAllocator>();
-		return allocator->do_realloc(dat);
-	}
-	inline void deallocate(const dealloc_data* dat) {
-		IAllocator* allocator = get_global_object<IAllocator>();
-		allocator->do_free(dat);
-	}
-	inline vallocator& get_allocator() {
-		IAllocator* allocator = get_global_object<IAllocator>();
-		return allocator->get_allocator();
-	}
-	inline const vallocator& get_allocator() const {
-		IAllocator* allocator = get_global_object<IAllocator>();
-		return allocator->get_allocator();
-	}
-};
-
-template<typename T,
-		 typename IAllocator = rc_multi_threaded_internal_allocator<std::mutex, ALLOC_PAGE_SIZE, 0>>
-using allocator = default_allocator<T, IAllocator>;
-
-template<typename T,
-		 typename IAllocator = default_allocator<T>>
-struct default_std_allocator {
-	typedef T value_type;
-	typedef T& reference;
-	typedef T const& const_reference;
-	typedef T* pointer;
-	typedef T const* const_pointer;
-	typedef std::size_t size_type;
-	typedef ptrdiff_t difference_type;
-	typedef std::true_type propagate_on_container_move_assignment;
-	typedef std::true_type is_always_equal;
-	IAllocator allctr;
-
-	pointer allocate(size_type n, const void* hint = 0) {
-		alloc_data dat = init_alloc_data<value_type>();
-		dat.size = n * sizeof(value_type);
-		return (pointer)allctr.allocate(&dat);
-	}
-
-	void deallocate(T* p, std::size_t n) {
-		dealloc_data dat = init_dealloc_data<value_type>();
-		dat.ptr = p;
-		dat.size = n * sizeof(value_type);
-		allctr.deallocate(&dat);
-	}
-
-	inline size_type max_size() {
-		return std::numeric_limits<size_type>::max();
-	}
-
-	inline void construct(pointer p, const_reference val) {
-		new ((void*)p) T(val);
-	}
-	inline void destroy(pointer p) {
-		p->~T();
-	}
-};
-
-template<class T1, class T2, typename IAllocator>
-inline bool operator==(const default_std_allocator<T1, IAllocator>& lhs, const default_std_allocator<T2, IAllocator>& rhs) noexcept {
-	return true;
-}
-template<class T1, class T2, typename IAllocator>
-inline bool operator!=(const default_std_allocator<T1, IAllocator>& lhs, const default_std_allocator<T2, IAllocator>& rhs) noexcept {
-	return false;
-}
-
-template<typename Alloc>
-typename Alloc::pointer allocate_init_count(uint32_t cnt) {
-	//allocate using the allocator
-	Alloc allctr;
-	alloc_data dat = init_alloc_data<typename Alloc::value_type>();
-	dat.size = sizeof(typename Alloc::value_type) * cnt;
-	typename Alloc::pointer rtn = (typename Alloc::pointer)allctr.allocate(&dat);
-	//do init
-	typename Alloc::pointer tmp = rtn;
-	for(uint32_t i = 0; i < cnt; ++i, ++tmp)
-		new (tmp) typename Alloc::value_type;
-	return rtn;
-}
-template<typename Alloc>
-typename Alloc::pointer allocate_init_count(uint32_t cnt, const typename Alloc::value_type& val) {
-	//allocate using the allocator
-	Alloc allctr;
-	alloc_data dat = init_alloc_data<typename Alloc::value_type>();
-	dat.size = sizeof(typename Alloc::value_type) * cnt;
-	typename Alloc::pointer rtn = (typename Alloc::pointer)allctr.allocate(&dat);
-	//do init
-	typename Alloc::pointer tmp = rtn;
-	for(uint32_t i = 0; i < cnt; ++i, ++tmp)
-		new (tmp) typename Alloc::value_type(val);
-	return rtn;
-}
-
-template<typename Alloc>
-inline typename Alloc::pointer allocate_init() {
-	return allocate_init_count< Alloc >(1);
-}
-
-template<typename Alloc>
-inline typename Alloc::pointer allocate_init(const typename Alloc::value_type& val) {
-	//allocate using the allocator
-	Alloc allctr;
-	alloc_data dat = init_alloc_data<typename Alloc::value_type>();
-	dat.size = sizeof(typename Alloc::value_type);
-	typename Alloc::pointer rtn = (typename Alloc::pointer)allctr.allocate(&dat);
-	new (rtn) typename Alloc::value_type(val);
-	return rtn;
-}
-
-template<typename Alloc>
-inline typename Alloc::pointer allocate_init(typename Alloc::value_type&& val) {
-	//allocate using the allocator
-	Alloc allctr;
-	alloc_data dat = init_alloc_data<typename Alloc::value_type>();
-	dat.size = sizeof(typename Alloc::value_type);
-	typename Alloc::pointer rtn = (typename Alloc::pointer)allctr.allocate(&dat);
-	new (rtn) typename Alloc::value_type(std::move(val));
-	return rtn;
-}
-
-template<typename Alloc>
-void destruct_deallocate_count(typename Alloc::pointer ptr, uint32_t cnt,
-							   uint32_t alignment = std::alignment_of<typename Alloc::value_type>(),
-							   uint32_t size_of = sizeof(typename Alloc::value_type)) {
-	if(ptr == 0)
-		return;
-	//do destruct
-	using X = typename Alloc::value_type;
-	typename Alloc::pointer tmp = ptr;
-	for(uint32_t i = 0; i < cnt; ++i, ++tmp)
-		tmp[i].~X();
-	//deallocate using the allocator
-	Alloc allctr;
-	dealloc_data dat = init_dealloc_data<typename Alloc::value_type>();
-	dat.ptr = ptr;
-	dat.size = sizeof(typename Alloc::value_type) * cnt;
-	dat.alignment = alignment;
-	dat.size_of = size_of;
-	allctr.deallocate(&dat);
-}
-
-template<typename Alloc>
-inline void destruct_deallocate(typename Alloc::pointer ptr,
-								uint32_t alignment = std::alignment_of<typename Alloc::value_type>(),
-								uint32_t size_of = sizeof(typename Alloc::value_type)) {
-	destruct_deallocate_count< Alloc >(ptr, 1, alignment, size_of);
-}
-
-template<typename T>
-inline T* new_T() {
-	return allocate_init< default_allocator< T > >();
-}
-template<typename T>
-inline T* new_T(const T& val) {
-	return allocate_init< default_allocator< T > >(val);
-}
-template<typename T>
-inline T* new_T(T&& val) {
-	return allocate_init< default_allocator< T > >(std::move(val));
-}
-template<typename T>
-inline T* new_T_array(uint32_t cnt) {
-	return allocate_init_count< default_allocator< T > >(cnt);
-}
-template<typename T>
-inline T* new_T_array(const T& val, uint32_t cnt) {
-	return allocate_init_count< default_allocator< T > >(cnt, val);
-}
-
-template<typename T>
-inline void delete_T(T* ptr) {
-	destruct_deallocate_count< default_allocator< T > >(ptr, 1);
-}
-template<typename T>
-inline void delete_T_array(T* ptr, uint32_t cnt) {
-	destruct_deallocate_count< default_allocator< T > >(ptr, cnt);
-}
-
-}
+/*----------------------------------------------------------------------------------*\
+ |																					|
+ | rcmalloc.hpp	 																	|
+ |																					|
+ | Copyright (c) 2019 Richard Cookman												|
+ |																					|
+ | Permission is hereby granted, free of charge, to any person obtaining a copy		|
+ | of this software and associated documentation files (the "Software"), to deal	|
+ | in the Software without restriction, including without limitation the rights		|
+ | to use, copy, modify, merge, publish, distribute, sublicense, and/or sell		|
+ | copies of the Software, and to permit persons to whom the Software is			|
+ | furnished to do so, subject to the following conditions:							|
+ |																					|
+ | The above copyright notice and this permission notice shall be included in all	|
+ | copies or substantial portions of the Software.									|
+ |																					|
+ | THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR		|
+ | IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,			|
+ | FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE		|
+ | AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER			|
+ | LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,	|
+ | OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE	|
+ | SOFTWARE.																		|
+ |																					|
+\*----------------------------------------------------------------------------------*/
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <memory>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <type_traits>
+#include <limits>
+#include <new>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace rcmalloc {
+
+const uint32_t ALLOC_PAGE_SIZE = 4096;
+const uint32_t ALLOC_PAGE_SHIFT = 12;
+const uint32_t CACHE_LINE_SIZE = 64;
+
+//allocation sizes and realloc offsets, build with RCMALLOC_64BIT_SIZES for single
+//allocations over 4 GiB - those are always direct mapped, blocks stay 32 bit
+#if defined(RCMALLOC_64BIT_SIZES)
+typedef uint64_t rc_size_t;
+typedef int64_t rc_offset_t;
+#else
+typedef uint32_t rc_size_t;
+typedef int32_t rc_offset_t;
+#endif
+
+template<typename U>
+inline ptrdiff_t dist(U* first, U* last) {
+	return last - first;
+}
+inline int midpoint(unsigned imin, unsigned imax) {
+	return ((imax - imin) >> 1) + imin;
+}
+//index of the highest set bit, v must not be 0
+inline uint32_t highest_bit(uint32_t v) {
+#if defined(_MSC_VER)
+	unsigned long idx;
+	_BitScanReverse(&idx, v);
+	return idx;
+#else
+	return 31 - __builtin_clz(v);
+#endif
+}
+//index of the lowest set bit, v must not be 0
+inline uint32_t lowest_bit(uint32_t v) {
+#if defined(_MSC_VER)
+	unsigned long idx;
+	_BitScanForward(&idx, v);
+	return idx;
+#else
+	return __builtin_ctz(v);
+#endif
+}
+//basic binary search
+template<typename Itr, typename T, typename Less>
+bool binary_search(Itr beg, Itr end, const T& item,
+				   Less comp, Itr& out) {
+	//binary search return the insertion point, in both the found and not found case
+	int sze = rcmalloc::dist(beg, end);
+	if(sze == 0) {
+		out = end;
+		return false;
+	}
+
+	int imin = 0;
+	int imax = sze - 1;
+	int imid = 0;
+
+	// continue searching while [imin,imax] is not empty
+	while(imin <= imax) {
+		// calculate the midpoint for roughly equal partition
+		imid = midpoint(imin, imax);
+		// determine which subarray to search
+		if (comp(*(beg + imid), item))
+			// change min index to search upper subarray
+			imin = imid + 1;
+		else if(comp(item, *(beg + imid)))
+			// change max index to search lower subarray
+			imax = imid - 1;
+		else {
+			out = (beg + imid);
+			return true;
+		}
+	}
+	// item was not found return the insertion point
+	out = (beg + imin);
+	return false;
+}
+
+template<typename T>
+T* get_global_object() {
+	static T object{};
+	return &object;
+}
+
+//the allocators own bookkeeping, kept off malloc when rcmalloc replaces it (RCMALLOC_OVERRIDE_MALLOC)
+void* meta_malloc(size_t size);
+void* meta_calloc(size_t count, size_t size);
+void* meta_realloc(void* ptr, size_t size);
+void meta_free(void* ptr);
+#if !defined(_MSC_VER)
+void* meta_memalign(size_t alignment, size_t size);
+#endif
+
+//basic replacement for vector
+struct basic_list {
+	void* ptr = 0;
+	uint32_t reserved = 0;
+	uint32_t size = 0;
+};
+
+template<typename T>
+inline T* basic_list_realloc(T* ptr, uint32_t newsize) {
+	if(ptr == 0)
+		return (T*)meta_malloc(newsize);
+	return (T*)meta_realloc((void*)ptr, newsize);
+}
+template<typename T>
+inline T* begin_basic_list(basic_list& ths) {
+	return (T*)ths.ptr;
+}
+template<typename T>
+inline T* end_basic_list(basic_list& ths) {
+	return ((T*)ths.ptr) + ths.size;
+}
+template<typename T>
+inline const T* begin_basic_list(const basic_list& ths) {
+	return (const T*)ths.ptr;
+}
+template<typename T>
+inline const T* end_basic_list(const basic_list& ths) {
+	return ((const T*)ths.ptr) + ths.size;
+}
+template<typename T>
+basic_list init_basic_list(uint32_t rsvr = 10) {
+	if(rsvr == 0) rsvr = 10;
+	basic_list rtn;
+	rtn.ptr = meta_calloc(rsvr, sizeof(T));
+	rtn.reserved = rsvr;
+	rtn.size = 0;
+	return rtn;
+}
+template<typename T>
+void dtor_basic_list(basic_list& ths) {
+	for(auto it = begin_basic_list<T>(ths); it != end_basic_list<T>(ths); ++it)
+		it->~T();
+	meta_free(ths.ptr);
+	ths.ptr = 0;
+	ths.reserved = 0;
+	ths.size = 0;
+}
+template<typename T>
+void clear_basic_list(basic_list& ths) {
+	dtor_basic_list<T>(ths);
+}
+template<typename T>
+T* insert_basic_list(basic_list& ths, T* insrt, T&& item) {
+	if(ths.size == ths.reserved) {
+		ths.reserved = (ths.reserved == 0 ? 10 : ths.reserved * 2);
+		uint32_t pst = dist(begin_basic_list<T>(ths), insrt);
+		ths.ptr = basic_list_realloc<T>((T*)ths.ptr, sizeof(T) * ths.reserved);
+		insrt = (T*)ths.ptr + pst;
+	}
+
+	memmove((char*)(insrt + 1), (char*)insrt, sizeof(T) * dist(insrt, end_basic_list<T>(ths)));
+	new (insrt) T(std::move(item));
+	++ths.size;
+	memset((char*)&item, 0, sizeof(T));
+	return insrt;
+}
+template<typename T>
+T* erase_basic_list(basic_list& ths, T* item) {
+	//call destructor
+	item->~T();
+	memmove((char*)item, (char*)(item + 1), sizeof(T) * dist(item + 1, end_basic_list<T>(ths)));
+	--ths.size;
+	return item;
+}
+template<typename T>
+inline T* push_back_basic_list(basic_list& ths, T&& item) {
+	return insert_basic_list(ths, end_basic_list<T>(ths), std::move(item));
+}
+template<typename T>
+inline T* pop_back_basic_list(basic_list& ths) {
+	return erase_basic_list<T>(ths, end_basic_list<T>(ths) - 1);
+}
+template<typename T>
+inline T& index_basic_list(basic_list& ths, uint32_t idx) {
+	return *((T*)ths.ptr + idx);
+}
+template<typename T>
+inline const T& index_basic_list(const basic_list& ths, uint32_t idx) {
+	return *((const T*)ths.ptr + idx);
+}
+template<typename T>
+inline uint32_t size_basic_list(const basic_list& ths) {
+	return ths.size;
+}
+
+template<typename T>
+void readLclInt(const uint8_t* bfr, uint32_t& bfrPos, T& val) {
+	val = 0;
+	for(uint32_t i = 0; i < sizeof(T); ++i) {
+		val <<= 8;
+		val |= bfr[bfrPos];
+		++bfrPos;
+	}
+}
+
+//prevent circular reference to new/delete
+template<typename T>
+T* malloc_new() {
+	T* rtn = (T*)meta_malloc(sizeof(T));
+	new (rtn) T();
+	return rtn;
+}
+template<typename T>
+void delete_free(T* ptr) {
+	ptr->~T();
+	meta_free(ptr);
+}
+
+struct object_data {
+	uint32_t alignment;
+	uint32_t size_of;
+};
+
+template<typename T>
+struct object_move_generator {
+	static void object_move(void* to, void* frm) {
+		if constexpr(!std::is_trivially_move_constructible<T>::value)
+			new (to) T(std::move(*(T*)frm));
+	}
+	static void object_intermediary_move(void* to, void* frm) {
+		if constexpr(!std::is_trivially_move_constructible<T>::value) {
+			//move to intermediary memory first
+			//do no destructor array move ctor
+			alignas(T) char scrtch[sizeof(T)];
+			new (scrtch) T(std::move(*(T*)frm));
+			new (to) T(std::move(*(T*)scrtch));
+		}
+	}
+};
+
+typedef void (*object_move_func)(void* to, void* frm);
+
+struct alloc_data {
+	rc_size_t size;
+	uint32_t alignment;
+	uint32_t size_of;
+	uint32_t minalignment;
+	uint32_t byterounding;
+	//over aligned only - the address this many bytes in is aligned, room for a header in
+	//front of the object, a multiple of 8 below alignment, never from a slab
+	uint32_t alignoffset;
+};
+
+struct realloc_data {
+	void* ptr;
+	void* hint;
+	rc_size_t from_byte_size;
+	rc_size_t to_byte_size;
+	rc_size_t keep_byte_size_1;
+	rc_size_t keep_byte_size_2;
+	rc_offset_t keep_from_byte_offset_1;
+	rc_offset_t keep_from_byte_offset_2;
+	rc_offset_t keep_to_byte_offset_1;
+	rc_offset_t keep_to_byte_offset_2;
+	rc_size_t from_count_1;
+	rc_size_t from_count_2;
+	uint32_t alignment;
+	uint32_t size_of;
+	uint32_t minalignment;
+	uint32_t byterounding;
+	object_move_func move_func;
+	object_move_func intermediary_move_func;
+	bool istrivial;
+};
+
+struct dealloc_data {
+	void* ptr;
+	rc_size_t size;
+	uint32_t alignment;
+	uint32_t size_of;
+	uint32_t minalignment;
+	uint32_t byterounding;
+	uint32_t alignoffset;
+};
+
+
+template<typename T>
+alloc_data init_alloc_data() {
+	alloc_data rtn;
+	memset((char*)&rtn, 0, sizeof(alloc_data));
+	rtn.size = sizeof(T);
+	rtn.alignment = std::alignment_of<T>();
+	rtn.size_of = sizeof(T);
+	rtn.minalignment = std::alignment_of<uintptr_t>();
+	rtn.byterounding = sizeof(uintptr_t);
+	return rtn;
+}
+alloc_data init_alloc_data_basic();
+
+template<typename T>
+realloc_data init_realloc_data() {
+	realloc_data rtn;
+	memset((char*)&rtn, 0, sizeof(realloc_data));
+	rtn.to_byte_size = sizeof(T);
+	rtn.alignment = std::alignment_of<T>();
+	rtn.size_of = sizeof(T);
+	if constexpr (!std::is_trivially_move_constructible<T>::value) {
+		rtn.move_func = object_move_generator<T>::object_move;
+		rtn.intermediary_move_func = object_move_generator<T>::object_intermediary_move;
+	}
+	rtn.istrivial = std::is_trivially_move_constructible<T>::value;
+	rtn.minalignment = std::alignment_of<uintptr_t>();
+	rtn.byterounding = sizeof(uintptr_t);
+	return rtn;
+}
+realloc_data init_realloc_data_basic();
+alloc_data to_alloc_data(const realloc_data* dat);
+
+template<typename T>
+dealloc_data init_dealloc_data() {
+	dealloc_data rtn;
+	memset((char*)&rtn, 0, sizeof(dealloc_data));
+	rtn.size = sizeof(T);
+	rtn.alignment = std::alignment_of<T>();
+	rtn.size_of = sizeof(T);
+	rtn.minalignment = std::alignment_of<uintptr_t>();
+	rtn.byterounding = sizeof(uintptr_t);
+	return rtn;
+}
+dealloc_data init_dealloc_data_basic();
+
+//the allocation owns whole cache lines, no other allocation shares one so another
+//thread's writes can't false share with it - costs at most a line of rounding, not
+//size + alignment, for alloc_data/realloc_data/dealloc_data alike
+template<typename Data>
+void isolate_cache_lines(Data& dat) {
+	if(dat.minalignment < CACHE_LINE_SIZE)
+		dat.minalignment = CACHE_LINE_SIZE;
+	if(dat.byterounding % CACHE_LINE_SIZE != 0)
+		dat.byterounding = CACHE_LINE_SIZE;
+}
+
+struct vallocator;
+typedef void (*stack_variable_cleanup)(vallocator* allocator, void* stkptr);
+
+struct vgcsettings {
+	//general virtual base class
+	virtual const char* name() const = 0;
+	virtual void ctorCopy(void* dat) const = 0;
+	virtual void ctorMove(void* dat) = 0;
+	virtual rcmalloc::object_data getDataDesc() const = 0;
+	virtual ~vgcsettings();
+};
+
+//allocator statistics - cheap enough to leave on, readable while allocating
+const uint32_t STATS_SIZE_BUCKETS = 34;
+//bucket 0 is size 0, bucket 1 size 1, bucket i holds sizes in (2^(i-2), 2^(i-1)]
+//the last bucket also holds anything bigger
+inline uint32_t stats_size_bucket(rc_size_t size) {
+	if(size <= 1)
+		return (uint32_t)size;
+	if((uint64_t)size - 1 > 0xFFFFFFFF)
+		return STATS_SIZE_BUCKETS - 1;
+	return highest_bit((uint32_t)(size - 1)) + 2;
+}
+struct alloc_stats {
+	//blocks and large mappings
+	uint64_t bytes_mapped;
+	//handed out, objects held in thread caches count as live
+	uint64_t bytes_live;
+	//mapped but not live - free extents, free slab slots and alignment padding
+	uint64_t bytes_free;
+	uint64_t block_count;
+	uint64_t large_count;
+	uint64_t retained_count;
+	//largest free extent of any block
+	uint64_t largest_free;
+	uint64_t new_blocks;
+	uint64_t realloc_in_place;
+	uint64_t realloc_moved;
+	uint64_t lock_acquisitions;
+	//frees queued by threads that don't own the allocator, counted when given back
+	uint64_t remote_frees;
+	//of those, freed by a thread on another numa node
+	uint64_t remote_node_frees;
+	//requested sizes
+	uint64_t size_histogram[STATS_SIZE_BUCKETS];
+};
+alloc_stats init_alloc_stats();
+//sum of both, largest_free is the larger of the two
+void add_alloc_stats(alloc_stats& to, const alloc_stats& frm);
+
+struct vallocator {
+	//general virtual base class
+	virtual const char* name() const = 0;
+	virtual void ctorCopy(void* dat) const = 0;
+	virtual void ctorMove(void* dat) = 0;
+	virtual rcmalloc::object_data getDataDesc() const = 0;
+	virtual ~vallocator();
+	//object allocation
+	virtual void* do_malloc(const alloc_data* dat) = 0;
+	virtual void* do_realloc(const realloc_data* dat) = 0;
+	virtual void do_free(const dealloc_data* dat) = 0;
+	//count objects of the same size at once, returns how many were allocated into out
+	virtual uint32_t do_malloc_batch(const alloc_data* dat, void** out, uint32_t count);
+	//null pointers are skipped
+	virtual void do_free_batch(const dealloc_data* dat, void* const* ptrs, uint32_t count);
+	//garbage collectors
+	virtual void do_add_stack_variable(void* stkptr, stack_variable_cleanup fptr);
+	virtual void do_remove_stack_variable_range(void* stkptr, uint32_t frame_size);
+	virtual void do_cleanup(const vgcsettings& settings);
+	virtual void do_test_cleanup(const vgcsettings& settings);
+	virtual void* do_dereference(void* ptr);
+	//statistics, false if not supported
+	virtual bool do_get_stats(alloc_stats* out) const;
+	//get pointer to this
+	vallocator& get_allocator();
+	const vallocator& get_allocator() const;
+};
+
+struct memblock_base;
+
+void roundAllocation(uint32_t minalignment, uint32_t byterounding,
+					 rc_size_t& size, uint32_t& alignment);
+void roundAllocation(realloc_data& ldat);
+
+bool moveEndFirst(char* toptr, rc_offset_t keep_to_byte_offset,
+				  char* frmptr, rc_offset_t keep_from_byte_offset);
+void* doMemMove(char* toPtr, char* frmPtr,
+				const realloc_data& dat);
+void addMemBlock(basic_list& blocklst, memblock_base* nMmBlck);
+void removeMemBlock(basic_list& blocklst, memblock_base* blck);
+
+//max tree over block slots of each blocks largest free extent
+const uint32_t FREE_INDEX_NONE = 0xFFFFFFFF;
+struct free_index {
+	//tree[1] is the root, the leaves start at tree[leaves]
+	uint32_t* tree;
+	uint32_t leaves;
+};
+free_index init_free_index(uint32_t leaves);
+void dtor_free_index(free_index& fi);
+void set_free_index(free_index& fi, uint32_t slot, uint32_t largest);
+void move_free_index(free_index& fi, uint32_t from, uint32_t to);
+//lowest slot with largest >= size
+uint32_t find_free_index(const free_index& fi, uint32_t size);
+
+//where rc_allocator gets the memory for its blocks
+//blocks are page aligned and whole pages, so each page belongs to at most one block
+struct vpagesource {
+	virtual const char* name() const = 0;
+	//size is always a multiple of page_size, returns memory aligned to page_size
+	virtual void* do_map(rc_size_t size) = 0;
+	virtual void do_unmap(void* ptr, rc_size_t size) = 0;
+	//resize a mapping keeping its contents, may move it, 0 if it can't be done
+	virtual void* do_remap(void* ptr, rc_size_t size, rc_size_t newsize);
+	//the pages are unused, give them back to the os but keep them mapped
+	virtual void do_purge(void* ptr, rc_size_t size);
+	//power of two multiple of ALLOC_PAGE_SIZE
+	virtual uint32_t page_size() const;
+	virtual ~vpagesource();
+};
+//page aligned memory from the c heap - the default
+struct heap_page_source : public vpagesource {
+	const char* name() const;
+	void* do_map(rc_size_t size);
+	void do_unmap(void* ptr, rc_size_t size);
+};
+
+enum huge_page_mode {
+	//normal pages only
+	HUGE_PAGES_NONE,
+	//2 MiB aligned mappings with madvise(MADV_HUGEPAGE) for transparent huge pages
+	HUGE_PAGES_ADVISE,
+	//MAP_HUGETLB from the reserved huge page pool, falls back to HUGE_PAGES_ADVISE when the pool is empty
+	HUGE_PAGES_EXPLICIT
+};
+const uint32_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+//memory mapped straight from the os, falls back to the heap without mmap
+struct mmap_page_source : public vpagesource {
+	huge_page_mode mode;
+
+	mmap_page_source(huge_page_mode mode = HUGE_PAGES_NONE);
+	const char* name() const;
+	void* do_map(rc_size_t size);
+	void do_unmap(void* ptr, rc_size_t size);
+	void* do_remap(void* ptr, rc_size_t size, rc_size_t newsize);
+	uint32_t page_size() const;
+};
+//mmap_page_source with its mappings bound to one numa node with mbind, preferred
+//not strict so a full node falls back to the others instead of failing
+struct numa_page_source : public mmap_page_source {
+	uint32_t node;
+
+	numa_page_source(uint32_t node);
+	const char* name() const;
+	void* do_map(rc_size_t size);
+};
+
+//empty blocks shared by every allocator on one page source, taken before mapping more
+//blocks of a power of two pages up to 2 MiB are kept, other sizes go straight to src
+const uint32_t BLOCK_DEPOT_CLASSES = 10;
+const uint32_t BLOCK_DEPOT_SLOTS = 1024;
+const uint64_t BLOCK_DEPOT_MAX_BYTES = 32 * 1024 * 1024;
+//lock-free stack of node indices, the tag in the top half changes on every push and pop
+//so a stale head never matches (no ABA), the nodes never live in block memory
+struct depot_stack {
+	std::atomic<uint64_t> head{0};
+};
+struct depot_node {
+	void* ptr;
+	//index + 1 of the next node, 0 for none
+	std::atomic<uint32_t> next{0};
+};
+struct depot_page_source : public vpagesource {
+	vpagesource* src;
+	depot_node nodes[BLOCK_DEPOT_SLOTS];
+	//nodes not holding a block
+	depot_stack unused;
+	depot_stack classes[BLOCK_DEPOT_CLASSES];
+	std::atomic<uint64_t> bytes{0};
+
+	depot_page_source(vpagesource* src);
+	const char* name() const;
+	void* do_map(rc_size_t size);
+	void do_unmap(void* ptr, rc_size_t size);
+	void* do_remap(void* ptr, rc_size_t size, rc_size_t newsize);
+	void do_purge(void* ptr, rc_size_t size);
+	uint32_t page_size() const;
+	//bytes of empty blocks held
+	uint64_t held_bytes() const;
+};
+//the depot over the heap, or over mmap when rcmalloc is the heap
+vpagesource* default_page_source();
+//direct mapped large allocations - mmap_page_source without huge pages
+vpagesource* default_large_page_source();
+//numa_page_source of node, one for each node shared by every allocator
+vpagesource* numa_node_page_source(uint32_t node);
+//allocations this big get their own mapping when they are also >= AllocSize
+const uint32_t DIRECT_MAP_MIN_SIZE = 128 * 1024;
+
+//empty blocks are kept for reuse, the number allowed to stay empty for t ms
+//is RETAIN_MAX_BLOCKS * 2^(-t / RETAIN_HALF_LIFE_MS)
+const uint32_t RETAIN_MAX_BLOCKS = 16;
+const uint32_t RETAIN_HALF_LIFE_MS = 1000;
+//frees between checks of the clock
+const uint32_t RETAIN_TICK_FREES = 256;
+//free extents this big in live blocks are purged once per half life
+const uint32_t PURGE_MIN_SIZE = 64 * 1024;
+uint64_t monotonic_ms();
+
+//only changed by the thread holding the allocator so there is no read-modify-write
+//atomic so it can be read from any thread
+struct stat_counter {
+	std::atomic<uint64_t> value{0};
+
+	stat_counter() {}
+	stat_counter(const stat_counter& cpy) : value(cpy.get()) {}
+	stat_counter& operator=(const stat_counter& cpy) {
+		set(cpy.get());
+		return *this;
+	}
+	inline uint64_t get() const {
+		return value.load(std::memory_order_relaxed);
+	}
+	inline void set(uint64_t v) {
+		value.store(v, std::memory_order_relaxed);
+	}
+	inline void add(uint64_t v) {
+		set(get() + v);
+	}
+	inline void sub(uint64_t v) {
+		set(get() - v);
+	}
+};
+struct alloc_counters {
+	stat_counter bytes_mapped;
+	stat_counter bytes_live;
+	stat_counter block_count;
+	stat_counter large_count;
+	stat_counter retained_count;
+	stat_counter largest_free;
+	stat_counter new_blocks;
+	stat_counter realloc_in_place;
+	stat_counter realloc_moved;
+	stat_counter lock_acquisitions;
+	stat_counter remote_frees;
+	stat_counter remote_node_frees;
+	stat_counter size_histogram[STATS_SIZE_BUCKETS];
+
+	void read(alloc_stats* out) const;
+};
+
+//sampling heap profiler, about one allocation in every rate bytes records its stack
+//the gaps between samples are exponential so every byte is equally likely to be sampled
+const uint64_t HEAP_SAMPLE_DEFAULT_RATE = 512 * 1024;
+//while sampling is off the rate is looked at again after this many bytes
+const uint64_t HEAP_SAMPLE_OFF_RECHECK = 1024 * 1024;
+const uint32_t HEAP_SAMPLE_MAX_DEPTH = 32;
+//live samples at once, more than this are dropped
+const uint32_t HEAP_SAMPLE_SLOTS = 16384;
+//0 turns sampling off, the default
+void set_heap_sample_rate(uint64_t rate);
+uint64_t heap_sample_rate();
+//pprof legacy heap profile (heap_v2) of the live samples, with the mapped libraries
+bool write_heap_profile(FILE* out);
+bool write_heap_profile(const char* path);
+
+//number of live samples, free only looks a pointer up when there are any
+extern std::atomic<uint32_t> heap_sample_count;
+//per allocator or thread cache, only changed by its owning thread
+struct heap_sampler {
+	//bytes until the next sample, the first allocation draws the first gap
+	int64_t countdown;
+	uint64_t rng;
+};
+struct heap_sample_bucket;
+void heap_sample_malloc(heap_sampler& smp, void* ptr, rc_size_t size);
+void heap_sample_free(void* ptr);
+//a sampled object being reallocated leaves the table, 0 if ptr isn't sampled
+heap_sample_bucket* heap_sample_take(void* ptr, rc_size_t& size);
+//and goes back at its new address and size, counted as a free and an allocation when resized
+void heap_sample_put(heap_sample_bucket* bkt, void* ptr, rc_size_t oldsize, rc_size_t size);
+inline void sample_malloc(heap_sampler& smp, void* ptr, rc_size_t size) {
+	smp.countdown -= size;
+	if(smp.countdown < 0 && ptr != 0)
+		heap_sample_malloc(smp, ptr, size);
+}
+inline void sample_free(void* ptr) {
+	if(heap_sample_count.load(std::memory_order_relaxed) != 0)
+		heap_sample_free(ptr);
+}
+uint32_t retain_limit(uint64_t idle_ms);
+//purge the whole pages of a free extent, leaving keep bytes at both ends alone
+void purge_extent(vpagesource* src, char* ptr, uint32_t size, uint32_t keep);
+//process wide radix tree from page to the block that holds it
+bool page_map_set(void* ptr, rc_size_t size, memblock_base* blck);
+void page_map_clear(void* ptr, rc_size_t size);
+memblock_base* page_map_get(void* ptr);
+uint32_t current_cpu();
+//nodes online in /sys/devices/system/node, 1 without numa
+const uint32_t NUMA_MAX_NODES = 64;
+uint32_t numa_node_count();
+//node of the cpu the thread is running on
+uint32_t current_numa_node();
+
+//small objects are carved from dedicated blocks of fixed size slots
+const uint32_t SLAB_MAX_SIZE = 1024;
+//slabs start on a page so slots whose size is a multiple of a cache line are aligned to it
+const uint32_t SLAB_MAX_ALIGNMENT = CACHE_LINE_SIZE;
+const uint32_t SLAB_CLASS_COUNT = 28;
+const uint32_t SLAB_MIN_SLOTS = 16;
+
+bool slab_class_index(rc_size_t size, uint32_t alignment, uint32_t& idx);
+uint32_t slab_class_size(uint32_t idx);
+
+struct bytesizes {
+	uint32_t bytecount;
+	char* ptr;
+};
+//fields shared by all block engines
+struct memblock_base {
+	//only large mappings can be over 32 bits
+	rc_size_t bytetotal;
+	uint32_t byteremain;
+	char* ptr;
+	//the rc_allocator this block belongs to and where it is in its block list
+	void* owner;
+	uint32_t slot;
+	//a single direct mapped allocation, not in the block list
+	bool large;
+	//empty blocks kept for reuse, oldest first
+	bool retained;
+	memblock_base* retnext;
+	memblock_base* retprev;
+	uint64_t emptysince;
+	//byteremain when the free extents were last purged
+	uint32_t purgedremain;
+	//slab blocks only - slabsize is 0 for normal blocks
+	uint32_t slabsize;
+	uint32_t slabused;
+	uint32_t slabclass;
+	void* slabfree;
+	char* slabbump;
+	//partially used slabs of the same size class
+	memblock_base* slabnext;
+	memblock_base* slabprev;
+
+	void slab_init(uint32_t idx);
+	inline bool slab_full() const {
+		return slabfree == 0 && (slabbump + slabsize) > (ptr + bytetotal);
+	}
+	void* slab_malloc();
+	void slab_free(void* p);
+};
+//default block engine - free extents kept in sorted lists, best fit
+struct memblock : public memblock_base {
+	typedef bytesizes* free_hint;
+	//sizes are rounded to this so extents stay aligned to it
+	static const uint32_t granule = sizeof(uintptr_t);
+
+	//sorted by bytecount
+	basic_list sizes;
+	//sorted by ptr
+	basic_list freelst;
+
+	void init();
+	~memblock();
+	void init_block(char* p, uint32_t total, uint32_t used);
+	void* internal_malloc_at_hint(uint32_t size, bytesizes* pfrelst, void* hint);
+	void* internal_malloc(uint32_t size);
+	//at an alignment above granule, the slack either side stays free - offset bytes in is aligned
+	void* internal_malloc_aligned(uint32_t size, uint32_t alignment, uint32_t offset = 0);
+	//largest size internal_malloc can give
+	inline uint32_t largest_free() const {
+		uint32_t cnt = size_basic_list<bytesizes>(sizes);
+		return cnt == 0 ? 0 : index_basic_list<bytesizes>(sizes, cnt - 1).bytecount;
+	}
+	void purge_free(vpagesource* src, uint32_t minsize);
+	void* internal_realloc(
+			const realloc_data* dat,
+			bytesizes*& freeOut
+	);
+	//the old memory was freed by a failed internal_realloc, give it back
+	inline void internal_realloc_restore(void* p, uint32_t size, bytesizes* freeOut) {
+		internal_malloc_at_hint(size, freeOut, p);
+	}
+	//the old memory was freed by a failed internal_realloc, nothing to do
+	inline void internal_realloc_release(void* /*p*/, uint32_t /*size*/, bytesizes* /*freeOut*/) {}
+	void internal_free(void* ptr, uint32_t size, bytesizes*& freeOut);
+};
+
+//two level segregated fit block engine - constant time malloc/free/coalesce
+//free extents are indexed by size class bitmaps, each free extent holds the
+//index of its node in its first and last 4 bytes (boundary tags), per granule
+//bitmaps mark where free extents start and end so a neighbour can be found
+//without reading memory that is in use
+const uint32_t TLSF_SL_LOG2 = 4;
+const uint32_t TLSF_SL_COUNT = 1 << TLSF_SL_LOG2;
+const uint32_t TLSF_GRANULE_LOG2 = 3;
+const uint32_t TLSF_SMALL_SIZE = TLSF_SL_COUNT << TLSF_GRANULE_LOG2;
+const uint32_t TLSF_NONE = 0xFFFFFFFF;
+
+struct tlsf_node {
+	char* ptr;
+	uint32_t bytecount;
+	uint32_t next;
+	uint32_t prev;
+};
+struct tlsf_memblock : public memblock_base {
+	typedef uint32_t free_hint;
+	static const uint32_t granule = 1 << TLSF_GRANULE_LOG2;
+
+	//free extent nodes, bytecount 0 for unused nodes
+	basic_list nodes;
+	uint32_t freenode;
+	uint32_t flcount;
+	uint32_t flbitmap;
+	//flcount second level bitmaps followed by flcount * TLSF_SL_COUNT list heads
+	uint32_t* slbitmaps;
+	uint32_t* heads;
+	//one bit per granule, free extent first granules followed by last granules
+	uint64_t* freestarts;
+	uint64_t* freeends;
+
+	~tlsf_memblock();
+	void init_block(char* p, uint32_t total, uint32_t used);
+	uint32_t insert_free(char* p, uint32_t size);
+	void remove_free(uint32_t node);
+	uint32_t find_free(uint32_t size);
+	uint32_t free_before(char* p);
+	uint32_t free_after(char* p);
+	void* internal_malloc(uint32_t size);
+	//at an alignment above granule, the slack either side stays free - offset bytes in is aligned
+	void* internal_malloc_aligned(uint32_t size, uint32_t alignment, uint32_t offset = 0);
+	//largest size internal_malloc is sure to give - the smallest size of the largest list
+	uint32_t largest_free() const;
+	void purge_free(vpagesource* src, uint32_t minsize);
+	void* internal_realloc(
+			const realloc_data* dat,
+			uint32_t& freeOut
+	);
+	//a failed internal_realloc leaves the old memory allocated
+	inline void internal_realloc_restore(void* /*p*/, uint32_t /*size*/, uint32_t /*freeOut*/) {}
+	inline void internal_realloc_release(void* p, uint32_t size, uint32_t freeOut) {
+		internal_free(p, size, freeOut);
+	}
+	void internal_free(void* ptr, uint32_t size, uint32_t& freeOut);
+};
+
+//a free from a thread that doesn't own the allocator, written over the freed object
+struct remote_free_node {
+	remote_free_node* next;
+	rc_size_t size;
+	//freed by a thread on another numa node
+	bool othernode;
+};
+//lock-free, any number of threads push and only the owner takes them all at once
+//so a node is never popped while another thread looks at it
+struct remote_free_list {
+	std::atomic<remote_free_node*> head{0};
+
+	remote_free_list() {}
+	remote_free_list(const remote_free_list& cpy) : head(cpy.head.load(std::memory_order_relaxed)) {}
+	remote_free_list& operator=(const remote_free_list& cpy) {
+		head.store(cpy.head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		return *this;
+	}
+	inline bool empty() const {
+		return head.load(std::memory_order_relaxed) == 0;
+	}
+	inline void push(remote_free_node* node) {
+		node->next = head.load(std::memory_order_relaxed);
+		while(!head.compare_exchange_weak(node->next, node, std::memory_order_release,
+										  std::memory_order_relaxed)) {}
+	}
+	inline remote_free_node* take_all() {
+		return head.exchange(0, std::memory_order_acquire);
+	}
+};
+
+template<unsigned AllocSize,
+		 unsigned BlockID,
+		 typename Block = memblock>
+struct rc_allocator : public vallocator {
+	//all blocks, each block knows its slot
+	basic_list blocklst;
+	//largest free extent of the block in each slot
+	free_index freeindex;
+	vpagesource* pages = default_page_source();
+	vpagesource* largepages = default_large_page_source();
+	//empty blocks kept for reuse, oldest first
+	memblock_base* retainedhead = 0;
+	memblock_base* retainedtail = 0;
+	uint32_t retainedcount = 0;
+	uint32_t freesincetick = 0;
+	uint64_t lastpurge = 0;
+	alloc_counters stats;
+	heap_sampler sampler = {0, 0};
+	//slabs with free slots for each size class
+	memblock_base* slabs[SLAB_CLASS_COUNT] = {};
+	//pushed by other threads without the lock, given back by the owner in one pass
+	remote_free_list remotefree;
+
+	static inline rc_size_t round_granule(rc_size_t size) {
+		return (size + Block::granule - 1) & ~(rc_size_t)(Block::granule - 1);
+	}
+	//extents start a multiple of granule into a page aligned block, so they are already
+	//aligned to it - only over aligned requests need an aligned placement
+	static inline void natural_alignment(uint32_t& alignment) {
+		if(alignment <= Block::granule)
+			alignment = 1;
+	}
+	//placed at an offset from the alignment, never a slab slot
+	template<typename Data>
+	static inline bool offset_placed(const Data& ldat) {
+		return ldat.alignoffset != 0 && ldat.alignment >= 2;
+	}
+	static inline Block* get_block(memblock_base* blck) {
+		return static_cast<Block*>(blck);
+	}
+
+	rc_allocator() {
+		blocklst = init_basic_list<memblock_base*>(30);
+		freeindex = init_free_index(32);
+	}
+	~rc_allocator() {
+		dtor_basic_list<memblock_base*>(blocklst);
+		dtor_free_index(freeindex);
+	}
+	//only change these before the first allocation
+	void set_page_source(vpagesource* src) {
+		pages = src;
+		largepages = src;
+	}
+	void set_large_page_source(vpagesource* src) {
+		largepages = src;
+	}
+	inline uint32_t round_pages(uint32_t size) const {
+		uint32_t pgsz = pages->page_size();
+		return (size + pgsz - 1) & ~(pgsz - 1);
+	}
+	inline rc_size_t round_large_pages(rc_size_t size) const {
+		rc_size_t pgsz = largepages->page_size();
+		return (size + pgsz - 1) & ~(pgsz - 1);
+	}
+	static inline bool is_large(rc_size_t size) {
+		return size >= AllocSize && size >= DIRECT_MAP_MIN_SIZE;
+	}
+	inline void update_block(memblock_base* blck) {
+		set_free_index(freeindex, blck->slot, get_block(blck)->largest_free());
+		stats.largest_free.set(freeindex.tree[1]);
+	}
+	//the per block largest free extents by slot, returns the number of blocks
+	uint32_t block_largest_free(uint32_t* out, uint32_t count) const {
+		uint32_t blocks = size_basic_list<memblock_base*>(blocklst);
+		for(uint32_t i = 0; i < blocks && i < count; ++i)
+			out[i] = freeindex.tree[freeindex.leaves + i];
+		return blocks;
+	}
+	//make a block of whole pages and map its pages to it
+	Block* add_block(uint32_t resz, uint32_t used) {
+		void* nmem = pages->do_map(resz);
+		if(nmem == 0) return 0;
+
+		Block* nBlck = malloc_new<Block>();
+		nBlck->init_block((char*)nmem, resz, used);
+		nBlck->owner = this;
+		if(!page_map_set(nmem, resz, nBlck)) {
+			delete_free(nBlck);
+			pages->do_unmap(nmem, resz);
+			return 0;
+		}
+		addMemBlock(blocklst, nBlck);
+		update_block(nBlck);
+		stats.bytes_mapped.add(resz);
+		stats.block_count.add(1);
+		stats.new_blocks.add(1);
+		return nBlck;
+	}
+	void release_block(memblock_base* blck) {
+		page_map_clear(blck->ptr, blck->bytetotal);
+		//the last block takes this slot
+		uint32_t last = size_basic_list<memblock_base*>(blocklst) - 1;
+		move_free_index(freeindex, last, blck->slot);
+		removeMemBlock(blocklst, blck);
+		stats.largest_free.set(freeindex.tree[1]);
+		stats.bytes_mapped.sub(blck->bytetotal);
+		stats.block_count.sub(1);
+		pages->do_unmap(blck->ptr, blck->bytetotal);
+		delete_free(get_block(blck));
+	}
+	//large allocations get a mapping each so they can be remapped
+	void* malloc_large(rc_size_t size) {
+		rc_size_t mapsz = round_large_pages(size);
+		void* nmem = largepages->do_map(mapsz);
+		if(nmem == 0) return 0;
+
+		memblock_base* blck = malloc_new<memblock_base>();
+		blck->bytetotal = mapsz;
+		blck->byteremain = 0;
+		blck->ptr = (char*)nmem;
+		blck->owner = this;
+		blck->large = true;
+		if(!page_map_set(nmem, mapsz, blck)) {
+			delete_free(blck);
+			largepages->do_unmap(nmem, mapsz);
+			return 0;
+		}
+		stats.bytes_mapped.add(mapsz);
+		stats.large_count.add(1);
+		return nmem;
+	}
+	void free_large(memblock_base* blck) {
+		stats.bytes_mapped.sub(blck->bytetotal);
+		stats.large_count.sub(1);
+		page_map_clear(blck->ptr, blck->bytetotal);
+		largepages->do_unmap(blck->ptr, blck->bytetotal);
+		delete_free(blck);
+	}
+	//dat.ptr keeps its offset into the mapping
+	void* realloc_large(memblock_base* blck, const realloc_data& dat, rc_size_t size) {
+		char* base = blck->ptr;
+		rc_size_t offset = dist(base, (char*)dat.ptr);
+		rc_size_t mapsz = round_large_pages(size);
+		rc_size_t oldsz = blck->bytetotal;
+		if(mapsz == oldsz)
+			return doMemMove((char*)dat.ptr, (char*)dat.ptr, dat);
+		bool grow = mapsz > oldsz;
+		if(!grow)
+			//shrinking - move the kept ranges while all of the old memory is there
+			doMemMove((char*)dat.ptr, (char*)dat.ptr, dat);
+
+		//unregister first, once remapped the old pages may belong to someone else
+		page_map_clear(base, oldsz);
+		char* nbase = (char*)largepages->do_remap(base, oldsz, mapsz);
+		if(nbase != 0 && !page_map_set(nbase, mapsz, blck)) {
+			//no memory for the page map - put the mapping back
+			char* back = (char*)largepages->do_remap(nbase, mapsz, oldsz);
+			if(back == 0) {
+				//stuck at the new address, unregistered - keep it as the blocks mapping
+				blck->ptr = nbase;
+				blck->bytetotal = mapsz;
+				stats.bytes_mapped.add((uint64_t)mapsz - oldsz);
+				return 0;
+			}
+			base = back;
+			nbase = 0;
+		}
+		if(nbase == 0) {
+			//still the old mapping
+			blck->ptr = base;
+			page_map_set(base, oldsz, blck);
+			if(!grow)
+				return base + offset;
+
+			//can't remap - copy to a new mapping
+			nbase = (char*)largepages->do_map(mapsz);
+			if(nbase == 0) return 0;
+			if(!page_map_set(nbase, mapsz, blck)) {
+				largepages->do_unmap(nbase, mapsz);
+				return 0;
+			}
+			doMemMove(nbase + offset, base + offset, dat);
+			page_map_clear(base, oldsz);
+			largepages->do_unmap(base, oldsz);
+			blck->ptr = nbase;
+			blck->bytetotal = mapsz;
+			stats.bytes_mapped.add((uint64_t)mapsz - oldsz);
+			return nbase + offset;
+		}
+
+		blck->ptr = nbase;
+		blck->bytetotal = mapsz;
+		stats.bytes_mapped.add((uint64_t)mapsz - oldsz);
+		if(grow)
+			//the contents kept their offsets, now move the kept ranges
+			doMemMove(nbase + offset, nbase + offset, dat);
+		return nbase + offset;
+	}
+	void* malloc_new_block(uint32_t size) {
+		uint32_t resz = round_pages(((size / AllocSize) + (size % AllocSize != 0 ? 1 : 0)) * AllocSize);
+
+		Block* nBlck = add_block(resz, size);
+		if(nBlck == 0) return 0;
+		return nBlck->ptr;
+	}
+
+	void* internal_malloc_i(rc_size_t lsize) {
+		lsize = round_granule(lsize);
+		if(is_large(lsize))
+			return malloc_large(lsize);
+		//not large, fits in a block
+		uint32_t size = (uint32_t)lsize;
+
+		//lowest slot with a big enough free extent, oversized blocks are reused too
+		uint32_t slt = find_free_index(freeindex, size);
+		if(slt != FREE_INDEX_NONE) {
+			memblock_base* blck = index_basic_list<memblock_base*>(blocklst, slt);
+			void* nmem = get_block(blck)->internal_malloc(size);
+			if(nmem != 0) {
+				if(blck->retained)
+					unretain(blck);
+				update_block(blck);
+				return nmem;
+			}
+		}
+		//if allocation >= AllocSize do new allocSize
+		if(size >= AllocSize) {
+			Block* nBlck = add_block(round_pages(size), size);
+			if(nBlck == 0) return 0;
+			return nBlck->ptr;
+		}
+
+		//add a new block to hold this
+		return malloc_new_block(size);
+	}
+	//over aligned, the extent is placed at an aligned position so it is freed like any other,
+	//with an offset the address offset bytes in is the aligned one
+	void* internal_malloc_aligned_i(rc_size_t lsize, uint32_t alignment, uint32_t offset = 0) {
+		lsize = round_granule(lsize);
+		if(is_large(lsize)) {
+			//mappings are page aligned, bigger alignments are found inside a bigger mapping
+			uint32_t pgsz = largepages->page_size();
+			uint32_t extra = offset != 0 ? alignment - offset : (alignment > pgsz ? alignment - pgsz : 0);
+			char* nmem = (char*)malloc_large(lsize + extra);
+			if(nmem == 0) return 0;
+			return (char*)((((uintptr_t)nmem + offset + alignment - 1) & ~(uintptr_t)(alignment - 1)) - offset);
+		}
+		uint32_t size = (uint32_t)lsize;
+
+		//the lowest block with an extent of size may have it aligned, any extent of
+		//worst has size bytes at an aligned position
+		uint32_t worst = size + alignment - Block::granule;
+		uint32_t slts[2] = {find_free_index(freeindex, size), find_free_index(freeindex, worst)};
+		for(uint32_t i = 0; i < 2; ++i) {
+			if(slts[i] == FREE_INDEX_NONE || (i == 1 && slts[1] == slts[0]))
+				continue;
+			memblock_base* blck = index_basic_list<memblock_base*>(blocklst, slts[i]);
+			void* nmem = get_block(blck)->internal_malloc_aligned(size, alignment, offset);
+			if(nmem != 0) {
+				if(blck->retained)
+					unretain(blck);
+				update_block(blck);
+				return nmem;
+			}
+		}
+		//a new block starts page aligned
+		if(offset == 0 && alignment <= pages->page_size())
+			return malloc_new_block(size);
+		uint32_t resz = round_pages(((worst / AllocSize) + (worst % AllocSize != 0 ? 1 : 0)) * AllocSize);
+		Block* nBlck = add_block(resz, 0);
+		if(nBlck == 0) return 0;
+		void* rtn = nBlck->internal_malloc_aligned(size, alignment, offset);
+		update_block(nBlck);
+		return rtn;
+	}
+	//over aligned reallocs are moved, not handled here
+	void* internal_realloc_i(const realloc_data* dat) {
+		realloc_data lclDat = *dat;
+		lclDat.from_byte_size = round_granule(lclDat.from_byte_size);
+		lclDat.to_byte_size = round_granule(lclDat.to_byte_size);
+
+		memblock_base* mblck = page_map_get(lclDat.ptr);
+		Block* blck = get_block(mblck);
+		typename Block::free_hint freeOut = 0;
+		void* rtn = blck->internal_realloc(
+						&lclDat,
+						freeOut
+					);
+
+		if(rtn == 0) {
+			//move to another block with room or a new one, never this one - it may have
+			//freed the old memory, which has to stay intact until moved
+			set_free_index(freeindex, mblck->slot, 0);
+			void* rslt = internal_malloc_i(lclDat.to_byte_size);
+			if(rslt == 0) {
+				//the block may have freed this, don't allow that, restore the old size block!!
+				blck->internal_realloc_restore(lclDat.ptr, (uint32_t)lclDat.from_byte_size, freeOut);
+				update_block(mblck);
+				return 0;
+			}
+
+			//do memove - guaranteed to have no overlap
+			doMemMove((char*)rslt, (char*)lclDat.ptr, lclDat);
+			blck->internal_realloc_release(lclDat.ptr, (uint32_t)lclDat.from_byte_size, freeOut);
+
+			block_freed(mblck);
+			return rslt;
+		}
+		update_block(mblck);
+		return rtn;
+	}
+	void internal_free_i(void* ptr, rc_size_t size) {
+		if(ptr == 0) return;
+		memblock_base* blck = page_map_get(ptr);
+		if(blck->large) {
+			free_large(blck);
+			return;
+		}
+
+		typename Block::free_hint freeOut = 0;
+		get_block(blck)->internal_free(ptr, (uint32_t)round_granule(size), freeOut);
+		block_freed(blck);
+
+		if(++freesincetick >= RETAIN_TICK_FREES) {
+			freesincetick = 0;
+			decay(monotonic_ms());
+		}
+	}
+	//keep empty blocks for reuse, unless it is the only block
+	void block_freed(memblock_base* blck) {
+		update_block(blck);
+		if(blck->byteremain != blck->bytetotal || blck->retained || size_basic_list<memblock_base*>(blocklst) < 2)
+			return;
+		blck->retained = true;
+		blck->emptysince = monotonic_ms();
+		blck->retnext = 0;
+		blck->retprev = retainedtail;
+		if(retainedtail != 0)
+			retainedtail->retnext = blck;
+		else
+			retainedhead = blck;
+		retainedtail = blck;
+		++retainedcount;
+		stats.retained_count.set(retainedcount);
+
+		if(retainedcount > RETAIN_MAX_BLOCKS) {
+			memblock_base* oldest = retainedhead;
+			unretain(oldest);
+			release_block(oldest);
+		}
+	}
+	void unretain(memblock_base* blck) {
+		if(blck->retprev != 0)
+			blck->retprev->retnext = blck->retnext;
+		else
+			retainedhead = blck->retnext;
+		if(blck->retnext != 0)
+			blck->retnext->retprev = blck->retprev;
+		else
+			retainedtail = blck->retprev;
+		blck->retained = false;
+		--retainedcount;
+		stats.retained_count.set(retainedcount);
+	}
+	//give back memory that hasn't been used for a while
+	void decay(uint64_t now) {
+		//longest empty first, stop at the first block still allowed
+		while(retainedhead != 0 && size_basic_list<memblock_base*>(blocklst) > 1) {
+			memblock_base* oldest = retainedhead;
+			if(retainedcount <= retain_limit(now - oldest->emptysince))
+				break;
+			unretain(oldest);
+			release_block(oldest);
+		}
+
+		if(now - lastpurge < RETAIN_HALF_LIFE_MS)
+			return;
+		lastpurge = now;
+		for(auto it = begin_basic_list<memblock_base*>(blocklst); it != end_basic_list<memblock_base*>(blocklst); ++it) {
+			memblock_base* blck = *it;
+			//skip slabs and blocks that haven't freed anything since the last purge
+			if(blck->slabsize != 0 || blck->byteremain == blck->purgedremain)
+				continue;
+			if(get_block(blck)->largest_free() >= PURGE_MIN_SIZE)
+				get_block(blck)->purge_free(pages, PURGE_MIN_SIZE);
+			blck->purgedremain = blck->byteremain;
+		}
+	}
+	//release every retained block and purge now
+	void trim() {
+		while(retainedhead != 0 && size_basic_list<memblock_base*>(blocklst) > 1) {
+			memblock_base* oldest = retainedhead;
+			unretain(oldest);
+			release_block(oldest);
+		}
+		lastpurge = 0;
+		decay(monotonic_ms());
+	}
+	void* slab_malloc(uint32_t idx) {
+		memblock_base* blck = slabs[idx];
+		if(blck == 0) {
+			//add a new slab for this size class
+			uint32_t slabsize = slab_class_size(idx);
+			uint32_t resz = slabsize * SLAB_MIN_SLOTS;
+			if(resz < AllocSize) resz = AllocSize;
+			resz = round_pages(((resz / AllocSize) + (resz % AllocSize != 0 ? 1 : 0)) * AllocSize);
+
+			void* nmem = pages->do_map(resz);
+			if(nmem == 0) return 0;
+
+			blck = malloc_new<Block>();
+			blck->bytetotal = resz;
+			blck->byteremain = 0;
+			blck->ptr = (char*)nmem;
+			blck->owner = this;
+			blck->slab_init(idx);
+			if(!page_map_set(nmem, resz, blck)) {
+				delete_free(get_block(blck));
+				pages->do_unmap(nmem, resz);
+				return 0;
+			}
+
+			slabs[idx] = blck;
+			addMemBlock(blocklst, blck);
+			//never used for extents
+			set_free_index(freeindex, blck->slot, 0);
+			stats.bytes_mapped.add(resz);
+			stats.block_count.add(1);
+			stats.new_blocks.add(1);
+		}
+
+		void* rtn = blck->slab_malloc();
+		if(blck->slab_full()) {
+			//no more space - take off the list
+			slabs[idx] = blck->slabnext;
+			if(blck->slabnext != 0)
+				blck->slabnext->slabprev = 0;
+			blck->slabnext = 0;
+		}
+		return rtn;
+	}
+	void slab_free(void* ptr) {
+		memblock_base* blck = page_map_get(ptr);
+
+		bool wasfull = blck->slab_full();
+		blck->slab_free(ptr);
+		uint32_t idx = blck->slabclass;
+
+		if(wasfull) {
+			//has space again - put back on the list
+			blck->slabprev = 0;
+			blck->slabnext = slabs[idx];
+			if(slabs[idx] != 0)
+				slabs[idx]->slabprev = blck;
+			slabs[idx] = blck;
+		}
+		//free empty slabs, but always keep one for this size class
+		if(blck->slabused == 0 && (blck->slabprev != 0 || blck->slabnext != 0)) {
+			if(blck->slabprev != 0)
+				blck->slabprev->slabnext = blck->slabnext;
+			else
+				slabs[idx] = blck->slabnext;
+			if(blck->slabnext != 0)
+				blck->slabnext->slabprev = blck->slabprev;
+
+			release_block(blck);
+		}
+	}
+	void* realloc_by_move(const realloc_data* dat) {
+		alloc_data adat = to_alloc_data(dat);
+		void* rtn = malloc_uncounted(&adat);
+		if(rtn == 0) return 0;
+		doMemMove((char*)rtn, (char*)dat->ptr, *dat);
+
+		dealloc_data ddat = init_dealloc_data_basic();
+		ddat.ptr = dat->ptr;
+		ddat.size = dat->from_byte_size;
+		ddat.alignment = dat->alignment;
+		ddat.size_of = dat->size_of;
+		ddat.minalignment = dat->minalignment;
+		ddat.byterounding = dat->byterounding;
+		do_free(&ddat);
+		return rtn;
+	}
+	//the size of a successful in place realloc changed
+	inline void* realloc_resized(void* rtn, const realloc_data& ldat) {
+		if(rtn != 0)
+			stats.bytes_live.set(stats.bytes_live.get() + ldat.to_byte_size - ldat.from_byte_size);
+		return rtn;
+	}
+	bool owns_pointer(void* ptr) {
+		memblock_base* blck = page_map_get(ptr);
+		return blck != 0 && blck->owner == this;
+	}
+
+	//virtual functions
+	const char* name() const {
+		return "rc_allocator";
+	}
+	void ctorCopy(void* dat) const {
+		new (dat) rc_allocator(*this);
+	}
+	void ctorMove(void* dat) {
+		new (dat) rc_allocator(std::move(*this));
+	}
+	rcmalloc::object_data getDataDesc() const {
+		return rcmalloc::object_data{(uint32_t)std::alignment_of<rc_allocator>(), sizeof(rc_allocator)};
+	}
+
+	bool do_get_stats(alloc_stats* out) const {
+		stats.read(out);
+		return true;
+	}
+
+	void* do_malloc(const alloc_data* dat) {
+		stats.size_histogram[stats_size_bucket(dat->size)].add(1);
+		void* rtn = malloc_uncounted(dat);
+		sample_malloc(sampler, rtn, dat->size);
+		return rtn;
+	}
+	//not counted as a request - moves and thread cache batches
+	void* malloc_uncounted(const alloc_data* dat) {
+		//handle alignment
+		//always allocate atleast one byte!
+		alloc_data ldat = *dat;
+		roundAllocation(ldat.minalignment, ldat.byterounding, ldat.size, ldat.alignment);
+		natural_alignment(ldat.alignment);
+		void* rtn = malloc_rounded(ldat);
+		if(rtn != 0)
+			stats.bytes_live.add(ldat.size);
+		return rtn;
+	}
+	void* malloc_rounded(const alloc_data& ldat) {
+		uint32_t idx;
+		if(offset_placed(ldat))
+			return internal_malloc_aligned_i(ldat.size, ldat.alignment, ldat.alignoffset);
+		if(slab_class_index(ldat.size, ldat.alignment, idx))
+			return slab_malloc(idx);
+		if(ldat.alignment < 2)
+			return internal_malloc_i(ldat.size);
+		return internal_malloc_aligned_i(ldat.size, ldat.alignment);
+	}
+	uint32_t do_malloc_batch(const alloc_data* dat, void** out, uint32_t count) {
+		uint32_t rtn = malloc_batch_uncounted(dat, out, count);
+		stats.size_histogram[stats_size_bucket(dat->size)].add(rtn);
+		for(uint32_t i = 0; i < rtn; ++i)
+			sample_malloc(sampler, out[i], dat->size);
+		return rtn;
+	}
+	//runs of objects are carved from one free extent, each object is freed on its own
+	uint32_t malloc_batch_uncounted(const alloc_data* dat, void** out, uint32_t count) {
+		alloc_data ldat = *dat;
+		roundAllocation(ldat.minalignment, ldat.byterounding, ldat.size, ldat.alignment);
+		natural_alignment(ldat.alignment);
+		rc_size_t size = round_granule(ldat.size);
+		uint32_t idx;
+		uint32_t done = 0;
+		if(!slab_class_index(ldat.size, ldat.alignment, idx) && ldat.alignment < 2 && !is_large(size)) {
+			//a run must not be large, that would be one mapping freed all at once
+			uint32_t maxrun = (uint32_t)(((AllocSize > DIRECT_MAP_MIN_SIZE ? AllocSize : DIRECT_MAP_MIN_SIZE) - 1) / size);
+			while(count - done >= 2) {
+				uint32_t run = count - done < maxrun ? count - done : maxrun;
+				//take what the largest free extent holds, a new block only if it holds less than two
+				uint32_t fits = freeindex.tree[1] / (uint32_t)size;
+				if(run > fits && fits >= 2)
+					run = fits;
+				char* nmem = (char*)internal_malloc_i(size * run);
+				if(nmem == 0) break;
+				for(uint32_t i = 0; i < run; ++i)
+					out[done++] = nmem + size * i;
+			}
+		}
+		for(; done < count; ++done) {
+			out[done] = malloc_rounded(ldat);
+			if(out[done] == 0) break;
+		}
+		stats.bytes_live.add(ldat.size * done);
+		return done;
+	}
+	void* do_realloc(const realloc_data* dat) {
+		if(dat->ptr == 0) {
+			alloc_data lclAllocDat = to_alloc_data(dat);
+			return do_malloc(&lclAllocDat);
+		}
+		//a sampled object keeps its sample, taken out so a new object at the old
+		//address can't be mistaken for it
+		bool resized = dat->from_byte_size != dat->to_byte_size;
+		heap_sample_bucket* smp = 0;
+		rc_size_t smpsize = 0;
+		if(resized && heap_sample_count.load(std::memory_order_relaxed) != 0)
+			smp = heap_sample_take(dat->ptr, smpsize);
+		void* rtn = realloc_i(dat);
+		if(rtn == dat->ptr)
+			stats.realloc_in_place.add(1);
+		else if(rtn != 0)
+			stats.realloc_moved.add(1);
+		if(smp != 0) {
+			//failed - still the old object
+			if(rtn == 0)
+				heap_sample_put(smp, dat->ptr, smpsize, smpsize);
+			else
+				heap_sample_put(smp, rtn, smpsize, dat->to_byte_size);
+		} else if(resized) {
+			sample_malloc(sampler, rtn, dat->to_byte_size);
+		}
+		return rtn;
+	}
+	void* realloc_i(const realloc_data* dat) {
+		realloc_data lclDat = *dat;
+		roundAllocation(lclDat);
+		natural_alignment(lclDat.alignment);
+		//always allocate atleast one byte, assume one byte was allocated last time!
+		if(lclDat.from_byte_size == lclDat.to_byte_size)
+			//just move the memory
+			return doMemMove((char*)lclDat.ptr, (char*)lclDat.ptr, lclDat);
+
+		//slab slots are a fixed size, move in or out of them
+		uint32_t idx;
+		if(slab_class_index(lclDat.from_byte_size, lclDat.alignment, idx) ||
+		   slab_class_index(lclDat.to_byte_size, lclDat.alignment, idx))
+			return realloc_by_move(dat);
+
+		//large allocations are remapped, move in or out of them
+		rc_size_t tosize = round_granule(lclDat.to_byte_size);
+		memblock_base* blck = page_map_get(lclDat.ptr);
+		bool remap = blck->large && is_large(tosize);
+		//over aligned allocations are moved to a new aligned placement, a remap
+		//keeps page alignment
+		if(lclDat.alignment >= 2 && !(remap && lclDat.alignment <= largepages->page_size()))
+			return realloc_by_move(dat);
+		if(remap)
+			return realloc_resized(realloc_large(blck, lclDat, tosize), lclDat);
+		if(blck->large || is_large(tosize))
+			return realloc_by_move(dat);
+
+		return realloc_resized(internal_realloc_i(&lclDat), lclDat);
+	}
+	void do_free(const dealloc_data* dat) {
+		//handle alignment
+		if(dat->ptr == 0)
+			return;
+		sample_free(dat->ptr);
+		dealloc_data ldat = *dat;
+		roundAllocation(ldat.minalignment, ldat.byterounding, ldat.size, ldat.alignment);
+		natural_alignment(ldat.alignment);
+		stats.bytes_live.sub(ldat.size);
+		uint32_t idx;
+		if(!offset_placed(ldat) && slab_class_index(ldat.size, ldat.alignment, idx)) {
+			slab_free(ldat.ptr);
+			return;
+		}
+		internal_free_i(ldat.ptr, ldat.size);
+	}
+	void do_free_batch(const dealloc_data* dat, void* const* ptrs, uint32_t count) {
+		dealloc_data ldat = *dat;
+		roundAllocation(ldat.minalignment, ldat.byterounding, ldat.size, ldat.alignment);
+		natural_alignment(ldat.alignment);
+		rc_size_t size = round_granule(ldat.size);
+		uint32_t idx;
+		bool slab = !offset_placed(ldat) && slab_class_index(ldat.size, ldat.alignment, idx);
+		//neighbouring objects in the same block are given back as one extent
+		char* run = 0;
+		rc_size_t runsize = 0;
+		memblock_base* runblck = 0;
+		for(uint32_t i = 0; i < count; ++i) {
+			char* ptr = (char*)ptrs[i];
+			if(ptr == 0) continue;
+			sample_free(ptr);
+			stats.bytes_live.sub(ldat.size);
+			if(slab) {
+				slab_free(ptr);
+				continue;
+			}
+			if(run != 0 && ptr == run + runsize && !runblck->large &&
+			   ptr + size <= runblck->ptr + runblck->bytetotal) {
+				runsize += size;
+				continue;
+			}
+			if(run != 0)
+				internal_free_i(run, runsize);
+			run = ptr;
+			runsize = size;
+			runblck = page_map_get(ptr);
+		}
+		if(run != 0)
+			internal_free_i(run, runsize);
+	}
+	//any thread, without the lock - false if the object can't hold the node or is
+	//a large mapping, those are freed under the lock
+	bool push_remote_free(const dealloc_data* dat, bool othernode = false) {
+		dealloc_data ldat = *dat;
+		roundAllocation(ldat.minalignment, ldat.byterounding, ldat.size, ldat.alignment);
+		if(ldat.size < sizeof(remote_free_node) || is_large(round_granule(ldat.size)))
+			return false;
+		sample_free(ldat.ptr);
+		remote_free_node* node = (remote_free_node*)ldat.ptr;
+		node->size = ldat.size;
+		node->othernode = othernode;
+		remotefree.push(node);
+		return true;
+	}
+	//under the lock, neighbouring objects in the same block are given back as one extent
+	void drain_remote_frees() {
+		if(remotefree.empty())
+			return;
+		remote_free_node* node = remotefree.take_all();
+		char* run = 0;
+		rc_size_t runsize = 0;
+		memblock_base* runblck = 0;
+		while(node != 0) {
+			remote_free_node* next = node->next;
+			char* ptr = (char*)node;
+			rc_size_t size = node->size;
+			stats.bytes_live.sub(size);
+			stats.remote_frees.add(1);
+			if(node->othernode)
+				stats.remote_node_frees.add(1);
+			memblock_base* blck = page_map_get(ptr);
+			if(blck->slabsize != 0) {
+				slab_free(ptr);
+			} else if(blck == runblck && ptr == run + runsize) {
+				runsize += round_granule(size);
+			} else if(blck == runblck && ptr + round_granule(size) == run) {
+				//pushed last freed first, so runs are often found backwards
+				run = ptr;
+				runsize += round_granule(size);
+			} else {
+				if(run != 0)
+					internal_free_i(run, runsize);
+				run = ptr;
+				runsize = round_granule(size);
+				runblck = blck;
+			}
+			node = next;
+		}
+		if(run != 0)
+			internal_free_i(run, runsize);
+	}
+};
+
+template<unsigned AllocSize,
+		 unsigned BlockID,
+		 typename Block = memblock>
+struct rc_internal_allocator {
+	rc_allocator<AllocSize, BlockID, Block> fa;
+
+	inline void* do_malloc(const alloc_data* dat) {
+		return fa.do_malloc(dat);
+	}
+	inline void* do_realloc(const realloc_data* dat) {
+		return fa.do_realloc(dat);
+	}
+	inline void do_free(const dealloc_data* dat) {
+		fa.do_free(dat);
+	}
+	inline uint32_t do_malloc_batch(const alloc_data* dat, void** out, uint32_t count) {
+		return fa.do_malloc_batch(dat, out, count);
+	}
+	inline void do_free_batch(const dealloc_data* dat, void* const* ptrs, uint32_t count) {
+		fa.do_free_batch(dat, ptrs, count);
+	}
+	void set_page_source(vpagesource* src) {
+		fa.set_page_source(src);
+	}
+	void trim() {
+		fa.trim();
+	}
+	void get_stats(alloc_stats* out) const {
+		fa.do_get_stats(out);
+	}
+	inline vallocator& get_allocator() {
+		return fa.get_allocator();
+	}
+};
+
+//locks for the Mtx parameter, the critical sections are short so they spin before they wait
+//all of them have lock, try_lock and unlock so they work with std::lock_guard
+const uint32_t LOCK_SPIN_COUNT = 128;
+
+//tell the cpu this is a spin loop
+inline void cpu_relax() {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	_mm_pause();
+#elif defined(__i386__) || defined(__x86_64__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+	__asm__ __volatile__("yield");
+#endif
+}
+//spin for a while, then let other threads run - the holder may not be running
+void lock_yield();
+inline void lock_backoff(uint32_t& spins) {
+	if(++spins < LOCK_SPIN_COUNT)
+		cpu_relax();
+	else
+		lock_yield();
+}
+
+//fifo spinlock, threads take a ticket and wait for it to be served
+//fair, so a waiter that isn't running holds up the rest - for no more threads than cores
+struct ticket_lock {
+	std::atomic<uint32_t> next{0};
+	std::atomic<uint32_t> serving{0};
+
+	inline void lock() {
+		uint32_t ticket = next.fetch_add(1, std::memory_order_relaxed);
+		uint32_t spins = 0;
+		while(serving.load(std::memory_order_acquire) != ticket)
+			lock_backoff(spins);
+	}
+	inline bool try_lock() {
+		uint32_t ticket = serving.load(std::memory_order_acquire);
+		return next.compare_exchange_strong(ticket, ticket + 1, std::memory_order_acquire,
+											std::memory_order_relaxed);
+	}
+	inline void unlock() {
+		serving.store(serving.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+};
+
+//queue lock, each waiter spins on its own node so the handover touches one cache line
+//fair like ticket_lock
+//lock(node)/unlock(node) use a node the caller keeps until unlocked (guard), lock()/unlock()
+//take a node from a per thread pool by lock so locks can be let go in any order
+const uint32_t MCS_MAX_HELD = 64;
+struct mcs_lock;
+struct mcs_node {
+	std::atomic<mcs_node*> next{0};
+	std::atomic<bool> locked{false};
+	//the lock a pool node is in use for, 0 when free
+	mcs_lock* owner = 0;
+};
+//a free node from the threads pool for lck, at most MCS_MAX_HELD in use at once
+mcs_node* mcs_take_node(mcs_lock* lck);
+//the pool node the thread holds or waits for lck with
+mcs_node* mcs_find_node(mcs_lock* lck);
+struct mcs_lock {
+	std::atomic<mcs_node*> tail{0};
+
+	//holds the lock for its scope, the node on the callers stack
+	struct guard {
+		mcs_lock& lck;
+		mcs_node node;
+
+		guard(mcs_lock& lck) : lck(lck) {
+			lck.lock(node);
+		}
+		~guard() {
+			lck.unlock(node);
+		}
+		guard(const guard&) = delete;
+		guard& operator=(const guard&) = delete;
+	};
+
+	inline void lock(mcs_node& node) {
+		node.next.store(0, std::memory_order_relaxed);
+		node.locked.store(true, std::memory_order_relaxed);
+		mcs_node* prev = tail.exchange(&node, std::memory_order_acq_rel);
+		if(prev != 0) {
+			prev->next.store(&node, std::memory_order_release);
+			uint32_t spins = 0;
+			while(node.locked.load(std::memory_order_acquire))
+				lock_backoff(spins);
+		}
+	}
+	inline bool try_lock(mcs_node& node) {
+		node.next.store(0, std::memory_order_relaxed);
+		mcs_node* empty = 0;
+		return tail.compare_exchange_strong(empty, &node, std::memory_order_acquire, std::memory_order_relaxed);
+	}
+	inline void unlock(mcs_node& node) {
+		mcs_node* next = node.next.load(std::memory_order_acquire);
+		if(next == 0) {
+			//no one waiting
+			mcs_node* self = &node;
+			if(tail.compare_exchange_strong(self, 0, std::memory_order_release, std::memory_order_relaxed))
+				return;
+			//a waiter is between taking the tail and linking itself in
+			uint32_t spins = 0;
+			while((next = node.next.load(std::memory_order_acquire)) == 0)
+				lock_backoff(spins);
+		}
+		next->locked.store(false, std::memory_order_release);
+	}
+	//Mtx interface, for std::lock_guard and the pools
+	inline void lock() {
+		lock(*mcs_take_node(this));
+	}
+	inline bool try_lock() {
+		mcs_node* node = mcs_take_node(this);
+		if(try_lock(*node))
+			return true;
+		node->owner = 0;
+		return false;
+	}
+	inline void unlock() {
+		mcs_node* node = mcs_find_node(this);
+		unlock(*node);
+		node->owner = 0;
+	}
+};
+
+//spins a while then sleeps in the kernel (futex on linux, yields elsewhere)
+//unfair, the running thread may take it again, so it holds up with more threads than cores
+//state is 0 unlocked, 1 locked, 2 locked and maybe a sleeper
+struct futex_mutex {
+	std::atomic<uint32_t> state{0};
+
+	inline void lock() {
+		uint32_t unlocked = 0;
+		if(!state.compare_exchange_strong(unlocked, 1, std::memory_order_acquire, std::memory_order_relaxed))
+			lock_slow();
+	}
+	inline bool try_lock() {
+		uint32_t unlocked = 0;
+		return state.compare_exchange_strong(unlocked, 1, std::memory_order_acquire, std::memory_order_relaxed);
+	}
+	inline void unlock() {
+		if(state.exchange(0, std::memory_order_release) == 2)
+			wake();
+	}
+	void lock_slow();
+	void wake();
+};
+
+//hold and wait times in nanoseconds
+struct lock_stats {
+	uint64_t acquisitions;
+	//had to wait
+	uint64_t contended;
+	uint64_t wait_ns;
+	uint64_t hold_ns;
+};
+uint64_t monotonic_ns();
+//any of the locks with contention counters, the counters are changed with the lock held
+template<typename Mtx>
+struct counted_lock {
+	Mtx mtx;
+	stat_counter acquisitions;
+	stat_counter contended;
+	stat_counter wait_ns;
+	stat_counter hold_ns;
+	uint64_t acquired = 0;
+
+	void lock() {
+		if(mtx.try_lock()) {
+			acquired = monotonic_ns();
+		} else {
+			uint64_t start = monotonic_ns();
+			mtx.lock();
+			acquired = monotonic_ns();
+			contended.add(1);
+			wait_ns.add(acquired - start);
+		}
+		acquisitions.add(1);
+	}
+	bool try_lock() {
+		if(!mtx.try_lock())
+			return false;
+		acquired = monotonic_ns();
+		acquisitions.add(1);
+		return true;
+	}
+	void unlock() {
+		hold_ns.add(monotonic_ns() - acquired);
+		mtx.unlock();
+	}
+	void get_stats(lock_stats* out) const {
+		out->acquisitions = acquisitions.get();
+		out->contended = contended.get();
+		out->wait_ns = wait_ns.get();
+		out->hold_ns = hold_ns.get();
+	}
+};
+
+template<typename Mtx = std::mutex,
+		 unsigned AllocSize = ALLOC_PAGE_SIZE,
+		 unsigned BlockID = 0,
+		 typename Block = memblock>
+struct rc_multi_threaded_internal_allocator {
+	Mtx mutex;
+	rc_allocator<AllocSize, BlockID, Block> fia;
+
+	void* do_malloc(const alloc_data* dat) {
+		std::lock_guard<Mtx> lg(mutex);
+		fia.stats.lock_acquisitions.add(1);
+		return fia.do_malloc(dat);
+	}
+	void* do_realloc(const realloc_data* dat) {
+		//for performance - don't lock on no change
+		if(dat->from_byte_size == dat->to_byte_size && dat->from_byte_size != 0)
+			//just move the memory
+			return doMemMove((char*)dat->ptr, (char*)dat->ptr, *dat);
+
+		std::lock_guard<Mtx> lg(mutex);
+		fia.stats.lock_acquisitions.add(1);
+		return fia.do_realloc(dat);
+	}
+	void do_free(const dealloc_data* dat) {
+		if(dat->ptr == 0) return;
+		std::lock_guard<Mtx> lg(mutex);
+		fia.stats.lock_acquisitions.add(1);
+		fia.do_free(dat);
+	}
+	//the lock is taken once for the whole batch
+	uint32_t do_malloc_batch(const alloc_data* dat, void** out, uint32_t count) {
+		std::lock_guard<Mtx> lg(mutex);
+		fia.stats.lock_acquisitions.add(1);
+		return fia.do_malloc_batch(dat, out, count);
+	}
+	void do_free_batch(const dealloc_data* dat, void* const* ptrs, uint32_t count) {
+		std::lock_guard<Mtx> lg(mutex);
+		fia.stats.lock_acquisitions.add(1);
+		fia.do_free_batch(dat, ptrs, count);
+	}
+	void set_page_source(vpagesource* src) {
+		std::lock_guard<Mtx> lg(mutex);
+		fia.set_page_source(src);
+	}
+	void trim() {
+		std::lock_guard<Mtx> lg(mutex);
+		fia.trim();
+	}
+	//counters are atomic so this does not take the lock
+	void get_stats(alloc_stats* out) const {
+		fia.do_get_stats(out);
+	}
+	inline vallocator& get_allocator() {
+		return fia.get_allocator();
+	}
+};
+
+const uint32_t THREAD_CACHE_MAX_SIZE = 256;
+const uint32_t THREAD_CACHE_BATCH_BYTES = 4096;
+const uint32_t THREAD_CACHE_MAX_BATCH = 64;
+//cache hits are counted per thread and handed to the shared statistics this often
+const uint32_t THREAD_CACHE_STATS_BATCH = 1024;
+//sizes above the slabs up to this are bumped out of a per thread chunk
+const uint32_t THREAD_BUMP_MAX_SIZE = 8 * 1024;
+const uint32_t THREAD_BUMP_CHUNK = 64 * 1024;
+
+//a per thread free list of one size class, linked through the free objects
+struct thread_cache_bin {
+	void* head;
+	uint32_t count;
+};
+//plain data so it stays valid while the thread is being torn down
+template<unsigned BinCount>
+struct thread_cache_data {
+	void* owner;
+	bool dead;
+	thread_cache_bin bins[BinCount];
+	//requests and moves not yet in the shared statistics
+	uint32_t pending;
+	uint32_t moved;
+	uint32_t requests[STATS_SIZE_BUCKETS];
+	heap_sampler sampler;
+	//the unused part of the bump chunk, counted as live until given back
+	char* bumpptr;
+	char* bumpend;
+	//granule rounding of bumped objects, live but not freed by the caller
+	uint32_t bumppad;
+};
+//drains the owning thread's cache back to the shared allocator on thread exit
+template<typename Owner>
+struct thread_cache_drainer {
+	Owner* owner = 0;
+	~thread_cache_drainer() {
+		if(owner != 0)
+			owner->drain_thread_cache();
+	}
+};
+
+inline uint32_t thread_cache_batch_count(uint32_t size) {
+	uint32_t cnt = THREAD_CACHE_BATCH_BYTES / size;
+	if(cnt < 2) return 2;
+	if(cnt > THREAD_CACHE_MAX_BATCH) return THREAD_CACHE_MAX_BATCH;
+	return cnt;
+}
+
+//small allocations are served from a per thread cache without taking the lock
+//the cache is refilled from and flushed to the shared allocator in batches
+//mid sized allocations are bumped out of a per thread chunk cut from one free extent
+//NOTE the cache is keyed on the allocator type - use as a global pool via default_allocator
+template<typename Mtx = std::mutex,
+		 unsigned AllocSize = ALLOC_PAGE_SIZE,
+		 unsigned BlockID = 0,
+		 typename Block = memblock>
+struct rc_thread_cached_internal_allocator {
+	static const uint32_t bin_count = THREAD_CACHE_MAX_SIZE / sizeof(uintptr_t);
+	typedef thread_cache_data<bin_count> cache_type;
+	typedef rc_thread_cached_internal_allocator<Mtx, AllocSize, BlockID, Block> this_type;
+
+	rc_multi_threaded_internal_allocator<Mtx, AllocSize, BlockID, Block> shrd;
+
+	static cache_type* get_thread_cache() {
+		static thread_local cache_type cache;
+		return &cache;
+	}
+	cache_type* get_owned_thread_cache() {
+		cache_type* cache = get_thread_cache();
+		if(cache->owner == this)
+			return cache;
+		if(cache->owner != 0 || cache->dead)
+			return 0;
+		//first use on this thread, register the drain on thread exit
+		static thread_local thread_cache_drainer<this_type> drainer;
+		drainer.owner = this;
+		cache->owner = this;
+		return cache;
+	}
+	//all cached objects share one layout, whatever the caller asked for
+	static inline bool cache_bin(rc_size_t size, uint32_t alignment, uint32_t& bin) {
+		if(size > THREAD_CACHE_MAX_SIZE || alignment > std::alignment_of<uintptr_t>())
+			return false;
+		bin = (uint32_t)(size - 1) / sizeof(uintptr_t);
+		return true;
+	}
+	static inline uint32_t bin_size(uint32_t bin) {
+		return (bin + 1) * sizeof(uintptr_t);
+	}
+	static alloc_data bin_alloc_data(uint32_t bin) {
+		alloc_data rtn = init_alloc_data_basic();
+		rtn.size = bin_size(bin);
+		rtn.alignment = std::alignment_of<uintptr_t>();
+		rtn.size_of = 1;
+		return rtn;
+	}
+	static dealloc_data bin_dealloc_data(uint32_t bin) {
+		dealloc_data rtn = init_dealloc_data_basic();
+		rtn.size = bin_size(bin);
+		rtn.alignment = std::alignment_of<uintptr_t>();
+		rtn.size_of = 1;
+		return rtn;
+	}
+
+	//call with the lock held
+	void merge_stats(cache_type* cache) {
+		if(cache->pending == 0) return;
+		for(uint32_t i = 0; i < STATS_SIZE_BUCKETS; ++i) {
+			if(cache->requests[i] == 0) continue;
+			shrd.fia.stats.size_histogram[i].add(cache->requests[i]);
+			cache->requests[i] = 0;
+		}
+		shrd.fia.stats.realloc_moved.add(cache->moved);
+		shrd.fia.stats.bytes_live.sub(cache->bumppad);
+		cache->moved = 0;
+		cache->bumppad = 0;
+		cache->pending = 0;
+	}
+	//a request or, for a realloc moving through the cache, a move
+	void count_request(cache_type* cache, rc_size_t size, bool request) {
+		if(request)
+			++cache->requests[stats_size_bucket(size)];
+		else
+			++cache->moved;
+		if(++cache->pending < THREAD_CACHE_STATS_BATCH) return;
+		std::lock_guard<Mtx> lg(shrd.mutex);
+		shrd.fia.stats.lock_acquisitions.add(1);
+		merge_stats(cache);
+	}
+
+	void* refill_bin(cache_type* cache, thread_cache_bin& bn, uint32_t bin) {
+		alloc_data adat = bin_alloc_data(bin);
+		uint32_t cnt = thread_cache_batch_count(adat.size);
+
+		std::lock_guard<Mtx> lg(shrd.mutex);
+		shrd.fia.stats.lock_acquisitions.add(1);
+		merge_stats(cache);
+		//the requests were counted by the cache
+		void* rtn = shrd.fia.malloc_uncounted(&adat);
+		if(rtn == 0) return 0;
+		for(uint32_t i = 1; i < cnt; ++i) {
+			void* nmem = shrd.fia.malloc_uncounted(&adat);
+			if(nmem == 0) break;
+			*(void**)nmem = bn.head;
+			bn.head = nmem;
+			++bn.count;
+		}
+		return rtn;
+	}
+	void flush_bin(cache_type* cache, thread_cache_bin& bn, uint32_t bin, uint32_t cnt) {
+		dealloc_data ddat = bin_dealloc_data(bin);
+
+		std::lock_guard<Mtx> lg(shrd.mutex);
+		shrd.fia.stats.lock_acquisitions.add(1);
+		merge_stats(cache);
+		for(; cnt > 0 && bn.head != 0; --cnt) {
+			ddat.ptr = bn.head;
+			bn.head = *(void**)bn.head;
+			--bn.count;
+			shrd.fia.do_free(&ddat);
+		}
+	}
+	//bumped objects are plain extents of the shared allocator, any thread frees them as usual
+	static inline bool bump_size(rc_size_t size, uint32_t alignment) {
+		uint32_t idx;
+		if(size > THREAD_BUMP_MAX_SIZE || alignment > Block::granule)
+			return false;
+		return !slab_class_index(size, 1, idx);
+	}
+	void* bump_malloc(cache_type* cache, const alloc_data* dat, rc_size_t size, bool request) {
+		uint32_t step = (uint32_t)rc_allocator<AllocSize, BlockID, Block>::round_granule(size);
+		if((uint32_t)(cache->bumpend - cache->bumpptr) < step && !refill_bump(cache))
+			return 0;
+		count_request(cache, dat->size, request);
+		void* rtn = cache->bumpptr;
+		cache->bumpptr += step;
+		cache->bumppad += step - (uint32_t)size;
+		sample_malloc(cache->sampler, rtn, dat->size);
+		return rtn;
+	}
+	bool refill_bump(cache_type* cache) {
+		std::lock_guard<Mtx> lg(shrd.mutex);
+		shrd.fia.stats.lock_acquisitions.add(1);
+		merge_stats(cache);
+		release_bump(cache);
+		char* nmem = (char*)shrd.fia.internal_malloc_i(THREAD_BUMP_CHUNK);
+		if(nmem == 0) return false;
+		shrd.fia.stats.bytes_live.add(THREAD_BUMP_CHUNK);
+		cache->bumpptr = nmem;
+		cache->bumpend = nmem + THREAD_BUMP_CHUNK;
+		return true;
+	}
+	//call with the lock held, the rest of the chunk goes back as one free extent
+	void release_bump(cache_type* cache) {
+		uint32_t rest = (uint32_t)(cache->bumpend - cache->bumpptr);
+		if(rest > 0) {
+			shrd.fia.internal_free_i(cache->bumpptr, rest);
+			shrd.fia.stats.bytes_live.sub(rest);
+		}
+		cache->bumpptr = 0;
+		cache->bumpend = 0;
+	}
+	void drain_thread_cache() {
+		cache_type* cache = get_thread_cache();
+		if(cache->owner == this) {
+			for(uint32_t i = 0; i < bin_count; ++i)
+				if(cache->bins[i].count > 0)
+					flush_bin(cache, cache->bins[i], i, cache->bins[i].count);
+			if(cache->pending > 0 || cache->bumpptr != 0) {
+				std::lock_guard<Mtx> lg(shrd.mutex);
+				merge_stats(cache);
+				release_bump(cache);
+			}
+		}
+		//any further allocation on this thread goes straight to the shared allocator
+		cache->owner = 0;
+		cache->dead = true;
+	}
+	void* realloc_by_move(const realloc_data* dat) {
+		alloc_data adat = to_alloc_data(dat);
+		void* rtn = malloc_i(&adat, false);
+		if(rtn == 0) return 0;
+		doMemMove((char*)rtn, (char*)dat->ptr, *dat);
+
+		//a sampled object keeps its sample at the new address
+		heap_sample_bucket* smp = 0;
+		rc_size_t smpsize = 0;
+		if(heap_sample_count.load(std::memory_order_relaxed) != 0)
+			smp = heap_sample_take(dat->ptr, smpsize);
+		dealloc_data ddat = init_dealloc_data_basic();
+		ddat.ptr = dat->ptr;
+		ddat.size = dat->from_byte_size;
+		ddat.alignment = dat->alignment;
+		ddat.size_of = dat->size_of;
+		ddat.minalignment = dat->minalignment;
+		ddat.byterounding = dat->byterounding;
+		do_free(&ddat);
+		if(smp != 0)
+			heap_sample_put(smp, rtn, smpsize, dat->to_byte_size);
+		return rtn;
+	}
+	//the shared allocator, counted as a request or as a move
+	void* shared_malloc(const alloc_data* dat, bool request) {
+		if(request)
+			return shrd.do_malloc(dat);
+		std::lock_guard<Mtx> lg(shrd.mutex);
+		shrd.fia.stats.lock_acquisitions.add(1);
+		void* rtn = shrd.fia.malloc_uncounted(dat);
+		if(rtn != 0)
+			shrd.fia.stats.realloc_moved.add(1);
+		sample_malloc(shrd.fia.sampler, rtn, dat->size);
+		return rtn;
+	}
+
+	void* do_malloc(const alloc_data* dat) {
+		return malloc_i(dat, true);
+	}
+	void* malloc_i(const alloc_data* dat, bool request) {
+		alloc_data ldat = *dat;
+		roundAllocation(ldat.minalignment, ldat.byterounding, ldat.size, ldat.alignment);
+		uint32_t bin;
+		if(!cache_bin(ldat.size, ldat.alignment, bin)) {
+			cache_type* cache;
+			if(bump_size(ldat.size, ldat.alignment) && (cache = get_owned_thread_cache()) != 0)
+				return bump_malloc(cache, dat, ldat.size, request);
+			return shared_malloc(dat, request);
+		}
+		cache_type* cache = get_owned_thread_cache();
+		if(cache == 0) {
+			alloc_data adat = bin_alloc_data(bin);
+			return shared_malloc(&adat, request);
+		}
+
+		count_request(cache, dat->size, request);
+		thread_cache_bin& bn = cache->bins[bin];
+		void* rtn;
+		if(bn.head == 0) {
+			rtn = refill_bin(cache, bn, bin);
+		} else {
+			rtn = bn.head;
+			bn.head = *(void**)rtn;
+			--bn.count;
+		}
+		sample_malloc(cache->sampler, rtn, dat->size);
+		return rtn;
+	}
+	void* do_realloc(const realloc_data* dat) {
+		if(dat->ptr == 0) {
+			alloc_data lclAllocDat = to_alloc_data(dat);
+			return do_malloc(&lclAllocDat);
+		}
+		//for performance - don't lock on no change
+		if(dat->from_byte_size == dat->to_byte_size)
+			//just move the memory
+			return doMemMove((char*)dat->ptr, (char*)dat->ptr, *dat);
+
+		realloc_data ldat = *dat;
+		roundAllocation(ldat);
+		uint32_t bin;
+		//cached objects don't have the callers layout, move them through the cache
+		if(cache_bin(ldat.from_byte_size, ldat.alignment, bin) ||
+		   cache_bin(ldat.to_byte_size, ldat.alignment, bin))
+			return realloc_by_move(dat);
+		return shrd.do_realloc(dat);
+	}
+	void do_free(const dealloc_data* dat) {
+		if(dat->ptr == 0) return;
+		dealloc_data ldat = *dat;
+		roundAllocation(ldat.minalignment, ldat.byterounding, ldat.size, ldat.alignment);
+		uint32_t bin;
+		if(!cache_bin(ldat.size, ldat.alignment, bin)) {
+			shrd.do_free(dat);
+			return;
+		}
+		cache_type* cache = get_owned_thread_cache();
+		if(cache == 0) {
+			dealloc_data ddat = bin_dealloc_data(bin);
+			ddat.ptr = ldat.ptr;
+			shrd.do_free(&ddat);
+			return;
+		}
+
+		sample_free(ldat.ptr);
+		thread_cache_bin& bn = cache->bins[bin];
+		*(void**)ldat.ptr = bn.head;
+		bn.head = ldat.ptr;
+		++bn.count;
+		//too many cached - give a batch back
+		uint32_t cnt = thread_cache_batch_count(bin_size(bin));
+		if(bn.count > 2 * cnt)
+			flush_bin(cache, bn, bin, cnt);
+	}
+	//cached sizes go through the cache one at a time, it takes no lock for them
+	uint32_t do_malloc_batch(const alloc_data* dat, void** out, uint32_t count) {
+		alloc_data ldat = *dat;
+		roundAllocation(ldat.minalignment, ldat.byterounding, ldat.size, ldat.alignment);
+		uint32_t bin;
+		if(cache_bin(ldat.size, ldat.alignment, bin)) {
+			for(uint32_t i = 0; i < count; ++i) {
+				out[i] = malloc_i(dat, true);
+				if(out[i] == 0)
+					return i;
+			}
+			return count;
+		}
+		return shrd.do_malloc_batch(dat, out, count);
+	}
+	void do_free_batch(const dealloc_data* dat, void* const* ptrs, uint32_t count) {
+		dealloc_data ldat = *dat;
+		roundAllocation(ldat.minalignment, ldat.byterounding, ldat.size, ldat.alignment);
+		uint32_t bin;
+		if(cache_bin(ldat.size, ldat.alignment, bin)) {
+			ldat = *dat;
+			for(uint32_t i = 0; i < count; ++i) {
+				ldat.ptr = ptrs[i];
+				do_free(&ldat);
+			}
+			return;
+		}
+		shrd.do_free_batch(dat, ptrs, count);
+	}
+	void set_page_source(vpagesource* src) {
+		shrd.set_page_source(src);
+	}
+	void trim() {
+		shrd.trim();
+	}
+	//cache hits of other threads may not be in the histogram yet
+	void get_stats(alloc_stats* out) const {
+		shrd.get_stats(out);
+	}
+	inline vallocator& get_allocator() {
+		return shrd.get_allocator();
+	}
+};
+
+enum arena_assignment {
+	//threads take the next arena in turn on first use
+	ARENA_ROUND_ROBIN,
+	//threads use the arena of the cpu they are running on
+	ARENA_BY_CPU,
+	//arena i is on numa node i % nodes and maps its blocks there, threads take the
+	//arenas of the node they are running on in turn - round robin with one node
+	ARENA_BY_NODE
+};
+
+const uint32_t ARENA_COUNT = 8;
+
+//each arena on its own cache line so the locks don't false share
+template<typename Mtx,
+		 unsigned AllocSize,
+		 unsigned BlockID,
+		 typename Block>
+struct alignas(CACHE_LINE_SIZE) rc_arena {
+	Mtx mutex;
+	rc_allocator<AllocSize, BlockID, Block> fia;
+};
+
+//N independent arenas each with their own lock, threads are spread over the arenas
+//frees and reallocs always go back to the arena that owns the pointer
+template<typename Mtx = std::mutex,
+		 unsigned AllocSize = ALLOC_PAGE_SIZE,
+		 unsigned BlockID = 0,
+		 unsigned ArenaCount = ARENA_COUNT,
+		 arena_assignment Assignment = ARENA_ROUND_ROBIN,
+		 typename Block = memblock>
+struct rc_sharded_internal_allocator {
+	typedef rc_arena<Mtx, AllocSize, BlockID, Block> arena_type;
+
+	arena_type arenas[ArenaCount];
+	std::atomic<uint32_t> next_arena{0};
+
+	rc_sharded_internal_allocator() {
+		if(Assignment != ARENA_BY_NODE || arena_nodes() < 2)
+			return;
+		for(uint32_t i = 0; i < ArenaCount; ++i) {
+			vpagesource* src = numa_node_page_source(i % arena_nodes());
+			arenas[i].fia.set_page_source(src);
+		}
+	}
+	//nodes with their own arenas
+	static uint32_t arena_nodes() {
+		uint32_t nodes = numa_node_count();
+		return nodes < ArenaCount ? nodes : ArenaCount;
+	}
+	uint32_t thread_arena() {
+		if(Assignment == ARENA_BY_CPU)
+			return current_cpu() % ArenaCount;
+		//0 is unassigned
+		static thread_local uint32_t arena = 0;
+		if(arena == 0)
+			arena = (next_arena.fetch_add(1, std::memory_order_relaxed) % ArenaCount) + 1;
+		if(Assignment == ARENA_BY_NODE) {
+			//looked up on every call so a thread moved to another node follows
+			uint32_t nodes = arena_nodes();
+			uint32_t node = current_numa_node() % nodes;
+			return node + nodes * ((arena - 1) % (ArenaCount / nodes));
+		}
+		return arena - 1;
+	}
+	//a free from another arena, crossing numa nodes only for ARENA_BY_NODE
+	bool push_remote_free(arena_type* arn, const dealloc_data* dat) {
+		bool othernode = false;
+		if(Assignment == ARENA_BY_NODE) {
+			uint32_t nodes = arena_nodes();
+			othernode = (uint32_t)(arn - arenas) % nodes != current_numa_node() % nodes;
+		}
+		return arn->fia.push_remote_free(dat, othernode);
+	}
+	//the block of ptr knows its allocator
+	arena_type* owning_arena(void* ptr) {
+		memblock_base* blck = page_map_get(ptr);
+		if(blck == 0) return 0;
+		//the allocator lives inside its arena
+		ptrdiff_t idx = dist((char*)arenas, (char*)blck->owner) / (ptrdiff_t)sizeof(arena_type);
+		if(idx < 0 || idx >= (ptrdiff_t)ArenaCount) return 0;
+		return &arenas[idx];
+	}
+	arena_type* lock_owning_arena(void* ptr) {
+		arena_type* arn = owning_arena(ptr);
+		if(arn == 0) return 0;
+		arn->mutex.lock();
+		arn->fia.stats.lock_acquisitions.add(1);
+		return arn;
+	}
+
+	void* do_malloc(const alloc_data* dat) {
+		arena_type& arn = arenas[thread_arena()];
+		std::lock_guard<Mtx> lg(arn.mutex);
+		arn.fia.stats.lock_acquisitions.add(1);
+		arn.fia.drain_remote_frees();
+		return arn.fia.do_malloc(dat);
+	}
+	void* do_realloc(const realloc_data* dat) {
+		if(dat->ptr == 0) {
+			alloc_data lclAllocDat = to_alloc_data(dat);
+			return do_malloc(&lclAllocDat);
+		}
+		//for performance - don't lock on no change
+		if(dat->from_byte_size == dat->to_byte_size)
+			//just move the memory
+			return doMemMove((char*)dat->ptr, (char*)dat->ptr, *dat);
+
+		arena_type* arn = lock_owning_arena(dat->ptr);
+		if(arn == 0) return 0;
+		std::lock_guard<Mtx> lg(arn->mutex, std::adopt_lock);
+		arn->fia.drain_remote_frees();
+		return arn->fia.do_realloc(dat);
+	}
+	//another arena's pointer is queued for its owner without taking the lock
+	void do_free(const dealloc_data* dat) {
+		if(dat->ptr == 0) return;
+		arena_type* arn = owning_arena(dat->ptr);
+		if(arn == 0) return;
+		if(arn != &arenas[thread_arena()] && push_remote_free(arn, dat))
+			return;
+		std::lock_guard<Mtx> lg(arn->mutex);
+		arn->fia.stats.lock_acquisitions.add(1);
+		arn->fia.do_free(dat);
+	}
+	uint32_t do_malloc_batch(const alloc_data* dat, void** out, uint32_t count) {
+		arena_type& arn = arenas[thread_arena()];
+		std::lock_guard<Mtx> lg(arn.mutex);
+		arn.fia.stats.lock_acquisitions.add(1);
+		arn.fia.drain_remote_frees();
+		return arn.fia.do_malloc_batch(dat, out, count);
+	}
+	//queued for other arenas, one lock for each run of pointers owned by this one
+	void do_free_batch(const dealloc_data* dat, void* const* ptrs, uint32_t count) {
+		arena_type* own = &arenas[thread_arena()];
+		dealloc_data ldat = *dat;
+		uint32_t i = 0;
+		while(i < count) {
+			arena_type* arn = ptrs[i] == 0 ? 0 : owning_arena(ptrs[i]);
+			if(arn == 0) {
+				++i;
+				continue;
+			}
+			ldat.ptr = ptrs[i];
+			if(arn != own && push_remote_free(arn, &ldat)) {
+				++i;
+				continue;
+			}
+			std::lock_guard<Mtx> lg(arn->mutex);
+			arn->fia.stats.lock_acquisitions.add(1);
+			uint32_t end = i + 1;
+			while(end < count && (ptrs[end] == 0 || owning_arena(ptrs[end]) == arn))
+				++end;
+			arn->fia.do_free_batch(dat, ptrs + i, end - i);
+			i = end;
+		}
+	}
+	void set_page_source(vpagesource* src) {
+		for(uint32_t i = 0; i < ArenaCount; ++i) {
+			std::lock_guard<Mtx> lg(arenas[i].mutex);
+			arenas[i].fia.set_page_source(src);
+		}
+	}
+	void trim() {
+		for(uint32_t i = 0; i < ArenaCount; ++i) {
+			std::lock_guard<Mtx> lg(arenas[i].mutex);
+			arenas[i].fia.drain_remote_frees();
+			arenas[i].fia.trim();
+		}
+	}
+	//summed over the arenas
+	void get_stats(alloc_stats* out) const {
+		*out = init_alloc_stats();
+		for(uint32_t i = 0; i < ArenaCount; ++i) {
+			alloc_stats arn;
+			arenas[i].fia.do_get_stats(&arn);
+			add_alloc_stats(*out, arn);
+		}
+	}
+	inline vallocator& get_allocator() {
+		return arenas[thread_arena()].fia.get_allocator();
+	}
+};
+
+//every allocation of the pool owns its cache lines, see isolate_cache_lines
+//any of the internal allocators, e.g. rc_cache_line_isolated_allocator<rc_sharded_internal_allocator<>>
+template<typename IAllocator>
+struct rc_cache_line_isolated_allocator {
+	IAllocator ia;
+
+	void* do_malloc(const alloc_data* dat) {
+		alloc_data ldat = *dat;
+		isolate_cache_lines(ldat);
+		return ia.do_malloc(&ldat);
+	}
+	void* do_realloc(const realloc_data* dat) {
+		realloc_data ldat = *dat;
+		isolate_cache_lines(ldat);
+		return ia.do_realloc(&ldat);
+	}
+	void do_free(const dealloc_data* dat) {
+		dealloc_data ldat = *dat;
+		isolate_cache_lines(ldat);
+		ia.do_free(&ldat);
+	}
+	uint32_t do_malloc_batch(const alloc_data* dat, void** out, uint32_t count) {
+		alloc_data ldat = *dat;
+		isolate_cache_lines(ldat);
+		return ia.do_malloc_batch(&ldat, out, count);
+	}
+	void do_free_batch(const dealloc_data* dat, void* const* ptrs, uint32_t count) {
+		dealloc_data ldat = *dat;
+		isolate_cache_lines(ldat);
+		ia.do_free_batch(&ldat, ptrs, count);
+	}
+	void set_page_source(vpagesource* src) {
+		ia.set_page_source(src);
+	}
+	void trim() {
+		ia.trim();
+	}
+	void get_stats(alloc_stats* out) const {
+		ia.get_stats(out);
+	}
+	inline vallocator& get_allocator() {
+		return ia.get_allocator();
+	}
+};
+
+template<typename T,
+		 typename IAllocator = rc_multi_threaded_internal_allocator<std::mutex, ALLOC_PAGE_SIZE, 0>>
+struct default_allocator {
+	typedef T value_type;
+	typedef T& reference;
+	typedef T const& const_reference;
+	typedef T* pointer;
+	typedef T const* const_pointer;
+	typedef ptrdiff_t difference_type;
+
+	inline void* allocate(const alloc_data* dat) {
+		IAllocator* allocator = get_global_object<IAllocator>();
+		return allocator->do_malloc(dat);
+	}
+	inline void* reallocate(const realloc_data* dat) {
+		IAllocator* allocator = get_global_object<IAllocator>();
+		return allocator->do_realloc(dat);
+	}
+	inline void deallocate(const dealloc_data* dat) {
+		IAllocator* allocator = get_global_object<IAllocator>();
+		allocator->do_free(dat);
+	}
+	//count objects of dat->size, returns how many were allocated into out
+	inline uint32_t allocate_batch(const alloc_data* dat, void** out, uint32_t count) {
+		IAllocator* allocator = get_global_object<IAllocator>();
+		return allocator->do_malloc_batch(dat, out, count);
+	}
+	inline void deallocate_batch(const dealloc_data* dat, void* const* ptrs, uint32_t count) {
+		IAllocator* allocator = get_global_object<IAllocator>();
+		allocator->do_free_batch(dat, ptrs, count);
+	}
+	inline vallocator& get_allocator() {
+		IAllocator* allocator = get_global_object<IAllocator>();
+		return allocator->get_allocator();
+	}
+	inline const vallocator& get_allocator() const {
+		IAllocator* allocator = get_global_object<IAllocator>();
+		return allocator->get_allocator();
+	}
+};
+
+template<typename T,
+		 typename IAllocator = rc_multi_threaded_internal_allocator<std::mutex, ALLOC_PAGE_SIZE, 0>>
+using allocator = default_allocator<T, IAllocator>;
+
+template<typename T,
+		 typename IAllocator = default_allocator<T>>
+struct default_std_allocator {
+	typedef T value_type;
+	typedef T& reference;
+	typedef T const& const_reference;
+	typedef T* pointer;
+	typedef T const* const_pointer;
+	typedef std::size_t size_type;
+	typedef ptrdiff_t difference_type;
+	typedef std::true_type propagate_on_container_move_assignment;
+	typedef std::true_type is_always_equal;
+	IAllocator allctr;
+
+	pointer allocate(size_type n, const void* hint = 0) {
+		//the byte size would be cut short in rc_size_t
+		if(n > max_size())
+			throw std::bad_array_new_length();
+		alloc_data dat = init_alloc_data<value_type>();
+		dat.size = (rc_size_t)(n * sizeof(value_type));
+		return (pointer)allctr.allocate(&dat);
+	}
+
+	void deallocate(T* p, std::size_t n) {
+		dealloc_data dat = init_dealloc_data<value_type>();
+		dat.ptr = p;
+		dat.size = n * sizeof(value_type);
+		allctr.deallocate(&dat);
+	}
+
+	inline size_type max_size() const noexcept {
+		if(std::numeric_limits<rc_size_t>::max() < std::numeric_limits<size_type>::max())
+			return (size_type)std::numeric_limits<rc_size_t>::max() / sizeof(value_type);
+		return std::numeric_limits<size_type>::max() / sizeof(value_type);
+	}
+
+	inline void construct(pointer p, const_reference val) {
+		new ((void*)p) T(val);
+	}
+	inline void destroy(pointer p) {
+		p->~T();
+	}
+};
+
+template<class T1, class T2, typename IAllocator>
+inline bool operator==(const default_std_allocator<T1, IAllocator>& lhs, const default_std_allocator<T2, IAllocator>& rhs) noexcept {
+	return true;
+}
+template<class T1, class T2, typename IAllocator>
+inline bool operator!=(const default_std_allocator<T1, IAllocator>& lhs, const default_std_allocator<T2, IAllocator>& rhs) noexcept {
+	return false;
+}
+
+template<typename Alloc>
+typename Alloc::pointer allocate_init_count(rc_size_t cnt) {
+	//allocate using the allocator
+	Alloc allctr;
+	alloc_data dat = init_alloc_data<typename Alloc::value_type>();
+	dat.size = sizeof(typename Alloc::value_type) * cnt;
+	typename Alloc::pointer rtn = (typename Alloc::pointer)allctr.allocate(&dat);
+	//do init
+	typename Alloc::pointer tmp = rtn;
+	for(rc_size_t i = 0; i < cnt; ++i, ++tmp)
+		new (tmp) typename Alloc::value_type;
+	return rtn;
+}
+template<typename Alloc>
+typename Alloc::pointer allocate_init_count(rc_size_t cnt, const typename Alloc::value_type& val) {
+	//allocate using the allocator
+	Alloc allctr;
+	alloc_data dat = init_alloc_data<typename Alloc::value_type>();
+	dat.size = sizeof(typename Alloc::value_type) * cnt;
+	typename Alloc::pointer rtn = (typename Alloc::pointer)allctr.allocate(&dat);
+	//do init
+	typename Alloc::pointer tmp = rtn;
+	for(rc_size_t i = 0; i < cnt; ++i, ++tmp)
+		new (tmp) typename Alloc::value_type(val);
+	return rtn;
+}
+
+template<typename Alloc>
+inline typename Alloc::pointer allocate_init() {
+	return allocate_init_count< Alloc >(1);
+}
+
+template<typename Alloc>
+inline typename Alloc::pointer allocate_init(const typename Alloc::value_type& val) {
+	//allocate using the allocator
+	Alloc allctr;
+	alloc_data dat = init_alloc_data<typename Alloc::value_type>();
+	dat.size = sizeof(typename Alloc::value_type);
+	typename Alloc::pointer rtn = (typename Alloc::pointer)allctr.allocate(&dat);
+	new (rtn) typename Alloc::value_type(val);
+	return rtn;
+}
+
+template<typename Alloc>
+inline typename Alloc::pointer allocate_init(typename Alloc::value_type&& val) {
+	//allocate using the allocator
+	Alloc allctr;
+	alloc_data dat = init_alloc_data<typename Alloc::value_type>();
+	dat.size = sizeof(typename Alloc::value_type);
+	typename Alloc::pointer rtn = (typename Alloc::pointer)allctr.allocate(&dat);
+	new (rtn) typename Alloc::value_type(std::move(val));
+	return rtn;
+}
+
+template<typename Alloc>
+void destruct_deallocate_count(typename Alloc::pointer ptr, rc_size_t cnt,
+							   uint32_t alignment = std::alignment_of<typename Alloc::value_type>(),
+							   uint32_t size_of = sizeof(typename Alloc::value_type)) {
+	if(ptr == 0)
+		return;
+	//do destruct
+	using X = typename Alloc::value_type;
+	typename Alloc::pointer tmp = ptr;
+	for(rc_size_t i = 0; i < cnt; ++i, ++tmp)
+		tmp[i].~X();
+	//deallocate using the allocator
+	Alloc allctr;
+	dealloc_data dat = init_dealloc_data<typename Alloc::value_type>();
+	dat.ptr = ptr;
+	dat.size = sizeof(typename Alloc::value_type) * cnt;
+	dat.alignment = alignment;
+	dat.size_of = size_of;
+	allctr.deallocate(&dat);
+}
+
+template<typename Alloc>
+inline void destruct_deallocate(typename Alloc::pointer ptr,
+								uint32_t alignment = std::alignment_of<typename Alloc::value_type>(),
+								uint32_t size_of = sizeof(typename Alloc::value_type)) {
+	destruct_deallocate_count< Alloc >(ptr, 1, alignment, size_of);
+}
+
+template<typename T>
+inline T* new_T() {
+	return allocate_init< default_allocator< T > >();
+}
+template<typename T>
+inline T* new_T(const T& val) {
+	return allocate_init< default_allocator< T > >(val);
+}
+template<typename T>
+inline T* new_T(T&& val) {
+	return allocate_init< default_allocator< T > >(std::move(val));
+}
+template<typename T>
+inline T* new_T_array(rc_size_t cnt) {
+	return allocate_init_count< default_allocator< T > >(cnt);
+}
+template<typename T>
+inline T* new_T_array(const T& val, rc_size_t cnt) {
+	return allocate_init_count< default_allocator< T > >(cnt, val);
+}
+
+template<typename T>
+inline void delete_T(T* ptr) {
+	destruct_deallocate_count< default_allocator< T > >(ptr, 1);
+}
+template<typename T>
+inline void delete_T_array(T* ptr, rc_size_t cnt) {
+	destruct_deallocate_count< default_allocator< T > >(ptr, cnt);
+}
+
+}
@@ -0,0 +1,346 @@
+/*----------------------------------------------------------------------------------*\
+ |																					|
+ | rcmalloc_c.cpp 	 																|
+ |																					|
+ | Copyright (c) 2019 Richard Cookman												|
+ |																					|
+ | Permission is hereby granted, free of charge, to any person obtaining a copy		|
+ | of this software and associated documentation files (the "Software"), to deal	|
+ | in the Software without restriction, including without limitation the rights		|
+ | to use, copy, modify, merge, publish, distribute, sublicense, and/or sell		|
+ | copies of the Software, and to permit persons to whom the Software is			|
+ | furnished to do so, subject to the following conditions:							|
+ |																					|
+ | The above copyright notice and this permission notice shall be included in all	|
+ | copies or substantial portions of the Software.									|
+ |																					|
+ | THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR		|
+ | IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,			|
+ | FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE		|
+ | AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER			|
+ | LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,	|
+ | OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE	|
+ | SOFTWARE.																		|
+ |																					|
+\*----------------------------------------------------------------------------------*/
+
+#include "rcmalloc_c.h"
+#include "rcmalloc.hpp"
+
+#include <errno.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+#if defined(RCMALLOC_OVERRIDE_MALLOC)
+#include <pthread.h>
+#endif
+
+using namespace rcmalloc;
+
+//the C functions share one sharded pool of tlsf blocks
+const uint32_t C_ALLOC_BLOCK_SIZE = 256 * 1024;
+//every pointer is aligned for any type, max_align_t - also the room for the header
+const size_t C_ALLOC_ALIGNMENT = 16;
+//sizes are rc_size_t, bigger requests fail with ENOMEM
+const size_t C_ALLOC_MAX_SIZE = std::numeric_limits<rc_size_t>::max() >> 1;
+
+typedef rc_sharded_internal_allocator<std::mutex, C_ALLOC_BLOCK_SIZE, 0, ARENA_COUNT,
+									  ARENA_ROUND_ROBIN, tlsf_memblock> c_allocator;
+
+//just before every pointer handed out, free has no size - the pools pointer is always
+//C_ALLOC_ALIGNMENT before the callers
+struct c_alloc_header {
+	//bytes allocated from the pool
+	rc_size_t total;
+	//the placement asked of the pool, C_ALLOC_ALIGNMENT unless over aligned
+	rc_size_t alignment;
+};
+
+static c_allocator* c_pool() {
+	//never destroyed, free is called during and after static destruction
+	alignas(c_allocator) static char storage[sizeof(c_allocator)];
+	static c_allocator* pool = new (storage) c_allocator();
+	return pool;
+}
+static inline c_alloc_header* c_header(void* ptr) {
+	return (c_alloc_header*)ptr - 1;
+}
+//not from the pool - allocated before rcmalloc took over malloc
+static inline bool c_foreign(void* ptr) {
+	return page_map_get(ptr) == 0;
+}
+
+//every size given to the pool is a multiple of C_ALLOC_ALIGNMENT, so the extents and
+//slab slots it hands out are aligned to it at the granule - an aligned placement
+//would make every realloc a move
+template<typename Data>
+static inline void c_pool_layout(Data& dat) {
+	dat.size_of = 1;
+	dat.minalignment = tlsf_memblock::granule;
+	dat.byterounding = C_ALLOC_ALIGNMENT;
+	dat.alignment = tlsf_memblock::granule;
+}
+//over aligned - the callers pointer, after the header, is the aligned address
+template<typename Data>
+static inline void c_pool_layout(Data& dat, size_t alignment) {
+	c_pool_layout(dat);
+	if(alignment > C_ALLOC_ALIGNMENT) {
+		dat.alignment = (uint32_t)alignment;
+		dat.alignoffset = C_ALLOC_ALIGNMENT;
+	}
+}
+static inline rc_size_t c_round(size_t size) {
+	return (rc_size_t)((size + C_ALLOC_ALIGNMENT - 1) & ~(C_ALLOC_ALIGNMENT - 1));
+}
+
+//alignment is a power of two
+static void* c_alloc(size_t size, size_t alignment) {
+	if(alignment < C_ALLOC_ALIGNMENT)
+		alignment = C_ALLOC_ALIGNMENT;
+	//the pool takes 32 bit alignments
+	if(alignment > ((size_t)1 << 31) || alignment > C_ALLOC_MAX_SIZE ||
+	   size > C_ALLOC_MAX_SIZE - alignment - C_ALLOC_ALIGNMENT) {
+		errno = ENOMEM;
+		return 0;
+	}
+	alloc_data dat = init_alloc_data_basic();
+	c_pool_layout(dat, alignment);
+	dat.size = c_round(size) + C_ALLOC_ALIGNMENT;
+	char* base = (char*)c_pool()->do_malloc(&dat);
+	if(base == 0) {
+		errno = ENOMEM;
+		return 0;
+	}
+	char* rtn = base + C_ALLOC_ALIGNMENT;
+	c_header(rtn)->total = dat.size;
+	c_header(rtn)->alignment = (rc_size_t)alignment;
+	return rtn;
+}
+static void c_dealloc(void* ptr) {
+	c_alloc_header* hdr = c_header(ptr);
+	dealloc_data dat = init_dealloc_data_basic();
+	c_pool_layout(dat, hdr->alignment);
+	dat.ptr = (char*)ptr - C_ALLOC_ALIGNMENT;
+	dat.size = hdr->total;
+	c_pool()->do_free(&dat);
+}
+static inline bool is_power_of_two(size_t v) {
+	return v != 0 && (v & (v - 1)) == 0;
+}
+
+extern "C" {
+
+void* rc_malloc(size_t size) {
+	return c_alloc(size, C_ALLOC_ALIGNMENT);
+}
+void rc_free(void* ptr) {
+	if(ptr == 0 || c_foreign(ptr))
+		return;
+	c_dealloc(ptr);
+}
+void* rc_realloc(void* ptr, size_t size) {
+	if(ptr == 0)
+		return c_alloc(size, C_ALLOC_ALIGNMENT);
+	if(size == 0) {
+		rc_free(ptr);
+		return 0;
+	}
+	if(c_foreign(ptr)) {
+#if defined(RCMALLOC_OVERRIDE_MALLOC)
+		return meta_realloc(ptr, size);
+#else
+		errno = ENOMEM;
+		return 0;
+#endif
+	}
+	c_alloc_header* hdr = c_header(ptr);
+	rc_size_t usable = hdr->total - C_ALLOC_ALIGNMENT;
+	//over aligned, realloc doesn't keep the alignment so start again
+	if(hdr->alignment != C_ALLOC_ALIGNMENT) {
+		void* rtn = c_alloc(size, C_ALLOC_ALIGNMENT);
+		if(rtn == 0) return 0;
+		memcpy(rtn, ptr, usable < size ? usable : size);
+		c_dealloc(ptr);
+		return rtn;
+	}
+	if(size > C_ALLOC_MAX_SIZE - 2 * C_ALLOC_ALIGNMENT) {
+		errno = ENOMEM;
+		return 0;
+	}
+
+	//grow or shrink in place where the pool can, keeping the header
+	realloc_data dat = init_realloc_data_basic();
+	c_pool_layout(dat);
+	dat.ptr = (char*)ptr - C_ALLOC_ALIGNMENT;
+	dat.from_byte_size = hdr->total;
+	dat.to_byte_size = c_round(size) + C_ALLOC_ALIGNMENT;
+	dat.keep_byte_size_1 = C_ALLOC_ALIGNMENT + (usable < size ? usable : (rc_size_t)size);
+	dat.istrivial = true;
+	char* base = (char*)c_pool()->do_realloc(&dat);
+	if(base == 0) {
+		errno = ENOMEM;
+		return 0;
+	}
+	char* rtn = base + C_ALLOC_ALIGNMENT;
+	c_header(rtn)->total = dat.to_byte_size;
+	return rtn;
+}
+void* rc_calloc(size_t count, size_t size) {
+	size_t total = count * size;
+	if(size != 0 && total / size != count) {
+		errno = ENOMEM;
+		return 0;
+	}
+	void* rtn = c_alloc(total, C_ALLOC_ALIGNMENT);
+	if(rtn != 0)
+		memset(rtn, 0, total);
+	return rtn;
+}
+int rc_posix_memalign(void** memptr, size_t alignment, size_t size) {
+	if(!is_power_of_two(alignment) || alignment % sizeof(void*) != 0)
+		return EINVAL;
+	int err = errno;
+	void* rtn = c_alloc(size, alignment);
+	if(rtn == 0) {
+		errno = err;
+		return ENOMEM;
+	}
+	*memptr = rtn;
+	return 0;
+}
+void* rc_aligned_alloc(size_t alignment, size_t size) {
+	if(!is_power_of_two(alignment)) {
+		errno = EINVAL;
+		return 0;
+	}
+	return c_alloc(size, alignment);
+}
+void* rc_memalign(size_t alignment, size_t size) {
+	//like glibc, round up to a power of two
+	if(alignment > C_ALLOC_MAX_SIZE) {
+		errno = EINVAL;
+		return 0;
+	}
+	size_t al = C_ALLOC_ALIGNMENT;
+	while(al < alignment)
+		al <<= 1;
+	return c_alloc(size, al);
+}
+void* rc_valloc(size_t size) {
+	return c_alloc(size, ALLOC_PAGE_SIZE);
+}
+void* rc_pvalloc(size_t size) {
+	if(size > C_ALLOC_MAX_SIZE) {
+		errno = ENOMEM;
+		return 0;
+	}
+	return c_alloc((size + ALLOC_PAGE_SIZE - 1) & ~(size_t)(ALLOC_PAGE_SIZE - 1), ALLOC_PAGE_SIZE);
+}
+size_t rc_malloc_usable_size(void* ptr) {
+	if(ptr == 0 || c_foreign(ptr))
+		return 0;
+	return c_header(ptr)->total - C_ALLOC_ALIGNMENT;
+}
+int rc_malloc_trim(size_t /*pad*/) {
+	c_pool()->trim();
+	return 1;
+}
+struct rc_mallinfo rc_mallinfo(void) {
+	alloc_stats st;
+	c_pool()->get_stats(&st);
+	struct rc_mallinfo rtn;
+	rtn.arena = st.bytes_mapped;
+	rtn.ordblks = st.block_count;
+	rtn.hblks = st.large_count;
+	//not tracked apart from the blocks
+	rtn.hblkhd = 0;
+	rtn.uordblks = st.bytes_live;
+	rtn.fordblks = st.bytes_free;
+	rtn.keepcost = st.largest_free;
+	return rtn;
+}
+
+#if defined(RCMALLOC_OVERRIDE_MALLOC)
+void* malloc(size_t size) noexcept {
+	return rc_malloc(size);
+}
+void free(void* ptr) noexcept {
+	rc_free(ptr);
+}
+void* realloc(void* ptr, size_t size) noexcept {
+	return rc_realloc(ptr, size);
+}
+void* calloc(size_t count, size_t size) noexcept {
+	return rc_calloc(count, size);
+}
+int posix_memalign(void** memptr, size_t alignment, size_t size) noexcept {
+	return rc_posix_memalign(memptr, alignment, size);
+}
+void* aligned_alloc(size_t alignment, size_t size) noexcept {
+	return rc_aligned_alloc(alignment, size);
+}
+void* memalign(size_t alignment, size_t size) noexcept {
+	return rc_memalign(alignment, size);
+}
+void* valloc(size_t size) noexcept {
+	return rc_valloc(size);
+}
+void* pvalloc(size_t size) noexcept {
+	return rc_pvalloc(size);
+}
+size_t malloc_usable_size(void* ptr) noexcept {
+	return rc_malloc_usable_size(ptr);
+}
+int malloc_trim(size_t pad) noexcept {
+	return rc_malloc_trim(pad);
+}
+struct mallinfo mallinfo(void) noexcept {
+	struct rc_mallinfo inf = rc_mallinfo();
+	struct mallinfo rtn;
+	memset(&rtn, 0, sizeof(rtn));
+	rtn.arena = (int)inf.arena;
+	rtn.ordblks = (int)inf.ordblks;
+	rtn.hblks = (int)inf.hblks;
+	rtn.hblkhd = (int)inf.hblkhd;
+	rtn.uordblks = (int)inf.uordblks;
+	rtn.fordblks = (int)inf.fordblks;
+	rtn.keepcost = (int)inf.keepcost;
+	return rtn;
+}
+#if __GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33)
+struct mallinfo2 mallinfo2(void) noexcept {
+	struct rc_mallinfo inf = rc_mallinfo();
+	struct mallinfo2 rtn;
+	memset(&rtn, 0, sizeof(rtn));
+	rtn.arena = inf.arena;
+	rtn.ordblks = inf.ordblks;
+	rtn.hblks = inf.hblks;
+	rtn.hblkhd = inf.hblkhd;
+	rtn.uordblks = inf.uordblks;
+	rtn.fordblks = inf.fordblks;
+	rtn.keepcost = inf.keepcost;
+	return rtn;
+}
+#endif
+#endif
+
+}
+
+#if defined(RCMALLOC_OVERRIDE_MALLOC)
+//no arena lock may be held across fork or the child deadlocks on its first malloc
+static void c_fork_prepare() {
+	c_allocator* pool = c_pool();
+	for(uint32_t i = 0; i < ARENA_COUNT; ++i)
+		pool->arenas[i].mutex.lock();
+}
+static void c_fork_release() {
+	c_allocator* pool = c_pool();
+	for(uint32_t i = ARENA_COUNT; i-- > 0;)
+		pool->arenas[i].mutex.unlock();
+}
+//at load, before anything can be holding a lock
+__attribute__((constructor)) static void c_alloc_init() {
+	c_pool();
+	pthread_atfork(c_fork_prepare, c_fork_release, c_fork_release);
+}
+#endif
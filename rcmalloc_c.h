@@ -0,0 +1,70 @@
+/*----------------------------------------------------------------------------------*\
+ |																					|
+ | rcmalloc_c.h   	 																|
+ |																					|
+ | Copyright (c) 2019 Richard Cookman												|
+ |																					|
+ | Permission is hereby granted, free of charge, to any person obtaining a copy		|
+ | of this software and associated documentation files (the "Software"), to deal	|
+ | in the Software without restriction, including without limitation the rights		|
+ | to use, copy, modify, merge, publish, distribute, sublicense, and/or sell		|
+ | copies of the Software, and to permit persons to whom the Software is			|
+ | furnished to do so, subject to the following conditions:							|
+ |																					|
+ | The above copyright notice and this permission notice shall be included in all	|
+ | copies or substantial portions of the Software.									|
+ |																					|
+ | THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR		|
+ | IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,			|
+ | FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE		|
+ | AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER			|
+ | LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,	|
+ | OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE	|
+ | SOFTWARE.																		|
+ |																					|
+\*----------------------------------------------------------------------------------*/
+#pragma once
+
+#include <stddef.h>
+
+//the C allocation functions on top of rcmalloc
+//built with RCMALLOC_OVERRIDE_MALLOC rcmalloc_c.cpp also exports them as malloc, free...
+//so the library can be LD_PRELOADed into unmodified programs (glibc only)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//mallinfo with size_t fields
+struct rc_mallinfo {
+	//bytes in blocks and large mappings
+	size_t arena;
+	//blocks
+	size_t ordblks;
+	//large mappings
+	size_t hblks;
+	size_t hblkhd;
+	//bytes handed out
+	size_t uordblks;
+	//bytes mapped but not handed out
+	size_t fordblks;
+	//largest free extent
+	size_t keepcost;
+};
+
+void* rc_malloc(size_t size);
+void rc_free(void* ptr);
+void* rc_realloc(void* ptr, size_t size);
+void* rc_calloc(size_t count, size_t size);
+int rc_posix_memalign(void** memptr, size_t alignment, size_t size);
+void* rc_aligned_alloc(size_t alignment, size_t size);
+void* rc_memalign(size_t alignment, size_t size);
+void* rc_valloc(size_t size);
+void* rc_pvalloc(size_t size);
+size_t rc_malloc_usable_size(void* ptr);
+int rc_malloc_trim(size_t pad);
+struct rc_mallinfo rc_mallinfo(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,140 +1,222 @@
-/*----------------------------------------------------------------------------------*\
- |																					|
- | rcnewdelete.cpp	 																|
- |																					|
- | Copyright (c) 2019 Richard Cookman												|
- |																					|
- | Permission is hereby granted, free of charge, to any person obtaining a copy		|
- | of this software and associated documentation files (the "Software"), to deal	|
- | in the Software without restriction, including without limitation the rights		|
- | to use, copy, modify, merge, publish, distribute, sublicense, and/or sell		|
- | copies of the Software, and to permit persons to whom the Software is			|
- | furnished to do so, subject to the following conditions:							|
- |																					|
- | The above copyright notice and this permission notice shall be included in all	|
- | copies or substantial portions of the Software.									|
- |																					|
- | THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR		|
- | IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,			|
- | FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE		|
- | AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER			|
- | LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,	|
- | OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE	|
- | SOFTWARE.																		|
- |																					|
-\*----------------------------------------------------------------------------------*/
-
-#include "rcnewdelete.hpp"
-
-void* aligned_new_allocate(std::size_t count, size_t al) {
-	rcmalloc::default_allocator<char> alloc;
-
-	rcmalloc::alloc_data adat = rcmalloc::init_alloc_data_basic();
-	unsigned count_alignment = std::alignment_of<uint32_t>();
-
-	unsigned offset = 0;
-	if(count_alignment >= al) {
-		adat.size = count + sizeof(uint32_t);
-		adat.size_of = 1;
-		offset = sizeof(uint32_t);
-	} else {
-		adat.size = count + al;
-		adat.size_of = 1;
-		offset = al;
-	}
-	adat.alignment = (std::alignment_of<uint32_t>() > al ? std::alignment_of<uint32_t>() : al);
-	void* rtn = alloc.allocate(&adat);
-	*((unsigned*)rtn) = count;
-	return (char*)rtn + offset;
-}
-inline void* general_new_allocate(std::size_t count) {
-	return aligned_new_allocate(count, std::alignment_of<void*>());
-}
-
-//replace allocator new and delete
-void* operator new(std::size_t count) STLIB_NEWTHROW {
-	return general_new_allocate(count);
-}
-void* operator new[](std::size_t count) STLIB_NEWTHROW {
-	return general_new_allocate(count);
-}
-#if __cpp_aligned_new
-void* operator new(std::size_t count, std::align_val_t al) STLIB_NEWTHROW {
-	return aligned_new_allocate(count, (const size_t&)al);
-}
-void* operator new[](std::size_t count, std::align_val_t al) STLIB_NEWTHROW {
-	return aligned_new_allocate(count, (const size_t&)al);
-}
-#endif
-void* operator new(std::size_t count, const std::nothrow_t&) noexcept {
-	return general_new_allocate(count);
-}
-void* operator new[](std::size_t count, const std::nothrow_t&) noexcept {
-	return general_new_allocate(count);
-}
-#if __cpp_aligned_new
-void* operator new(std::size_t count,
-				   std::align_val_t al, const std::nothrow_t&) noexcept {
-	return aligned_new_allocate(count, (const size_t&)al);
-}
-void* operator new[](std::size_t count,
-					 std::align_val_t al, const std::nothrow_t&) noexcept {
-	return aligned_new_allocate(count, (const size_t&)al);
-}
-#endif
-
-
-void aligned_delete_deallocate(void* ptr, size_t al) {
-	rcmalloc::default_allocator<char> alloc;
-
-	unsigned count_alignment = std::alignment_of<uint32_t>();
-	unsigned offset = 0;
-	if(count_alignment >= al)
-		offset = sizeof(uint32_t);
-	else
-		offset = al;
-	ptr = (char*)ptr - offset;
-	size_t sz = *(unsigned*)ptr + offset;
-
-	rcmalloc::dealloc_data ddat = rcmalloc::init_dealloc_data_basic();
-	ddat.ptr = ptr;
-	ddat.size = sz;
-	ddat.alignment = (std::alignment_of<uint32_t>() > al ? std::alignment_of<uint32_t>() : al);
-	ddat.size_of = 1;
-	alloc.deallocate(&ddat);
-}
-inline void general_delete_deallocate(void* ptr) {
-	aligned_delete_deallocate(ptr, std::alignment_of<void*>());
-}
-
-void operator delete(void* ptr) noexcept {
-	general_delete_deallocate(ptr);
-}
-void operator delete[](void* ptr) noexcept {
-	general_delete_deallocate(ptr);
-}
-#if __cpp_aligned_new
-void operator delete(void* ptr, std::align_val_t al) noexcept {
-	aligned_delete_deallocate(ptr, (const size_t&)al);
-}
-void operator delete[](void* ptr, std::align_val_t al) noexcept {
-	aligned_delete_deallocate(ptr, (const size_t&)al);
-}
-#endif
-void operator delete(void* ptr, std::size_t sz) noexcept {
-	general_delete_deallocate(ptr);
-}
-void operator delete[](void* ptr, std::size_t sz) noexcept {
-	general_delete_deallocate(ptr);
-}
-#if __cpp_aligned_new
-void operator delete(void* ptr, std::size_t sz,
-					 std::align_val_t al) noexcept {
-	aligned_delete_deallocate(ptr, (const size_t&)al);
-}
-void operator delete[](void* ptr, std::size_t sz,
-					   std::align_val_t al) noexcept {
-	aligned_delete_deallocate(ptr, (const size_t&)al);
-}
-#endif
-
+/*----------------------------------------------------------------------------------*\
+ |																					|
+ | rcnewdelete.cpp	 																|
+ |																					|
+ | Copyright (c) 2019 Richard Cookman												|
+ |																					|
+ | Permission is hereby granted, free of charge, to any person obtaining a copy		|
+ | of this software and associated documentation files (the "Software"), to deal	|
+ | in the Software without restriction, including without limitation the rights		|
+ | to use, copy, modify, merge, publish, distribute, sublicense, and/or sell		|
+ | copies of the Software, and to permit persons to whom the Software is			|
+ | furnished to do so, subject to the following conditions:							|
+ |																					|
+ | The above copyright notice and this permission notice shall be included in all	|
+ | copies or substantial portions of the Software.									|
+ |																					|
+ | THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR		|
+ | IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,			|
+ | FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE		|
+ | AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER			|
+ | LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,	|
+ | OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE	|
+ | SOFTWARE.																		|
+ |																					|
+\*----------------------------------------------------------------------------------*/
+
+#include "rcnewdelete.hpp"
+
+#include <stddef.h>
+
+//small news/deletes are served from per thread caches without taking the pool lock
+typedef rcmalloc::rc_thread_cached_internal_allocator<std::mutex, rcmalloc::ALLOC_PAGE_SIZE, 0> new_delete_allocator;
+
+//objects don't carry their size, the block knows it or sized delete gives it
+//slab objects - size class rounded so the slot size is the object size
+//large objects - page rounded so the mapping size is the object size
+//anything else keeps a header, small next to the object
+enum new_layout {
+	NEW_SLAB,
+	NEW_LARGE,
+	NEW_HEADER
+};
+//in front of NEW_HEADER objects
+struct new_header {
+	//bytes allocated from the pool
+	rcmalloc::rc_size_t total;
+	//from the pools pointer to the callers
+	rcmalloc::rc_size_t offset;
+};
+//the pools natural alignment, given without padding - slots and headers line objects up beyond it
+const uint32_t NEW_POOL_ALIGNMENT = sizeof(uintptr_t);
+//plain new, what the compiler assumes of it
+#if defined(__STDCPP_DEFAULT_NEW_ALIGNMENT__)
+const size_t NEW_ALIGNMENT = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+#else
+const size_t NEW_ALIGNMENT = alignof(max_align_t);
+#endif
+const size_t NEW_MAX_SIZE = std::numeric_limits<rcmalloc::rc_size_t>::max() >> 1;
+
+//the same for new and sized delete of the same count and al
+static inline new_layout new_placement(size_t count, size_t al, rcmalloc::rc_size_t& size) {
+	if(count == 0) count = 1;
+	if(count <= rcmalloc::SLAB_MAX_SIZE && al <= rcmalloc::SLAB_MAX_SIZE) {
+		//slots are at multiples of their size from a page aligned block
+		uint32_t idx;
+		rcmalloc::slab_class_index((uint32_t)count, 1, idx);
+		while(rcmalloc::slab_class_size(idx) % al != 0)
+			++idx;
+		size = rcmalloc::slab_class_size(idx);
+		return NEW_SLAB;
+	}
+	size_t pages = (count + rcmalloc::ALLOC_PAGE_SIZE - 1) & ~(size_t)(rcmalloc::ALLOC_PAGE_SIZE - 1);
+	if(pages >= rcmalloc::DIRECT_MAP_MIN_SIZE && al <= rcmalloc::ALLOC_PAGE_SIZE) {
+		size = (rcmalloc::rc_size_t)pages;
+		return NEW_LARGE;
+	}
+	//the header then the object rounded up to al from a NEW_POOL_ALIGNMENT pointer
+	size_t pad = sizeof(new_header) + (al > NEW_POOL_ALIGNMENT ? al - NEW_POOL_ALIGNMENT : 0);
+	size = (rcmalloc::rc_size_t)((count + pad + NEW_POOL_ALIGNMENT - 1) & ~(size_t)(NEW_POOL_ALIGNMENT - 1));
+	return NEW_HEADER;
+}
+static inline rcmalloc::alloc_data new_alloc_data(rcmalloc::rc_size_t size) {
+	rcmalloc::alloc_data rtn = rcmalloc::init_alloc_data_basic();
+	rtn.size = size;
+	rtn.alignment = NEW_POOL_ALIGNMENT;
+	rtn.size_of = 1;
+	return rtn;
+}
+static inline void new_deallocate(void* ptr, rcmalloc::rc_size_t size) {
+	rcmalloc::default_allocator<char, new_delete_allocator> alloc;
+
+	rcmalloc::dealloc_data ddat = rcmalloc::init_dealloc_data_basic();
+	ddat.ptr = ptr;
+	ddat.size = size;
+	ddat.alignment = NEW_POOL_ALIGNMENT;
+	ddat.size_of = 1;
+	alloc.deallocate(&ddat);
+}
+
+//0 on failure
+void* aligned_new_allocate(std::size_t count, size_t al) {
+	rcmalloc::default_allocator<char, new_delete_allocator> alloc;
+
+	if(al > NEW_MAX_SIZE || count > NEW_MAX_SIZE - al)
+		return 0;
+	rcmalloc::rc_size_t size;
+	new_layout layout = new_placement(count, al, size);
+	rcmalloc::alloc_data adat = new_alloc_data(size);
+	char* rtn = (char*)alloc.allocate(&adat);
+	if(rtn == 0 || layout != NEW_HEADER)
+		return rtn;
+
+	char* obj = (char*)(((uintptr_t)rtn + sizeof(new_header) + al - 1) & ~((uintptr_t)al - 1));
+	new_header* hdr = (new_header*)obj - 1;
+	hdr->total = size;
+	hdr->offset = (rcmalloc::rc_size_t)(obj - rtn);
+	return obj;
+}
+inline void* general_new_allocate(std::size_t count) {
+	return aligned_new_allocate(count, NEW_ALIGNMENT);
+}
+inline void* throw_on_fail(void* ptr) {
+	if(ptr == 0)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+//replace allocator new and delete
+void* operator new(std::size_t count) STLIB_NEWTHROW {
+	return throw_on_fail(general_new_allocate(count));
+}
+void* operator new[](std::size_t count) STLIB_NEWTHROW {
+	return throw_on_fail(general_new_allocate(count));
+}
+#if __cpp_aligned_new
+void* operator new(std::size_t count, std::align_val_t al) STLIB_NEWTHROW {
+	return throw_on_fail(aligned_new_allocate(count, (const size_t&)al));
+}
+void* operator new[](std::size_t count, std::align_val_t al) STLIB_NEWTHROW {
+	return throw_on_fail(aligned_new_allocate(count, (const size_t&)al));
+}
+#endif
+void* operator new(std::size_t count, const std::nothrow_t&) noexcept {
+	return general_new_allocate(count);
+}
+void* operator new[](std::size_t count, const std::nothrow_t&) noexcept {
+	return general_new_allocate(count);
+}
+#if __cpp_aligned_new
+void* operator new(std::size_t count,
+				   std::align_val_t al, const std::nothrow_t&) noexcept {
+	return aligned_new_allocate(count, (const size_t&)al);
+}
+void* operator new[](std::size_t count,
+					 std::align_val_t al, const std::nothrow_t&) noexcept {
+	return aligned_new_allocate(count, (const size_t&)al);
+}
+#endif
+
+
+//no size - slab and large objects get it from their block
+void aligned_delete_deallocate(void* ptr, size_t /*al*/) {
+	if(ptr == 0) return;
+	rcmalloc::memblock_base* blck = rcmalloc::page_map_get(ptr);
+	if(blck->slabsize != 0) {
+		new_deallocate(ptr, blck->slabsize);
+		return;
+	}
+	//over aligned large objects are NEW_HEADER, not at the start of the mapping
+	if(blck->large && ptr == blck->ptr) {
+		new_deallocate(ptr, blck->bytetotal);
+		return;
+	}
+	new_header* hdr = (new_header*)ptr - 1;
+	new_deallocate((char*)ptr - hdr->offset, hdr->total);
+}
+inline void general_delete_deallocate(void* ptr) {
+	aligned_delete_deallocate(ptr, NEW_ALIGNMENT);
+}
+//sized delete - no page map lookup unless there is a header
+void sized_delete_deallocate(void* ptr, size_t sz, size_t al) {
+	if(ptr == 0) return;
+	rcmalloc::rc_size_t size;
+	if(new_placement(sz, al, size) != NEW_HEADER) {
+		new_deallocate(ptr, size);
+		return;
+	}
+	new_header* hdr = (new_header*)ptr - 1;
+	new_deallocate((char*)ptr - hdr->offset, hdr->total);
+}
+
+void operator delete(void* ptr) noexcept {
+	general_delete_deallocate(ptr);
+}
+void operator delete[](void* ptr) noexcept {
+	general_delete_deallocate(ptr);
+}
+#if __cpp_aligned_new
+void operator delete(void* ptr, std::align_val_t al) noexcept {
+	aligned_delete_deallocate(ptr, (const size_t&)al);
+}
+void operator delete[](void* ptr, std::align_val_t al) noexcept {
+	aligned_delete_deallocate(ptr, (const size_t&)al);
+}
+#endif
+void operator delete(void* ptr, std::size_t sz) noexcept {
+	sized_delete_deallocate(ptr, sz, NEW_ALIGNMENT);
+}
+void operator delete[](void* ptr, std::size_t sz) noexcept {
+	sized_delete_deallocate(ptr, sz, NEW_ALIGNMENT);
+}
+#if __cpp_aligned_new
+void operator delete(void* ptr, std::size_t sz,
+					 std::align_val_t al) noexcept {
+	sized_delete_deallocate(ptr, sz, (const size_t&)al);
+}
+void operator delete[](void* ptr, std::size_t sz,
+					   std::align_val_t al) noexcept {
+	sized_delete_deallocate(ptr, sz, (const size_t&)al);
+}
+#endif
+